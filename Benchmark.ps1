@@ -0,0 +1,173 @@
+###############################################################################
+# MParallel - Parallel Batch Processor
+# Copyright (c) 2016 LoRd_MuldeR <mulder2@gmx.de>. Some rights reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+# http://www.gnu.org/licenses/gpl-2.0.txt
+###############################################################################
+
+# End-to-end benchmark: runs the same synthetic workloads through MParallel,
+# "xargs -P" and GNU parallel, appends one CSV row per run to the output file.
+#
+# Usage: powershell -ExecutionPolicy Bypass -File Benchmark.ps1 [-Tools mparallel,xargs] [-Counts 1,4,8] [-Tasks 100,1000] [-MParallelArgs --shell]
+
+param(
+	[string]$MParallel       = (Join-Path $PSScriptRoot "bin\v100\win32\Release\MParallel.exe"),
+	[string]$ToolsPath       = "C:\Program Files\Git\usr\bin",
+	[string]$ParallelScript  = "",
+	[string[]]$MParallelArgs = @(),
+	[string[]]$Tools         = @("mparallel", "xargs", "parallel"),
+	[string[]]$Workloads     = @("noop", "sleep", "skewed", "output"),
+	[int[]]$Counts           = @(1, 2, 4, [Environment]::ProcessorCount),
+	[int[]]$Tasks            = @(100, 1000),
+	[int]$Repeat             = 3,
+	[string]$Output          = (Join-Path $PSScriptRoot "benchmark.csv")
+)
+
+$ErrorActionPreference = "Stop"
+
+# Scheduler CPU time and peak memory, queried from the process handle (works after the process has exited)
+Add-Type -TypeDefinition @"
+using System;
+using System.Runtime.InteropServices;
+public static class BenchNative
+{
+	[StructLayout(LayoutKind.Sequential)]
+	private struct PROCESS_MEMORY_COUNTERS
+	{
+		public uint cb, PageFaultCount;
+		public UIntPtr PeakWorkingSetSize, WorkingSetSize, QuotaPeakPagedPoolUsage, QuotaPagedPoolUsage;
+		public UIntPtr QuotaPeakNonPagedPoolUsage, QuotaNonPagedPoolUsage, PagefileUsage, PeakPagefileUsage;
+	}
+	[DllImport("kernel32.dll", SetLastError = true)]
+	private static extern bool GetProcessTimes(IntPtr process, out long creation, out long exit, out long kernel, out long user);
+	[DllImport("psapi.dll", SetLastError = true)]
+	private static extern bool GetProcessMemoryInfo(IntPtr process, out PROCESS_MEMORY_COUNTERS counters, uint size);
+	public static double GetCpuSeconds(IntPtr process)
+	{
+		long creation, exit, kernel, user;
+		return GetProcessTimes(process, out creation, out exit, out kernel, out user) ? (kernel + user) / 10000000.0 : -1.0;
+	}
+	public static double GetPeakMemoryMB(IntPtr process)
+	{
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(process, out counters, (uint)Marshal.SizeOf(typeof(PROCESS_MEMORY_COUNTERS))) ? counters.PeakWorkingSetSize.ToUInt64() / 1048576.0 : -1.0;
+	}
+}
+"@
+
+# Write the task list of the workload, one complete command per line
+function New-TaskList([string]$Workload, [int]$TaskCount, [string]$FileName, [string]$BlobFile)
+{
+	$bin = $ToolsPath.Replace('\', '/')
+	$lines = New-Object System.Collections.Generic.List[string]
+	for ($i = 0; $i -lt $TaskCount; $i++)
+	{
+		switch ($Workload)
+		{
+			"noop"   { $lines.Add("`"$bin/true.exe`"") }
+			"sleep"  { $lines.Add("`"$bin/sleep.exe`" 0.1") }
+			"skewed" { $lines.Add("`"$bin/sha256sum.exe`"" + (" `"$BlobFile`"" * [Math]::Floor(64 / (1 + ($i % 16))))) }
+			"output" { $lines.Add("`"$bin/seq.exe`" 1 20000") }
+			default  { throw "Unknown workload: $Workload" }
+		}
+	}
+	[System.IO.File]::WriteAllLines($FileName, $lines)
+}
+
+# Run the task list through the tool, returns $null if the tool is not available
+function Invoke-Tool([string]$Tool, [int]$Count, [string]$ListFile, [string]$WorkDir)
+{
+	$stdin = $null
+	switch ($Tool)
+	{
+		"mparallel" { $exe = $MParallel;                        $arguments = @("--count=$Count", "--silent", "--input=`"$ListFile`"") + $MParallelArgs }
+		"xargs"     { $exe = Join-Path $ToolsPath "xargs.exe"; $arguments = @("-P", "$Count", "-L", "1", "`"$(Join-Path $ToolsPath 'env.exe')`""); $stdin = $ListFile }
+		"parallel"  { $exe = Join-Path $ToolsPath "perl.exe";  $arguments = @("`"$ParallelScript`"", "--will-cite", "-j", "$Count"); $stdin = $ListFile }
+		default     { throw "Unknown tool: $Tool" }
+	}
+	if ((-not (Test-Path $exe)) -or (($Tool -eq "parallel") -and ((-not $ParallelScript) -or (-not (Test-Path $ParallelScript)))))
+	{
+		return $null
+	}
+
+	$options = @{ FilePath = $exe; ArgumentList = $arguments; NoNewWindow = $true; PassThru = $true;
+		RedirectStandardOutput = (Join-Path $WorkDir "stdout.txt"); RedirectStandardError = (Join-Path $WorkDir "stderr.txt") }
+	if ($stdin)
+	{
+		$options.RedirectStandardInput = $stdin
+	}
+
+	$timer = [System.Diagnostics.Stopwatch]::StartNew()
+	$process = Start-Process @options
+	$handle = $process.Handle # keep the handle open, so the stats survive the exit
+	$process.WaitForExit()
+	$timer.Stop()
+
+	return @{ Makespan = $timer.Elapsed.TotalSeconds; CpuTime = [BenchNative]::GetCpuSeconds($handle);
+		PeakMemory = [BenchNative]::GetPeakMemoryMB($handle); ExitCode = $process.ExitCode }
+}
+
+# Prepare the work directory, including a 1 MB file for the CPU burners
+$workDir = Join-Path ([System.IO.Path]::GetTempPath()) ("MParallel_Bench_" + [Guid]::NewGuid().ToString("N"))
+New-Item -ItemType Directory -Path $workDir | Out-Null
+$blobFile = (Join-Path $workDir "blob.bin").Replace('\', '/')
+$blob = New-Object byte[] 1048576
+(New-Object System.Random 42).NextBytes($blob)
+[System.IO.File]::WriteAllBytes($blobFile, $blob)
+
+if (-not (Test-Path $Output))
+{
+	"date,host,tool,workload,count,tasks,repeat,makespan_s,tasks_per_s,scheduler_cpu_s,peak_rss_mb,exit_code" | Out-File -FilePath $Output -Encoding ascii
+}
+
+try
+{
+	$date = (Get-Date).ToString("s")
+	foreach ($workload in $Workloads)
+	{
+		foreach ($taskCount in $Tasks)
+		{
+			$listFile = Join-Path $workDir "$workload-$taskCount.txt"
+			New-TaskList $workload $taskCount $listFile $blobFile
+			foreach ($count in ($Counts | Sort-Object -Unique))
+			{
+				foreach ($tool in $Tools)
+				{
+					for ($run = 1; $run -le $Repeat; $run++)
+					{
+						$result = Invoke-Tool $tool $count $listFile $workDir
+						if (-not $result)
+						{
+							Write-Warning "Skipping $tool, because it was not found."
+							break
+						}
+						$rate = if ($result.Makespan -gt 0) { $taskCount / $result.Makespan } else { 0 }
+						$row = [string]::Format([System.Globalization.CultureInfo]::InvariantCulture, "{0},{1},{2},{3},{4},{5},{6},{7:F3},{8:F1},{9:F3},{10:F1},{11}",
+							$date, $env:COMPUTERNAME, $tool, $workload, $count, $taskCount, $run, $result.Makespan, $rate, $result.CpuTime, $result.PeakMemory, $result.ExitCode)
+						$row | Out-File -FilePath $Output -Encoding ascii -Append
+						Write-Host ("{0,-9} {1,-6} count={2,-3} tasks={3,-6} #{4}: {5:F3} s, {6:F1} tasks/s, scheduler CPU {7:F3} s, peak RSS {8:F1} MB" -f
+							$tool, $workload, $count, $taskCount, $run, $result.Makespan, $rate, $result.CpuTime, $result.PeakMemory)
+					}
+				}
+			}
+		}
+	}
+}
+finally
+{
+	Remove-Item -Recurse -Force $workDir
+}
@@ -26,7 +26,9 @@
 #include <cassert>
 #include <sstream>
 #include <cstring>
-#include <queue>
+#include <deque>
+#include <map>
+#include <vector>
 #include <algorithm>
 #include <ctime>
 #include <io.h>
@@ -36,10 +38,12 @@
 #include <cstdarg>
 #include <csignal>
 #include <sys/stat.h>
+#include <process.h>
 
 //Win32
 #include <ShellAPI.h>
 #include <MMSystem.h>
+#include <WinSock2.h>
 
 //VLD
 #include <vld.h>
@@ -49,13 +53,23 @@ static const wchar_t *const DEFAULT_SEP = L":";
 static const size_t MAX_TASKS = MAXIMUM_WAIT_OBJECTS - 1;
 static const wchar_t *const FILE_DELIMITERS = L"/\\:";
 static const wchar_t *const BLANK_STR = L"";
+static const wchar_t RECORD_SEP = L'\x1F';
+static const DWORD KILL_TIMEOUT = 10000;
 
 //Instance
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define MY_HINSTANCE ((HINSTANCE)&__ImageBase)
 
 //Types
-typedef std::queue<std::wstring> queue_t;
+typedef struct _task_t
+{
+	std::wstring command;
+	std::wstring stdin_file;
+	std::wstring stdout_file;
+	std::wstring stderr_file;
+	DWORD        retries;
+}
+task_t;
 
 //Priority classes
 typedef enum _priority_t
@@ -69,13 +83,68 @@ typedef enum _priority_t
 }
 priority_t;
 
+//Task types
+typedef enum _task_type_t
+{
+	TASK_PROCESS = 0U,
+	TASK_SHELL   = 1U,
+	TASK_WORKER  = 2U,
+	TASK_PIPELINE = 3U,
+	TASK_BUILTIN = 4U
+}
+task_type_t;
+
+//Shard modes
+typedef enum _shard_mode_t
+{
+	SHARD_HASH = 0U,
+	SHARD_LINE = 1U,
+	SHARD_SIZE = 2U
+}
+shard_mode_t;
+
+//Task status
+typedef enum _task_status_t
+{
+	TASK_PENDING  = 0U,
+	TASK_COMPLETE = 1U,
+	TASK_LOST     = 2U
+}
+task_status_t;
+
+//Halting modes
+typedef enum _halt_mode_t
+{
+	HALT_NEVER = 0U,
+	HALT_SOON  = 1U,
+	HALT_NOW   = 2U
+}
+halt_mode_t;
+
+//Finalizer of SplitMix64, spreads the bits of a 64-Bit hash value
+static inline ULONGLONG mix64(ULONGLONG x)
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
 //Options
 namespace options
 {
 	static bool         abort_on_failure;
 	static bool         auto_quote_vars;
+	static bool         auto_shell;
+	static bool         batch_adaptive;
+	static DWORD        batch_max_args;
+	static DWORD        batch_max_chars;
+	static bool         batch_mode;
+	static DWORD        bench_parse_count;
+	static DWORD        bench_queue_count;
 	static std::wstring command_pattern;
+	static std::wstring coprocess_command;
 	static bool         detached_console;
+	static bool         disable_builtins;
 	static bool         disable_concolor;
 	static bool         disable_jobctrl;
 	static bool         disable_lineargv;
@@ -83,19 +152,54 @@ namespace options
 	static bool         disable_prboost;
 	static bool         discard_textouts;
 	static bool         enable_notifysnd;
+	static bool         enable_summary;
 	static bool         enable_tracing;
 	static bool         encoding_utf16;
+	static std::wstring find_mtime;
+	static std::wstring find_name;
+	static std::wstring find_root;
+	static std::wstring find_size;
 	static bool         force_use_shell;
+	static DWORD        halt_mode;
+	static bool         halt_on_success;
+	static bool         halt_percent;
+	static DWORD        halt_threshold;
+	static DWORD        kill_grace;
+	static DWORD        limit_cpu;
+	static ULONGLONG    limit_io_bandwidth;
+	static ULONGLONG    limit_io_ops;
+	static ULONGLONG    limit_memory;
 	static bool         ignore_exitcode;
 	static std::wstring input_file_name;
+	static bool         jobserver;
+	static bool         keep_order;
+	static bool         link_sources;
 	static std::wstring log_file_name;
+	static bool         log_format_json;
 	static DWORD        max_instances;
+	static std::wstring metrics_file_name;
+	static DWORD        metrics_interval;
+	static DWORD        metrics_port;
+	static std::wstring partition_file_name;
+	static bool         persistent_shell;
+	static DWORD        pipe_block_size;
+	static bool         pipe_mode;
 	static DWORD        process_priority;
 	static DWORD        process_timeout;
 	static bool         read_stdin_lines;
 	static bool         print_manpage;
+	static std::wstring record_end;
 	static std::wstring redir_path_name;
+	static std::wstring results_file_name;
 	static std::wstring separator;
+	static DWORD        shard_count;
+	static DWORD        shard_index;
+	static DWORD        shard_mode;
+	static std::wstring stderr_pattern;
+	static std::wstring stdin_pattern;
+	static std::wstring stdout_pattern;
+	static ULONGLONG    unique_memory;
+	static bool         unique_tasks;
 }
 
 // ==========================================================================
@@ -130,7 +234,7 @@ namespace output
 			{
 				va_list args;
 				va_start(args, fmt);
-				utils::console::write_console(type, (!options::disable_concolor), fmt, args);
+				utils::console::write_console(type, (!options::disable_concolor), fmt, args, (type == 0x3));
 				va_end(args);
 			}
 		}
@@ -143,7 +247,7 @@ namespace output
 
 #define LOG(...) do \
 { \
-	if(logging::impl::g_log_file) \
+	if(logging::impl::g_enabled) \
 	{ \
 		logging::logging_impl(__VA_ARGS__); \
 	} \
@@ -154,54 +258,314 @@ namespace logging
 {
 	namespace impl
 	{
-		static FILE* g_log_file = NULL;
+		//Ring buffer (single producer, single consumer)
+		static const DWORD RING_SIZE = 1U << 20;
+		static const DWORD RING_MASK = RING_SIZE - 1U;
+		static const DWORD RING_ALIGN = 16U;
+		static const DWORD FLUSH_INTERVAL = 100U;
+		static const DWORD WRITE_BUFFER_SIZE = 65536U;
+		static const DWORD FORMAT_BUFFER_SIZE = 32768U;
+
+		//Record header
+		typedef struct _record_t
+		{
+			DWORD     size;      /*total size, including header and padding*/
+			DWORD     length;    /*number of characters, MAXDWORD for padding*/
+			ULONGLONG timestamp; /*timer value*/
+		}
+		record_t;
+
+		static bool          g_enabled = false;
+		static HANDLE        g_log_file = INVALID_HANDLE_VALUE;
+		static HANDLE        g_thread = NULL;
+		static HANDLE        g_data_event = NULL;
+		static HANDLE        g_space_event = NULL;
+		static volatile LONG g_stop = 0;
+		static volatile LONG g_write_pos = 0;
+		static volatile LONG g_read_pos = 0;
+		static BYTE         *g_ring = NULL;
+		static wchar_t       g_format_buffer[FORMAT_BUFFER_SIZE];
+
+		//Clock reference
+		static ULONGLONG g_base_timer = 0;
+		static ULONGLONG g_base_filetime = 0;
+
+		//Size of a record, including padding
+		static inline DWORD record_size(const DWORD length)
+		{
+			return (DWORD(sizeof(record_t)) + (length * DWORD(sizeof(wchar_t))) + (RING_ALIGN - 1U)) & (~(RING_ALIGN - 1U));
+		}
+
+		//Append record to ring buffer (producer side)
+		static void push_record(const ULONGLONG timestamp, const wchar_t *const text, const DWORD length)
+		{
+			const DWORD size = record_size(length);
+			const DWORD write_pos = DWORD(g_write_pos);
+			for (;;)
+			{
+				const DWORD offset = write_pos & RING_MASK, tail_room = RING_SIZE - offset;
+				const DWORD required = (size <= tail_room) ? size : (tail_room + size);
+				if ((RING_SIZE - (write_pos - DWORD(InterlockedCompareExchange(&g_read_pos, 0, 0)))) >= required)
+				{
+					break;
+				}
+				SetEvent(g_data_event); /*ring buffer is full, wait for the writer*/
+				WaitForSingleObject(g_space_event, FLUSH_INTERVAL);
+			}
+			DWORD pos = write_pos;
+			if (size > (RING_SIZE - (pos & RING_MASK)))
+			{
+				record_t *const padding = (record_t*)(&g_ring[pos & RING_MASK]);
+				padding->size = RING_SIZE - (pos & RING_MASK);
+				padding->length = MAXDWORD;
+				pos += padding->size;
+			}
+			record_t *const record = (record_t*)(&g_ring[pos & RING_MASK]);
+			record->size = size;
+			record->length = length;
+			record->timestamp = timestamp;
+			memcpy(&g_ring[(pos & RING_MASK) + sizeof(record_t)], text, length * sizeof(wchar_t));
+			InterlockedExchange(&g_write_pos, LONG(pos + size));
+			if ((pos + size - DWORD(g_read_pos)) > (RING_SIZE / 2U))
+			{
+				SetEvent(g_data_event);
+			}
+		}
+
+		//Format the time stamp (cached per second)
+		static const char *format_timestamp(const ULONGLONG timestamp)
+		{
+			static char s_buffer[32] = { '\0' };
+			static ULONGLONG s_last_second = MAXDWORD;
+			const ULONGLONG frequency = utils::sysinfo::get_timer_frequency();
+			const ULONGLONG elapsed = (timestamp > g_base_timer) ? (timestamp - g_base_timer) : 0U;
+			const ULONGLONG filetime = g_base_filetime + ((elapsed / frequency) * 10000000U) + (((elapsed % frequency) * 10000000U) / frequency);
+			const ULONGLONG current_second = filetime / 10000000U;
+			if (current_second != s_last_second)
+			{
+				ULARGE_INTEGER temp;
+				temp.QuadPart = filetime;
+				FILETIME time_utc, time_local;
+				time_utc.dwLowDateTime = temp.LowPart;
+				time_utc.dwHighDateTime = temp.HighPart;
+				SYSTEMTIME time_info;
+				if (FileTimeToLocalFileTime(&time_utc, &time_local) && FileTimeToSystemTime(&time_local, &time_info))
+				{
+					if (options::log_format_json)
+					{
+						_snprintf_s(s_buffer, 32, _TRUNCATE, "%04u-%02u-%02uT%02u:%02u:%02u", time_info.wYear, time_info.wMonth, time_info.wDay, time_info.wHour, time_info.wMinute, time_info.wSecond);
+					}
+					else
+					{
+						_snprintf_s(s_buffer, 32, _TRUNCATE, "%04u:%02u:%02u %02u:%02u:%02u", time_info.wYear, time_info.wMonth, time_info.wDay, time_info.wHour, time_info.wMinute, time_info.wSecond);
+					}
+					s_last_second = current_second;
+				}
+			}
+			return s_buffer;
+		}
+
+		//Format a single record (consumer side)
+		static void format_record(std::string &out, const record_t *const record)
+		{
+			const wchar_t *const text = (const wchar_t*)(((const BYTE*)record) + sizeof(record_t));
+			DWORD length = record->length;
+			if (options::log_format_json)
+			{
+				while ((length > 0) && ((text[length - 1] == L'\n') || (text[length - 1] == L'\r')))
+				{
+					length--;
+				}
+				out.append("{\"time\":\"");
+				out.append(format_timestamp(record->timestamp));
+				out.append("\",\"msg\":\"");
+				DWORD start = 0;
+				for (DWORD i = 0; i < length; i++)
+				{
+					if ((text[i] == L'"') || (text[i] == L'\\') || (text[i] < 0x20))
+					{
+						utils::string::append_utf8(out, &text[start], i - start);
+						char escaped[8];
+						if ((text[i] == L'"') || (text[i] == L'\\'))
+						{
+							_snprintf_s(escaped, 8, _TRUNCATE, "\\%c", char(text[i]));
+						}
+						else
+						{
+							_snprintf_s(escaped, 8, _TRUNCATE, "\\u%04x", DWORD(text[i]));
+						}
+						out.append(escaped);
+						start = i + 1;
+					}
+				}
+				utils::string::append_utf8(out, &text[start], length - start);
+				out.append("\"}\n");
+			}
+			else
+			{
+				out.push_back('[');
+				out.append(format_timestamp(record->timestamp));
+				out.append("] ");
+				DWORD start = 0;
+				for (DWORD i = 0; i < length; i++)
+				{
+					if (text[i] == L'\n')
+					{
+						utils::string::append_utf8(out, &text[start], i - start);
+						out.append("\r\n");
+						start = i + 1;
+					}
+				}
+				utils::string::append_utf8(out, &text[start], length - start);
+			}
+		}
+
+		//Write buffer to file
+		static void flush_buffer(std::string &out)
+		{
+			if (!out.empty())
+			{
+				DWORD written;
+				WriteFile(g_log_file, out.c_str(), DWORD(out.size()), &written, NULL);
+				out.clear();
+			}
+		}
+
+		//Drain the ring buffer (consumer side)
+		static void drain_records(std::string &out)
+		{
+			DWORD read_pos = DWORD(g_read_pos);
+			const DWORD write_pos = DWORD(InterlockedCompareExchange(&g_write_pos, 0, 0));
+			while (read_pos != write_pos)
+			{
+				const record_t *const record = (const record_t*)(&g_ring[read_pos & RING_MASK]);
+				if (record->length != MAXDWORD)
+				{
+					format_record(out, record);
+				}
+				read_pos += record->size;
+				if (out.size() >= WRITE_BUFFER_SIZE)
+				{
+					flush_buffer(out);
+				}
+			}
+			InterlockedExchange(&g_read_pos, LONG(read_pos));
+			SetEvent(g_space_event);
+			flush_buffer(out);
+		}
+
+		//Log writer thread
+		static unsigned __stdcall writer_thread(void*)
+		{
+			std::string out;
+			out.reserve(WRITE_BUFFER_SIZE + 4096U);
+			while (!InterlockedCompareExchange(&g_stop, 0, 0))
+			{
+				WaitForSingleObject(g_data_event, FLUSH_INTERVAL);
+				drain_records(out);
+			}
+			drain_records(out);
+			return 0;
+		}
 
 		//Close the log file
 		static void close_log_file(void)
 		{
-			CLOSE_FILE(g_log_file);
+			if (g_thread)
+			{
+				InterlockedExchange(&g_stop, 1);
+				SetEvent(g_data_event);
+				WaitForSingleObject(g_thread, INFINITE);
+				CLOSE_HANDLE(g_thread);
+			}
+			g_enabled = false;
+			if (g_log_file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(g_log_file);
+				g_log_file = INVALID_HANDLE_VALUE;
+			}
+			CLOSE_HANDLE(g_data_event);
+			CLOSE_HANDLE(g_space_event);
+			if (g_ring)
+			{
+				VirtualFree(g_ring, 0, MEM_RELEASE);
+				g_ring = NULL;
+			}
+		}
+
+		//Initialize clock reference
+		static void init_clock(void)
+		{
+			FILETIME time_now;
+			GetSystemTimeAsFileTime(&time_now);
+			g_base_timer = utils::sysinfo::get_timer_value();
+			ULARGE_INTEGER temp;
+			temp.LowPart  = time_now.dwLowDateTime;
+			temp.HighPart = time_now.dwHighDateTime;
+			g_base_filetime = temp.QuadPart;
+		}
+
+		//Write header to log file
+		static void write_header(void)
+		{
+			DWORD written;
+			LARGE_INTEGER file_size;
+			if (GetFileSizeEx(g_log_file, &file_size))
+			{
+				if ((file_size.QuadPart < 1LL) && (!options::log_format_json))
+				{
+					static const char *const BOM = "\xef\xbb\xbf";
+					WriteFile(g_log_file, BOM, DWORD(strlen(BOM)), &written, NULL);
+				}
+				else if ((file_size.QuadPart > 3LL) && (!options::log_format_json))
+				{
+					static const char *const SEPARATOR = "---------------------\r\n";
+					WriteFile(g_log_file, SEPARATOR, DWORD(strlen(SEPARATOR)), &written, NULL);
+				}
+			}
 		}
 	}
 
 	//Open log file
 	static void open_log_file(const wchar_t *file_name)
 	{
-		if (!impl::g_log_file)
+		if (!impl::g_enabled)
 		{
-			if (impl::g_log_file = _wfsopen(file_name, L"a,ccs=UTF-8", _SH_DENYWR))
+			impl::g_log_file = CreateFileW(file_name, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (impl::g_log_file != INVALID_HANDLE_VALUE)
 			{
-				atexit(impl::close_log_file);
-				struct _stat64 stat;
-				if(_fstati64(_fileno(impl::g_log_file), &stat) == 0)
+				impl::write_header();
+				impl::init_clock();
+				impl::g_ring = (BYTE*) VirtualAlloc(NULL, impl::RING_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+				impl::g_data_event  = CreateEventW(NULL, FALSE, FALSE, NULL);
+				impl::g_space_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+				if (impl::g_ring && impl::g_data_event && impl::g_space_event)
 				{
-					if (stat.st_size > 3LL)
+					if (impl::g_thread = (HANDLE)_beginthreadex(NULL, 0, impl::writer_thread, NULL, 0, NULL))
 					{
-						fwprintf(impl::g_log_file, L"---------------------\n");
+						impl::g_enabled = true;
+						atexit(impl::close_log_file);
+						return;
 					}
 				}
+				impl::close_log_file();
 			}
-			else
-			{
-				impl::g_log_file = NULL;
-				PRINT_ERR(L"ERROR: Failed to open log file \"%s\" for writing!\n\n", options::log_file_name.c_str());
-			}
+			PRINT_ERR(L"ERROR: Failed to open log file \"%s\" for writing!\n\n", options::log_file_name.c_str());
 		}
 	}
 
 	//Actual logging function
 	static inline void logging_impl(const wchar_t *const fmt, ...)
 	{
-		assert(impl::g_log_file != NULL);
-		wchar_t time_buffer[32];
-		if (utils::sysinfo::get_current_time(time_buffer, 32, false))
-		{
-			va_list args;
-			va_start(args, fmt);
-			fwprintf_s(impl::g_log_file, L"[%s] ", time_buffer);
-			vfwprintf_s(impl::g_log_file, fmt, args);
-			va_end(args);
-		}
-	}}
+		assert(impl::g_enabled);
+		const ULONGLONG timestamp = utils::sysinfo::get_timer_value();
+		va_list args;
+		va_start(args, fmt);
+		const int len = _vsnwprintf_s(impl::g_format_buffer, impl::FORMAT_BUFFER_SIZE, _TRUNCATE, fmt, args);
+		va_end(args);
+		impl::push_record(timestamp, impl::g_format_buffer, (len >= 0) ? DWORD(len) : DWORD(wcslen(impl::g_format_buffer)));
+	}
+}
 
 // ==========================================================================
 // LOGO / MANPAGE
@@ -226,6 +590,7 @@ namespace manpage
 		PRINT_NFO(L"Synopsis:\n");
 		PRINT_NFO(L"  MParallel.exe [options] <command_1> : <command_2> : ... : <command_n>\n");
 		PRINT_NFO(L"  MParallel.exe [options] --input=commands.txt\n");
+		PRINT_NFO(L"  MParallel.exe [options] --pattern=<PATTERN> ::: <arg_1> ... ::: <arg_n> ...\n");
 		PRINT_NFO(L"  GenerateCommands.exe [parameters] | MParallel.exe [options] --stdin\n\n");
 		PRINT_NFO(L"Options:\n");
 		PRINT_NFO(L"  --count=<N>          Run at most N instances in parallel (Default is %u)\n", CPU_COUNT);
@@ -233,24 +598,65 @@ namespace manpage
 		PRINT_NFO(L"  --separator=<SEP>    Set the command separator to SEP (Default is '%s')\n", DEFAULT_SEP);
 		PRINT_NFO(L"  --input=<FILE>       Read additional commands from specified FILE\n");
 		PRINT_NFO(L"  --stdin              Read additional commands from STDIN stream\n");
+		PRINT_NFO(L"  --unique             Drop duplicate commands before they are enqueued\n");
+		PRINT_NFO(L"  --unique-memory=<N>  Limit \"--unique\" to N bytes of RAM (spills to disk)\n");
+		PRINT_NFO(L"  --max-args=<N>       Pass up to N inputs to each command (\"auto\" = adaptive)\n");
+		PRINT_NFO(L"  --max-chars=<N>      Limit the length of batched commands to N characters\n");
+		PRINT_NFO(L"  --shard=<I/N>        Only run the I-th of N disjoint parts of the input\n");
+		PRINT_NFO(L"  --shard-by=<MODE>    Assign inputs to shards by 'hash', 'line' or 'size'\n");
 		PRINT_NFO(L"  --logfile=<FILE>     Save logfile to FILE, appends if the file exists\n");
+		PRINT_NFO(L"  --log-format=<FMT>   Set the logfile format to FMT ('text' or 'json')\n");
 		PRINT_NFO(L"  --out-path=<PATH>    Redirect the stdout/stderr of sub-processes to PATH\n");
+		PRINT_NFO(L"  --stdin-from=<PAT>   Feed the file PAT to the stdin of each sub-process\n");
+		PRINT_NFO(L"  --stdout-to=<PAT>    Write the stdout of each sub-process to the file PAT\n");
+		PRINT_NFO(L"  --stderr-to=<PAT>    Write the stderr of each sub-process to the file PAT\n");
+		PRINT_NFO(L"  --results=<FILE>     Save per-task resource usage to FILE (CSV format)\n");
+		PRINT_NFO(L"  --metrics=<FILE>     Periodically export live metrics to FILE (Prometheus)\n");
+		PRINT_NFO(L"  --metrics-port=<N>   Serve live metrics on http://127.0.0.1:N/metrics\n");
+		PRINT_NFO(L"  --metrics-tick=<MS>  Update the metrics file every MS milliseconds\n");
 		PRINT_NFO(L"  --auto-wrap          Automatically wrap tokens in quotation marks\n");
 		PRINT_NFO(L"  --no-split-lines     Ignore whitespaces when reading commands from file\n");
 		PRINT_NFO(L"  --shell              Start each command inside a new sub-shell (cmd.exe)\n");
+		PRINT_NFO(L"  --shell=persistent   Run the commands inside long-lived shells, one per slot\n");
+		PRINT_NFO(L"  --shell=auto         Use a sub-shell only for commands that require one\n");
+		PRINT_NFO(L"  --no-builtins        Do NOT run \"@copy\", \"@move\", etc. as built-in commands\n");
+		PRINT_NFO(L"  --coprocess=<CMD>    Send the commands to long-lived CMD workers via stdin\n");
+		PRINT_NFO(L"  --jobserver          Share the slots with sub-processes via GNU make jobserver\n");
+		PRINT_NFO(L"  --pipe               Split STDIN into chunks and pipe them to the command\n");
+		PRINT_NFO(L"  --pipe-part=<FILE>   Run one command per record-aligned byte range of FILE\n");
+		PRINT_NFO(L"  --block-size=<SIZE>  Set the chunk size for \"--pipe\" (Default is 1M)\n");
+		PRINT_NFO(L"  --record-end=<STR>   Split the chunks only after STR (Default is \\n)\n");
+		PRINT_NFO(L"  --keep-order         Write the outputs of the chunks in input order\n");
+		PRINT_NFO(L"  --range=<A:B[:S]>    Add the integers from A to B (step S) as input source\n");
+		PRINT_NFO(L"  --link               Combine the input sources pairwise, not all-to-all\n");
+		PRINT_NFO(L"  --find=<DIR>         Run the command for each file in DIR (recursively)\n");
+		PRINT_NFO(L"  --find-name=<GLOB>   Only include files matching GLOB, e.g. \"*.jpg;*.png\"\n");
+		PRINT_NFO(L"  --find-size=<+/-N>   Only include files larger (+) or smaller (-) than N\n");
+		PRINT_NFO(L"  --find-mtime=<+/-N>  Only include files modified more (+) or less (-) than\n");
+		PRINT_NFO(L"                       N days ago\n");
 		PRINT_NFO(L"  --timeout=<TIMEOUT>  Kill processes after TIMEOUT milliseconds\n");
+		PRINT_NFO(L"  --max-memory=<SIZE>  Limit the memory of each task (incl. children) to SIZE\n");
+		PRINT_NFO(L"  --max-cpu=<PERCENT>  Limit the CPU usage of each task, 100 is one full CPU\n");
+		PRINT_NFO(L"  --max-io=<SIZE>      Limit the I/O bandwidth of each task to SIZE bytes/sec\n");
+		PRINT_NFO(L"  --max-iops=<N>       Limit the I/O operations of each task to N per second\n");
+		PRINT_NFO(L"  --kill-grace=<MS>    Send Ctrl+Break and wait MS milliseconds before killing\n");
 		PRINT_NFO(L"  --priority=<VALUE>   Run commands with the specified process priority\n");
 		PRINT_NFO(L"  --ignore-exitcode    Do NOT check the exit code of sub-processes\n");
 		PRINT_NFO(L"  --utf16              Read the input file as UTF-16 (Default is UTF-8)\n");
 		PRINT_NFO(L"  --detached           Run each sub-process in a separate console window\n");
 		PRINT_NFO(L"  --abort              Abort batch, if any command failed to execute\n");
+		PRINT_NFO(L"  --halt=<MODE,COND>   Stop 'soon' or 'now', e.g. on 'fail=N', 'fail=P%%' or\n");
+		PRINT_NFO(L"                       'success=N'\n");
 		PRINT_NFO(L"  --no-jobctrl         Do NOT add new sub-processes to job object\n");
 		PRINT_NFO(L"  --no-boost           Do NOT apply priroity boost to the \"main\" process\n");
 		PRINT_NFO(L"  --discard-output     Discard all stdout/stderr outputs of sub-processes\n");
 		PRINT_NFO(L"  --notify             Play a notification sound when all tasks completed\n");
+		PRINT_NFO(L"  --summary            Print a resource usage summary when all tasks completed\n");
 		PRINT_NFO(L"  --silent             Disable all textual messages, aka \"silent mode\"\n");
 		PRINT_NFO(L"  --no-colors          Do NOT applay colors to textual console output\n");
 		PRINT_NFO(L"  --trace              Enable more diagnostic outputs (for debugging only)\n");
+		PRINT_NFO(L"  --bench-queue=<N>    Measure memory and speed of the task queue with N tasks\n");
+		PRINT_NFO(L"  --bench-parse=<N>    Measure the input parsing hot paths with N lines each\n");
 		PRINT_NFO(L"  --help               Print this help screen\n");
 	}
 }
@@ -277,6 +683,7 @@ namespace error
 	namespace impl
 	{
 		static HANDLE  g_interrupt_event = NULL;
+		static volatile LONG g_interrupted = 0;
 
 		static void my_invalid_parameter_handler(wchar_t const*, wchar_t const*, wchar_t const*, unsigned int, uintptr_t)
 		{
@@ -292,6 +699,7 @@ namespace error
 			case CTRL_CLOSE_EVENT:
 				if (g_interrupt_event)
 				{
+					InterlockedExchange(&g_interrupted, 1L);
 					SetEvent(g_interrupt_event);
 					return TRUE;
 				}
@@ -304,6 +712,7 @@ namespace error
 			signal(signo, signal_handler);
 			if (g_interrupt_event)
 			{
+				InterlockedExchange(&g_interrupted, 1L);
 				SetEvent(g_interrupt_event);
 			}
 		}
@@ -311,14 +720,7 @@ namespace error
 
 	static inline bool interrupted(void)
 	{
-		if (impl::g_interrupt_event)
-		{
-			if (WaitForSingleObject(impl::g_interrupt_event, 0) == WAIT_OBJECT_0)
-			{
-				return true;
-			}
-		}
-		return false;
+		return (impl::g_interrupted != 0);
 	}
 
 	static void install_error_handlers(void)
@@ -341,648 +743,6255 @@ namespace error
 }
 
 // ==========================================================================
-// QUEUE
+// METRICS
 // ==========================================================================
 
-namespace queue
+namespace metrics
 {
-	static DWORD g_queue_max = 0;
 	namespace impl
 	{
-		static queue_t g_queue;
-	}
+		//Histogram buckets (seconds)
+		static const DWORD MAX_BUCKETS = 16;
+		static const DWORD TASK_BUCKET_COUNT = 12;
+		static const double TASK_BUCKETS[TASK_BUCKET_COUNT] = { 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 300.0 };
+		static const DWORD LOOP_BUCKET_COUNT = 8;
+		static const double LOOP_BUCKETS[LOOP_BUCKET_COUNT] = { 0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05 };
 
-	//Enqueue next task
-	static inline void enqueue(const std::wstring item)
-	{
-		PRINT_TRC(L"Enqueue: ``%s\n", item.c_str());
-		impl::g_queue.push(item);
-		g_queue_max = std::max(g_queue_max, DWORD(impl::g_queue.size()));
-	}
+		//Histogram
+		typedef struct _histogram_t
+		{
+			volatile LONG     buckets[MAX_BUCKETS + 1];
+			volatile LONGLONG sum_us;
+		}
+		histogram_t;
 
-	//Dequeue next task
-	static inline std::wstring dequeue(void)
-	{
-		assert(impl::g_queue.size() > 0);
-		const std::wstring next_item = impl::g_queue.front();
-		impl::g_queue.pop();
-		return next_item;
-	}
+		//Counters and gauges
+		static volatile LONG g_queued       = 0;
+		static volatile LONG g_running      = 0;
+		static volatile LONG g_succeeded    = 0;
+		static volatile LONG g_failed       = 0;
+		static volatile LONG g_spawn_errors = 0;
+		static volatile LONG g_timeouts     = 0;
+		static histogram_t   g_task_duration;
+		static histogram_t   g_loop_latency;
 
-	//Enqueue next task
-	static inline bool have_more(void)
-	{
-		return !impl::g_queue.empty();
-	}
-}
+		//Exporter
+		static HANDLE g_thread        = NULL;
+		static HANDLE g_stop_event    = NULL;
+		static HANDLE g_accept_event  = NULL;
+		static SOCKET g_listen_socket = INVALID_SOCKET;
 
-// ==========================================================================
-// COMMAND-LINE HANDLING
-// ==========================================================================
+		//Update histogram
+		static inline void observe(histogram_t &histogram, const double *const bounds, const DWORD count, const ULONGLONG value_us)
+		{
+			const double value = double(value_us) / 1000000.0;
+			DWORD index = 0;
+			while ((index < count) && (value > bounds[index]))
+			{
+				index++;
+			}
+			InterlockedIncrement(&histogram.buckets[index]);
+			InterlockedExchangeAdd64(&histogram.sum_us, LONGLONG(value_us));
+		}
 
-namespace command
-{
-	static DWORD expand_placeholder(std::wstring &str, const DWORD n, const wchar_t postfix, const wchar_t *const value)
-	{
-		std::wstringstream placeholder;
-		if (postfix)
+		//Convert timer ticks to microseconds
+		static inline ULONGLONG ticks_to_us(const ULONGLONG ticks)
 		{
-			placeholder << L"{{" << n << L':' << postfix << L"}}";
+			return (ticks * 1000000U) / utils::sysinfo::get_timer_frequency();
 		}
-		else
+
+		//Append formatted text
+		static void append(std::string &out, const char *const fmt, ...)
 		{
-			placeholder << L"{{" << n << L"}}";
+			char buffer[256];
+			va_list args;
+			va_start(args, fmt);
+			const int len = _vsnprintf_s(buffer, 256, _TRUNCATE, fmt, args);
+			va_end(args);
+			if (len > 0)
+			{
+				out.append(buffer, len);
+			}
 		}
 
-		if (options::auto_quote_vars && ((!value) || (!value[0]) || utils::string::contains_whitespace(value)))
+		//Render a single counter or gauge
+		static void render_value(std::string &out, const char *const name, const char *const type, const char *const help, const LONG value)
 		{
-			std::wstringstream replacement;
-			replacement << L'"' << value << L'"';
-			return utils::string::replace_str(str, placeholder.str(), replacement.str());
+			append(out, "# HELP %s %s\n# TYPE %s %s\n%s %ld\n", name, help, name, type, name, value);
 		}
-		else
+
+		//Render a histogram
+		static void render_histogram(std::string &out, const char *const name, const char *const help, histogram_t &histogram, const double *const bounds, const DWORD count)
 		{
-			return utils::string::replace_str(str, placeholder.str(), value);
+			append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+			LONG cumulative = 0;
+			for (DWORD i = 0; i < count; i++)
+			{
+				cumulative += histogram.buckets[i];
+				append(out, "%s_bucket{le=\"%g\"} %ld\n", name, bounds[i], cumulative);
+			}
+			cumulative += histogram.buckets[count];
+			append(out, "%s_bucket{le=\"+Inf\"} %ld\n", name, cumulative);
+			append(out, "%s_sum %.6f\n", name, double(InterlockedCompareExchange64(&histogram.sum_us, 0, 0)) / 1000000.0);
+			append(out, "%s_count %ld\n", name, cumulative);
 		}
-	}
 
-	//Parse commands (simple)
-	static void parse_commands_simple(const int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
-	{
-		int i = offset;
-		std::wstringstream command_buffer;
-		PRINT_TRC(L"Separator: ``%s\n", separator ? separator : L"<NULL>");
-		while (i < argc)
+		//Render all metrics in Prometheus text format
+		static std::string render(void)
 		{
-			const wchar_t *const current = argv[i++];
-			PRINT_TRC(L"Process token: %s\n", current);
-			if ((!separator) || wcscmp(current, separator))
+			std::string out;
+			out.reserve(4096);
+			render_value(out, "mparallel_tasks_queued",            "gauge",   "Number of tasks waiting in the queue.",                       g_queued);
+			render_value(out, "mparallel_tasks_running",           "gauge",   "Number of tasks currently running.",                          g_running);
+			render_value(out, "mparallel_tasks_succeeded_total",   "counter", "Number of tasks that completed successfully.",                g_succeeded);
+			render_value(out, "mparallel_tasks_failed_total",      "counter", "Number of tasks that failed or have been killed.",            g_failed);
+			render_value(out, "mparallel_spawn_errors_total",      "counter", "Number of tasks that could not be started.",                  g_spawn_errors);
+			render_value(out, "mparallel_timeouts_total",          "counter", "Number of timeouts encountered.",                             g_timeouts);
+			render_histogram(out, "mparallel_task_duration_seconds", "Wall-clock duration of completed tasks.",               g_task_duration, TASK_BUCKETS, TASK_BUCKET_COUNT);
+			render_histogram(out, "mparallel_scheduler_loop_seconds", "Time spent by the scheduler between two waits.",       g_loop_latency,  LOOP_BUCKETS, LOOP_BUCKET_COUNT);
+			return out;
+		}
+
+		//Write metrics file
+		static void write_metrics_file(void)
+		{
+			const std::string text = render();
+			if (!utils::files::write_file_atomic(options::metrics_file_name.c_str(), text.c_str(), DWORD(text.size())))
 			{
-				if (command_buffer.tellp())
-				{
-					command_buffer << L' ';
-				}
-				if ((!current[0]) || utils::string::contains_whitespace(current))
-				{
-					command_buffer << L'"' << current << L'"';
-				}
-				else
+				PRINT_TRC(L"Failed to write metrics file!\n");
+			}
+		}
+
+		//Serve metrics to HTTP client
+		static void serve_client(const SOCKET client)
+		{
+			static const DWORD CLIENT_TIMEOUT = 250;
+
+			//Wait for the request, but don't let an idle client hold up the other scrapes (or the shutdown)
+			bool readable = false;
+			if (const WSAEVENT client_event = WSACreateEvent())
+			{
+				if (WSAEventSelect(client, client_event, FD_READ | FD_CLOSE) == 0)
 				{
-					command_buffer << current;
+					const HANDLE handles[2] = { g_stop_event, client_event };
+					readable = (WaitForMultipleObjects(2, &handles[0], FALSE, CLIENT_TIMEOUT) == WAIT_OBJECT_0 + 1);
 				}
+				WSAEventSelect(client, NULL, 0);
+				WSACloseEvent(client_event);
 			}
-			else
+
+			u_long blocking = 0;
+			DWORD timeout = CLIENT_TIMEOUT;
+			ioctlsocket(client, FIONBIO, &blocking);
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(DWORD));
+			setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(DWORD));
+
+			char request[1024];
+			if (readable && (recv(client, request, sizeof(request), 0) > 0)) /*request is ignored*/
 			{
-				if (command_buffer.tellp())
+				const std::string body = render();
+				char header[256];
+				const int header_len = _snprintf_s(header, 256, _TRUNCATE, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", DWORD(body.size()));
+				if (header_len > 0)
 				{
-					queue::enqueue(std::move(command_buffer.str()));
+					send(client, header, header_len, 0);
+					send(client, body.c_str(), int(body.size()), 0);
 				}
-				command_buffer.str(std::wstring());
-				command_buffer.clear();
 			}
+			closesocket(client);
 		}
-		if (command_buffer.tellp())
-		{
-			queue::enqueue(command_buffer.str());
-		}
-	}
 
-	//Parse commands with pattern
-	static void parse_commands_pattern(const std::wstring &pattern, int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
-	{
-		int i = offset, var_idx = 0;
-		std::wstring command_buffer = pattern;
-		PRINT_TRC(L"Separator: ``%s\n", separator ? separator : L"<NULL>");
-		PRINT_TRC(L"Pattern: ``%s\n", pattern.c_str());
-		while (i < argc)
+		//Open listen socket on localhost
+		static bool open_listen_socket(const DWORD port)
 		{
-			const wchar_t *const current = argv[i++];
-			PRINT_TRC(L"Process token: %s\n", current);
-			if ((!separator) || wcscmp(current, separator))
+			WSADATA wsa_data;
+			if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+			{
+				return false;
+			}
+			const SOCKET listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (listen_socket != INVALID_SOCKET)
 			{
-				static const wchar_t *const TYPES = L"FDPNX";
-				DWORD expanded = 0;
-				expanded += expand_placeholder(command_buffer, var_idx, 0x00, current);
-				const std::wstring file_full = utils::files::get_full_path(current);
-				if (!file_full.empty())
+				SetHandleInformation((HANDLE)listen_socket, HANDLE_FLAG_INHERIT, 0);
+				sockaddr_in address;
+				memset(&address, 0, sizeof(sockaddr_in));
+				address.sin_family = AF_INET;
+				address.sin_port = htons(u_short(port));
+				address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				if ((bind(listen_socket, (const sockaddr*)&address, sizeof(sockaddr_in)) == 0) && (listen(listen_socket, SOMAXCONN) == 0))
 				{
-					expanded += expand_placeholder(command_buffer, var_idx, TYPES[0], file_full.c_str());
-					std::wstring file_drive, file_dir, file_fname, file_ext;
-					if (utils::files::split_file_name(file_full.c_str(), file_drive, file_dir, file_fname, file_ext))
+					if (g_accept_event = WSACreateEvent())
 					{
-						expanded += expand_placeholder(command_buffer, var_idx, TYPES[1], file_drive.c_str());
-						expanded += expand_placeholder(command_buffer, var_idx, TYPES[2], file_dir.c_str());
-						expanded += expand_placeholder(command_buffer, var_idx, TYPES[3], file_fname.c_str());
-						expanded += expand_placeholder(command_buffer, var_idx, TYPES[4], file_ext.c_str());
+						if (WSAEventSelect(listen_socket, g_accept_event, FD_ACCEPT) == 0)
+						{
+							g_listen_socket = listen_socket;
+							return true;
+						}
+						WSACloseEvent(g_accept_event);
+						g_accept_event = NULL;
 					}
 				}
-				for (DWORD i = 0; TYPES[i]; i++)
+				closesocket(listen_socket);
+			}
+			WSACleanup();
+			return false;
+		}
+
+		//Exporter thread
+		static unsigned __stdcall exporter_thread(void*)
+		{
+			const HANDLE handles[2] = { g_stop_event, g_accept_event };
+			const DWORD handle_count = g_accept_event ? 2 : 1;
+			for (;;)
+			{
+				const DWORD ret = WaitForMultipleObjects(handle_count, &handles[0], FALSE, options::metrics_file_name.empty() ? INFINITE : options::metrics_interval);
+				if (ret == WAIT_OBJECT_0 + 1)
 				{
-					expanded += expand_placeholder(command_buffer, var_idx, TYPES[i], BLANK_STR);
+					WSAResetEvent(g_accept_event);
+					SOCKET client;
+					while ((client = accept(g_listen_socket, NULL, NULL)) != INVALID_SOCKET)
+					{
+						serve_client(client);
+					}
+					continue;
 				}
-				if(expanded < 1)
+				if (!options::metrics_file_name.empty())
 				{
-					PRINT_WRN(L"WARNING: Discarding token \"%s\", due to missing {{%u}} placeholder!\n\n", current, var_idx);
+					write_metrics_file(); /*write final snapshot on exit*/
 				}
-				var_idx++;
-			}
-			else
-			{
-				if (!command_buffer.empty())
+				if (ret != WAIT_TIMEOUT)
 				{
-					queue::enqueue(command_buffer);
-					var_idx = 0;
-					command_buffer = pattern;
+					break;
 				}
 			}
+			return 0;
 		}
-		if ((!command_buffer.empty()) && (var_idx > 0))
+
+		//Stop the exporter
+		static void stop_exporter(void)
 		{
-			queue::enqueue(command_buffer);
+			if (g_thread)
+			{
+				SetEvent(g_stop_event);
+				WaitForSingleObject(g_thread, INFINITE);
+				CLOSE_HANDLE(g_thread);
+			}
+			if (g_listen_socket != INVALID_SOCKET)
+			{
+				closesocket(g_listen_socket);
+				g_listen_socket = INVALID_SOCKET;
+				WSACloseEvent(g_accept_event);
+				g_accept_event = NULL;
+				WSACleanup();
+			}
+			CLOSE_HANDLE(g_stop_event);
 		}
 	}
 
-	//Parse commands
-	static void parse_commands(int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
+	//Start the exporter, if required
+	static void initialize(void)
 	{
-		if (!options::command_pattern.empty())
+		if (options::metrics_file_name.empty() && (options::metrics_port < 1))
 		{
-			parse_commands_pattern(options::command_pattern, argc, argv, offset, separator);
+			return;
+		}
+		if (options::metrics_port > 0)
+		{
+			if (!impl::open_listen_socket(options::metrics_port))
+			{
+				PRINT_WRN(L"WARNING: Failed to listen on port %u, metrics will not be served!\n\n", options::metrics_port);
+				if (options::metrics_file_name.empty())
+				{
+					return;
+				}
+			}
+		}
+		if (impl::g_stop_event = CreateEventW(NULL, TRUE, FALSE, NULL))
+		{
+			if (impl::g_thread = (HANDLE)_beginthreadex(NULL, 0, impl::exporter_thread, NULL, 0, NULL))
+			{
+				atexit(impl::stop_exporter);
+				return;
+			}
+		}
+		PRINT_WRN(L"WARNING: Failed to start the metrics exporter thread!\n\n");
+		impl::stop_exporter();
+	}
+
+	//Counter updates
+	static inline void task_enqueued(void) { InterlockedIncrement(&impl::g_queued);       }
+	static inline void task_dequeued(void) { InterlockedDecrement(&impl::g_queued);       }
+	static inline void task_started(void)  { InterlockedIncrement(&impl::g_running);      }
+	static inline void task_requeued(void) { InterlockedDecrement(&impl::g_running);      }
+	static inline void spawn_failed(void)  { InterlockedIncrement(&impl::g_spawn_errors); }
+	static inline void timeout(void)       { InterlockedIncrement(&impl::g_timeouts);     }
+
+	//Task has completed
+	static inline void task_finished(const bool succeeded, const ULONGLONG duration_ticks)
+	{
+		InterlockedDecrement(&impl::g_running);
+		InterlockedIncrement(succeeded ? &impl::g_succeeded : &impl::g_failed);
+		impl::observe(impl::g_task_duration, impl::TASK_BUCKETS, impl::TASK_BUCKET_COUNT, impl::ticks_to_us(duration_ticks));
+	}
+
+	//Scheduler loop has completed
+	static inline void scheduler_loop(const ULONGLONG duration_ticks)
+	{
+		impl::observe(impl::g_loop_latency, impl::LOOP_BUCKETS, impl::LOOP_BUCKET_COUNT, impl::ticks_to_us(duration_ticks));
+	}
+}
+
+// ==========================================================================
+// DE-DUPLICATION
+// ==========================================================================
+
+namespace dedup
+{
+	namespace impl
+	{
+		static const DWORD  SPILL_BUCKETS = 64U;
+		static const size_t SPILL_BUFFER  = 65536U;
+		static const DWORD  BLOOM_HASHES  = 7U;
+
+		typedef struct _spill_t
+		{
+			HANDLE      file;
+			std::string buffer;
+		}
+		spill_t;
+
+		typedef struct _reader_t
+		{
+			HANDLE             file;
+			const std::string *tail;
+			std::string        buffer;
+			size_t             pos;
+			bool               eof;
+		}
+		reader_t;
+
+		//Slot of the in-memory set, the ticket identifies the queue entry holding the task
+		typedef struct _slot_t
+		{
+			ULONGLONG hash;
+			ULONGLONG ticket;
+		}
+		slot_t;
+
+		typedef bool (*fetch_t)(const ULONGLONG ticket, const char *&data, size_t &length);
+
+		static bool                   g_finished = false;
+		static std::vector<slot_t>    g_table;
+		static size_t                 g_table_used = 0;
+		static std::vector<BYTE>      g_bloom;
+		static ULONGLONG              g_bloom_bits = 0;
+		static spill_t                g_seen[SPILL_BUCKETS];
+		static spill_t                g_candidates[SPILL_BUCKETS];
+		static DWORD                  g_dropped = 0;
+		static bool                   g_spill_failed = false;
+
+		//Hash a byte sequence, eight bytes at a time
+		static ULONGLONG hash_bytes(const char *data, size_t length)
+		{
+			ULONGLONG hash = 0x9E3779B97F4A7C15ULL ^ ULONGLONG(length);
+			while (length >= 8U)
+			{
+				ULONGLONG block;
+				memcpy(&block, data, 8U);
+				hash = (hash ^ mix64(block)) * 0x9E3779B97F4A7C15ULL;
+				data += 8U;
+				length -= 8U;
+			}
+			ULONGLONG tail = 0;
+			memcpy(&tail, data, length);
+			return mix64((hash ^ mix64(tail)) * 0x9E3779B97F4A7C15ULL);
+		}
+
+		//Insert task into the in-memory set (open addressing), returns false if already present
+		static bool insert_exact(ULONGLONG hash, const char *const data, const size_t length, const ULONGLONG ticket, const fetch_t fetch)
+		{
+			hash = hash ? hash : 1U; /*zero marks an empty slot*/
+			if ((g_table_used + 1U) * 10U >= g_table.size() * 7U)
+			{
+				const slot_t empty = { 0U, 0U };
+				std::vector<slot_t> old_table(std::max(size_t(65536U), g_table.size() * 2U), empty);
+				old_table.swap(g_table);
+				for (std::vector<slot_t>::const_iterator iter = old_table.begin(); iter != old_table.end(); iter++)
+				{
+					if (iter->hash)
+					{
+						size_t slot = size_t(iter->hash) & (g_table.size() - 1U);
+						while (g_table[slot].hash)
+						{
+							slot = (slot + 1U) & (g_table.size() - 1U);
+						}
+						g_table[slot] = *iter;
+					}
+				}
+			}
+			size_t slot = size_t(hash) & (g_table.size() - 1U);
+			while (g_table[slot].hash)
+			{
+				if (g_table[slot].hash == hash)
+				{
+					//Equal fingerprints, compare the actual bytes (assume a duplicate, if the task has been dequeued already)
+					const char *other = NULL;
+					size_t other_length = 0;
+					if (!fetch(g_table[slot].ticket, other, other_length))
+					{
+						return false;
+					}
+					if ((other_length == length) && (memcmp(other, data, length) == 0))
+					{
+						return false;
+					}
+				}
+				slot = (slot + 1U) & (g_table.size() - 1U);
+			}
+			g_table[slot].hash = hash;
+			g_table[slot].ticket = ticket;
+			g_table_used++;
+			return true;
+		}
+
+		//Set the bits of the hash in the Bloom filter, returns true if all of them were set already
+		static bool bloom_test_and_set(const ULONGLONG hash)
+		{
+			const ULONGLONG step = mix64(hash) | 1U;
+			bool present = true;
+			for (DWORD i = 0; i < BLOOM_HASHES; i++)
+			{
+				const ULONGLONG bit = (hash + (ULONGLONG(i) * step)) % g_bloom_bits;
+				BYTE &byte = g_bloom[size_t(bit >> 3)];
+				const BYTE mask = BYTE(1U << (bit & 7U));
+				present = present && ((byte & mask) != 0);
+				byte |= mask;
+			}
+			return present;
+		}
+
+		//Write buffered records to the spill file, records are kept in memory if that fails
+		static void spill_flush(spill_t &spill)
+		{
+			if (!spill.file)
+			{
+				wchar_t temp_path[MAX_PATH], temp_file[MAX_PATH];
+				const DWORD length = GetTempPathW(MAX_PATH, temp_path);
+				if ((length > 0) && (length < MAX_PATH) && GetTempFileNameW(temp_path, L"mpu", 0, temp_file))
+				{
+					spill.file = CreateFileW(temp_file, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+					if (spill.file == INVALID_HANDLE_VALUE)
+					{
+						spill.file = NULL;
+						DeleteFileW(temp_file);
+					}
+				}
+			}
+			DWORD written = 0;
+			if (!(spill.file && WriteFile(spill.file, spill.buffer.c_str(), DWORD(spill.buffer.size()), &written, NULL) && (written == spill.buffer.size())))
+			{
+				if (!g_spill_failed)
+				{
+					PRINT_WRN(L"WARNING: Failed to write the de-duplication spill file, keeping the data in memory!\n\n");
+					g_spill_failed = true;
+				}
+				return;
+			}
+			spill.buffer.clear();
+		}
+
+		//Append a record (hash, length, data) to the spill file
+		static void spill_write(spill_t &spill, const ULONGLONG hash, const char *const data, const size_t length)
+		{
+			const DWORD length32 = DWORD(length);
+			spill.buffer.append((const char*) &hash, sizeof(ULONGLONG));
+			spill.buffer.append((const char*) &length32, sizeof(DWORD));
+			spill.buffer.append(data, length);
+			if ((spill.buffer.size() >= SPILL_BUFFER) && (!g_spill_failed))
+			{
+				spill_flush(spill);
+			}
+		}
+
+		//Make sure the reader has the required number of bytes available
+		static bool reader_fill(reader_t &reader, const size_t required)
+		{
+			while ((reader.buffer.size() - reader.pos) < required)
+			{
+				if (reader.eof)
+				{
+					return false;
+				}
+				reader.buffer.erase(0, reader.pos);
+				reader.pos = 0;
+				const size_t offset = reader.buffer.size();
+				reader.buffer.resize(offset + std::max(required, size_t(1048576U)));
+				DWORD bytes_read = 0;
+				if (!(reader.file && ReadFile(reader.file, &reader.buffer[offset], DWORD(reader.buffer.size() - offset), &bytes_read, NULL)))
+				{
+					bytes_read = 0;
+				}
+				reader.buffer.resize(offset + bytes_read);
+				if (bytes_read < 1U)
+				{
+					reader.buffer.append(*reader.tail); /*records that have not been written to the file*/
+					reader.eof = true;
+				}
+			}
+			return true;
+		}
+
+		//Read the next record from the spill file
+		static bool reader_next(reader_t &reader, ULONGLONG &hash, std::string &data)
+		{
+			DWORD length = 0;
+			if (!reader_fill(reader, sizeof(ULONGLONG) + sizeof(DWORD)))
+			{
+				return false;
+			}
+			memcpy(&hash, &reader.buffer[reader.pos], sizeof(ULONGLONG));
+			memcpy(&length, &reader.buffer[reader.pos + sizeof(ULONGLONG)], sizeof(DWORD));
+			reader.pos += sizeof(ULONGLONG) + sizeof(DWORD);
+			if (!reader_fill(reader, length))
+			{
+				return false;
+			}
+			data.assign(reader.buffer, reader.pos, length);
+			reader.pos += length;
+			return true;
+		}
+
+		//Rewind the spill file for reading
+		static void reader_open(reader_t &reader, spill_t &spill)
+		{
+			reader.file = spill.file;
+			reader.tail = &spill.buffer;
+			reader.buffer.clear();
+			reader.pos = 0;
+			reader.eof = false;
+			if (spill.file)
+			{
+				SetFilePointer(spill.file, 0, NULL, FILE_BEGIN);
+			}
+		}
+	}
+
+	//De-duplication enabled?
+	static inline bool enabled(void)
+	{
+		return options::unique_tasks && (!impl::g_finished);
+	}
+
+	//Number of duplicates that have been dropped
+	static inline DWORD dropped(void)
+	{
+		return impl::g_dropped;
+	}
+
+	//Check the encoded task, returns false if it must not be enqueued now
+	//The ticket is the position the task will take in the queue, fetch() looks up the bytes of an earlier ticket
+	static bool accept(const char *const data, const size_t length, const ULONGLONG ticket, const impl::fetch_t fetch)
+	{
+		const ULONGLONG hash = impl::hash_bytes(data, length);
+		if (options::unique_memory < 1U)
+		{
+			if (impl::insert_exact(hash, data, length, ticket, fetch))
+			{
+				return true;
+			}
+			impl::g_dropped++;
+			return false;
+		}
+
+		if (impl::g_bloom.empty())
+		{
+			impl::g_bloom.resize(size_t(options::unique_memory), 0U);
+			impl::g_bloom_bits = ULONGLONG(impl::g_bloom.size()) * 8U;
+		}
+
+		//A Bloom filter miss is definitely new, a hit is verified later against the spilled tasks
+		const DWORD bucket = DWORD(hash >> 58);
+		const bool maybe_seen = impl::bloom_test_and_set(hash);
+		impl::spill_write(maybe_seen ? impl::g_candidates[bucket] : impl::g_seen[bucket], hash, data, length);
+		return !maybe_seen;
+	}
+
+	//Verify the deferred tasks, bucket by bucket, and emit those that are not duplicates
+	static void finish(void (*const emit)(const char *const data, const size_t length))
+	{
+		for (DWORD b = 0; b < impl::SPILL_BUCKETS; b++)
+		{
+			if (!(impl::g_candidates[b].file || (!impl::g_candidates[b].buffer.empty())))
+			{
+				continue;
+			}
+
+			//Load the candidates of this bucket, sorted by hash
+			std::vector<std::string> candidates;
+			std::vector<ULONGLONG> hashes;
+			std::vector<std::pair<ULONGLONG, size_t> > lookup;
+			impl::reader_t reader;
+			impl::reader_open(reader, impl::g_candidates[b]);
+			ULONGLONG hash;
+			std::string data;
+			while (impl::reader_next(reader, hash, data))
+			{
+				lookup.push_back(std::make_pair(hash, candidates.size()));
+				hashes.push_back(hash);
+				candidates.push_back(std::string());
+				candidates.back().swap(data);
+			}
+			std::sort(lookup.begin(), lookup.end());
+			std::vector<bool> duplicate(candidates.size(), false);
+
+			//Compare against all tasks that have been enqueued already
+			impl::reader_open(reader, impl::g_seen[b]);
+			while (impl::reader_next(reader, hash, data))
+			{
+				std::vector<std::pair<ULONGLONG, size_t> >::const_iterator iter = std::lower_bound(lookup.begin(), lookup.end(), std::make_pair(hash, size_t(0)));
+				for (; (iter != lookup.end()) && (iter->first == hash); iter++)
+				{
+					if ((!duplicate[iter->second]) && (candidates[iter->second] == data))
+					{
+						duplicate[iter->second] = true;
+					}
+				}
+			}
+
+			//Emit the remaining candidates, keeping only the first of identical ones
+			for (size_t i = 0; i < candidates.size(); i++)
+			{
+				if (!duplicate[i])
+				{
+					emit(candidates[i].c_str(), candidates[i].size());
+					std::vector<std::pair<ULONGLONG, size_t> >::const_iterator iter = std::lower_bound(lookup.begin(), lookup.end(), std::make_pair(hashes[i], i + 1U));
+					for (; (iter != lookup.end()) && (iter->first == hashes[i]); iter++)
+					{
+						if ((!duplicate[iter->second]) && (candidates[iter->second] == candidates[i]))
+						{
+							duplicate[iter->second] = true;
+						}
+					}
+					continue;
+				}
+				impl::g_dropped++;
+			}
+			CLOSE_HANDLE(impl::g_candidates[b].file);
+			std::string().swap(impl::g_candidates[b].buffer);
+		}
+
+		for (DWORD b = 0; b < impl::SPILL_BUCKETS; b++)
+		{
+			CLOSE_HANDLE(impl::g_seen[b].file);
+			std::string().swap(impl::g_seen[b].buffer);
+		}
+		std::vector<BYTE>().swap(impl::g_bloom);
+		std::vector<impl::slot_t>().swap(impl::g_table);
+		impl::g_finished = true; /*re-queued tasks must not be dropped*/
+	}
+}
+
+// ==========================================================================
+// QUEUE
+// ==========================================================================
+
+namespace queue
+{
+	static DWORD g_queue_max = 0;
+	namespace impl
+	{
+		static const DWORD CHUNK_SIZE = 1048576U;
+
+		//Arena chunk, holding the UTF-8 encoded tasks back-to-back
+		typedef struct _chunk_t
+		{
+			char  *data;
+			DWORD capacity;
+			DWORD used;
+			DWORD pending;
+		}
+		chunk_t;
+
+		//Index entry, locating a single task in the arena
+		typedef struct _entry_t
+		{
+			DWORD chunk;
+			DWORD offset;
+			DWORD length;
+			DWORD retries;
+		}
+		entry_t;
+
+		static std::deque<chunk_t> g_chunks;
+		static std::deque<entry_t> g_index;
+		static DWORD     g_first_chunk = 0;
+		static ULONGLONG g_arena_bytes = 0;
+		static ULONGLONG g_popped      = 0;
+
+		//Get chunk with enough free space, allocates a new chunk if required
+		static chunk_t &reserve(const size_t required)
+		{
+			if (g_chunks.empty() || ((g_chunks.back().capacity - g_chunks.back().used) < required))
+			{
+				chunk_t chunk;
+				chunk.capacity = DWORD(std::max(size_t(CHUNK_SIZE), required));
+				chunk.data = new char[chunk.capacity];
+				chunk.used = chunk.pending = 0;
+				g_chunks.push_back(chunk);
+				g_arena_bytes += chunk.capacity;
+			}
+			return g_chunks.back();
+		}
+
+		//Release the chunks that have been drained completely
+		static void release_chunks(void)
+		{
+			while ((g_chunks.size() > 1U) && (g_chunks.front().pending < 1))
+			{
+				g_arena_bytes -= g_chunks.front().capacity;
+				delete [] g_chunks.front().data;
+				g_chunks.pop_front();
+				g_first_chunk++;
+			}
+			if (g_index.empty() && (!g_chunks.empty()))
+			{
+				g_chunks.back().used = 0; /*recycle the last chunk*/
+			}
+		}
+
+		//Add index entry for the bytes just written to the last chunk
+		static void commit(chunk_t &chunk, const size_t length, const DWORD retries)
+		{
+			entry_t entry;
+			entry.chunk = g_first_chunk + DWORD(g_chunks.size() - 1U);
+			entry.offset = chunk.used;
+			entry.length = DWORD(length);
+			entry.retries = retries;
+			g_index.push_back(entry);
+			chunk.used += DWORD(length);
+			chunk.pending++;
+		}
+
+		//Look up the encoded bytes of a task by its position in the queue, fails if the task has been dequeued already
+		static bool fetch(const ULONGLONG ticket, const char *&data, size_t &length)
+		{
+			if ((ticket < g_popped) || ((ticket - g_popped) >= g_index.size()))
+			{
+				return false;
+			}
+			const entry_t &entry = g_index[size_t(ticket - g_popped)];
+			data = g_chunks[entry.chunk - g_first_chunk].data + entry.offset;
+			length = entry.length;
+			return true;
+		}
+
+		//Append a task to the arena, the fields are separated by NUL characters
+		static bool push(const std::wstring &command, const std::wstring &stdin_file, const std::wstring &stdout_file, const std::wstring &stderr_file, const DWORD retries)
+		{
+			const std::wstring *const fields[4] = { &command, &stdin_file, &stdout_file, &stderr_file };
+			size_t required = 3U;
+			for (size_t i = 0; i < 4U; i++)
+			{
+				required += 3U * fields[i]->length();
+			}
+
+			chunk_t &chunk = reserve(required);
+			char *const start = chunk.data + chunk.used;
+			size_t length = 0;
+			for (size_t i = 0; i < 4U; i++)
+			{
+				if (i > 0)
+				{
+					start[length++] = '\0';
+				}
+				length += utils::string::encode_utf8(fields[i]->c_str(), fields[i]->length(), start + length, required - length);
+			}
+
+			if ((retries < 1) && dedup::enabled() && (!dedup::accept(start, length, g_popped + g_index.size(), fetch)))
+			{
+				return false; /*duplicate, or deferred for verification*/
+			}
+			commit(chunk, length, retries);
+			return true;
+		}
+
+		//Append an already encoded task to the arena
+		static void push_raw(const char *const data, const size_t length)
+		{
+			chunk_t &chunk = reserve(length);
+			memcpy(chunk.data + chunk.used, data, length);
+			commit(chunk, length, 0);
+			metrics::task_enqueued();
+		}
+
+		//Remove the first task from the arena and decode it
+		static void pop(task_t &task)
+		{
+			const entry_t entry = g_index.front();
+			g_index.pop_front();
+			g_popped++;
+			chunk_t &chunk = g_chunks[entry.chunk - g_first_chunk];
+
+			std::wstring *const fields[4] = { &task.command, &task.stdin_file, &task.stdout_file, &task.stderr_file };
+			const char *ptr = chunk.data + entry.offset, *const end = ptr + entry.length;
+			for (size_t i = 0; i < 4U; i++)
+			{
+				const char *const next = (i < 3U) ? ((const char*) memchr(ptr, '\0', end - ptr)) : end;
+				utils::string::decode_utf8(*fields[i], ptr, (next ? next : end) - ptr);
+				ptr = next ? std::min(next + 1, end) : end;
+			}
+			task.retries = entry.retries;
+
+			chunk.pending--;
+			release_chunks();
+		}
+	}
+
+	//Initialize task, applying the redirection patterns as-is
+	static inline void init_task(task_t &task, const std::wstring &command)
+	{
+		task.command = command;
+		task.stdin_file = options::stdin_pattern;
+		task.stdout_file = options::stdout_pattern;
+		task.stderr_file = options::stderr_pattern;
+		task.retries = 0;
+	}
+
+	//Create task, applying the redirection patterns as-is
+	static inline task_t make_task(const std::wstring &command)
+	{
+		task_t task;
+		init_task(task, command);
+		return task;
+	}
+
+	//Does the task use native redirection?
+	static inline bool has_redirection(const task_t &task)
+	{
+		return !(task.stdin_file.empty() && task.stdout_file.empty() && task.stderr_file.empty());
+	}
+
+	//Number of tasks in the queue
+	static inline DWORD size(void)
+	{
+		return DWORD(impl::g_index.size());
+	}
+
+	//Enqueue next task
+	static inline void enqueue(const task_t &task)
+	{
+		PRINT_TRC(L"Enqueue: ``%s\n", task.command.c_str());
+		if (impl::push(task.command, task.stdin_file, task.stdout_file, task.stderr_file, task.retries))
+		{
+			g_queue_max = std::max(g_queue_max, size());
+			metrics::task_enqueued();
+		}
+	}
+
+	//Enqueue next command
+	static inline void enqueue(const std::wstring &command)
+	{
+		PRINT_TRC(L"Enqueue: ``%s\n", command.c_str());
+		if (impl::push(command, options::stdin_pattern, options::stdout_pattern, options::stderr_pattern, 0))
+		{
+			g_queue_max = std::max(g_queue_max, size());
+			metrics::task_enqueued();
+		}
+	}
+
+	//Dequeue next task
+	static inline void dequeue(task_t &task)
+	{
+		assert(impl::g_index.size() > 0);
+		impl::pop(task);
+		metrics::task_dequeued();
+	}
+
+	//Enqueue next task
+	static inline bool have_more(void)
+	{
+		return !impl::g_index.empty();
+	}
+
+	//All input has been read, enqueue the deferred tasks that turned out to be unique
+	static void finalize(void)
+	{
+		if (dedup::enabled())
+		{
+			dedup::finish(impl::push_raw);
+			g_queue_max = std::max(g_queue_max, size());
+		}
+	}
+
+	//Measure memory usage and throughput of the queue
+	static void benchmark(const DWORD count)
+	{
+		static const wchar_t *const SAMPLE = L"ffmpeg.exe -i \"C:\\Media\\Input\\video_%07u.avi\" -c:v libx264 -crf 22 \"C:\\Media\\Output\\video_%07u.mp4\"";
+		wchar_t buffer[256];
+
+		const ULONGLONG freq = utils::sysinfo::get_timer_frequency(), start = utils::sysinfo::get_timer_value();
+		ULONGLONG char_count = 0;
+		for (DWORD i = 0; i < count; i++)
+		{
+			_snwprintf_s(buffer, 256, _TRUNCATE, SAMPLE, i, i);
+			const std::wstring command(buffer);
+			char_count += command.length();
+			impl::push(command, options::stdin_pattern, options::stdout_pattern, options::stderr_pattern, 0);
+		}
+		const ULONGLONG middle = utils::sysinfo::get_timer_value();
+
+		const double bytes_per_task = double(impl::g_arena_bytes + (impl::g_index.size() * sizeof(impl::entry_t))) / double(std::max(count, DWORD(1)));
+		task_t task;
+		while (have_more())
+		{
+			impl::pop(task);
+		}
+		const ULONGLONG end = utils::sysinfo::get_timer_value();
+
+		const double enqueue_time = double(middle - start) / double(freq), dequeue_time = double(end - middle) / double(freq);
+		PRINT_NFO(L"Queue benchmark (%u tasks, %.1f chars per command):\n", count, double(char_count) / double(std::max(count, DWORD(1))));
+		PRINT_NFO(L"  Memory:  %.1f bytes per queued task\n", bytes_per_task);
+		PRINT_NFO(L"  Enqueue: %.2f million tasks per second\n", (enqueue_time > 0.0) ? (double(count) / enqueue_time / 1000000.0) : 0.0);
+		PRINT_NFO(L"  Dequeue: %.2f million tasks per second\n\n", (dequeue_time > 0.0) ? (double(count) / dequeue_time / 1000000.0) : 0.0);
+	}
+}
+
+// ==========================================================================
+// COMMAND-LINE HANDLING
+// ==========================================================================
+
+namespace command
+{
+	//Check whether the name suffix is a file extension, i.e. a '.' followed by letters or digits only
+	static bool has_extension(const wchar_t *const suffix, const size_t length)
+	{
+		if ((length < 2U) || (suffix[0] != L'.'))
+		{
+			return false;
+		}
+		for (size_t i = 1U; i < length; i++)
+		{
+			if (!iswalnum(suffix[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Check whether the command needs cmd.exe, i.e. uses shell operators, variables or built-in commands
+	static bool requires_shell(const wchar_t *const command)
+	{
+		static const wchar_t *const BUILTINS[] =
+		{
+			L"assoc", L"break", L"call", L"cd", L"chdir", L"cls", L"color", L"copy", L"date", L"del", L"dir", L"echo", L"endlocal", L"erase",
+			L"exit", L"for", L"ftype", L"goto", L"if", L"md", L"mkdir", L"mklink", L"move", L"path", L"pause", L"popd", L"prompt", L"pushd",
+			L"rd", L"rem", L"ren", L"rename", L"rmdir", L"set", L"setlocal", L"shift", L"start", L"time", L"title", L"type", L"ver", L"verify",
+			L"vol", NULL
+		};
+
+		bool quoted = false;
+		for (const wchar_t *ptr = command; *ptr; ptr++)
+		{
+			switch (*ptr)
+			{
+				case L'"': quoted = !quoted; break;
+				case L'%': return true;
+				case L'&': case L'|': case L'<': case L'>': case L'^': if (!quoted) return true; break;
+			}
+		}
+
+		const wchar_t *name = command;
+		while (iswspace(*name))
+		{
+			name++;
+		}
+		if ((*name == L'(') || (*name == L'@'))
+		{
+			return true;
+		}
+		if (*name == L'"')
+		{
+			name++;
+		}
+		size_t length = 0;
+		while (name[length] && (!iswspace(name[length])) && (name[length] != L'"'))
+		{
+			length++;
+		}
+
+		if ((length > 4) && ((_wcsnicmp(&name[length - 4], L".bat", 4) == 0) || (_wcsnicmp(&name[length - 4], L".cmd", 4) == 0)))
+		{
+			return true; /*batch files are run by cmd.exe anyway*/
+		}
+		for (size_t i = 0; BUILTINS[i]; i++)
+		{
+			const size_t builtin_length = wcslen(BUILTINS[i]);
+			if ((builtin_length <= length) && (_wcsnicmp(name, BUILTINS[i], builtin_length) == 0))
+			{
+				if ((builtin_length == length) || wcschr(L"/\\(:;,=+[]", name[builtin_length]))
+				{
+					return true;
+				}
+				if ((name[builtin_length] == L'.') && (!has_extension(&name[builtin_length], length - builtin_length)))
+				{
+					return true; /*"echo." is a built-in, but "echo.exe" is a program*/
+				}
+			}
+		}
+		return false;
+	}
+
+	//Split a command at unquoted pipe operators into stages that can be started directly
+	static bool split_pipeline(const wchar_t *const command, std::vector<std::wstring> &stages)
+	{
+		stages.clear();
+		bool quoted = false;
+		const wchar_t *start = command;
+		for (const wchar_t *ptr = command; ; ptr++)
+		{
+			if ((*ptr) && ((*ptr != L'|') || quoted))
+			{
+				if (*ptr == L'"')
+				{
+					quoted = !quoted;
+				}
+				continue;
+			}
+			const wchar_t *first = start, *last = ptr;
+			while ((first < last) && iswspace(*first))
+			{
+				first++;
+			}
+			while ((last > first) && iswspace(*(last - 1)))
+			{
+				last--;
+			}
+			const std::wstring stage(first, last - first);
+			if (stage.empty() || requires_shell(stage.c_str()))
+			{
+				stages.clear();
+				return false; /*empty stage, "||" operator or shell syntax*/
+			}
+			stages.push_back(stage);
+			if (!(*ptr))
+			{
+				break;
+			}
+			start = ptr + 1;
+		}
+		return (stages.size() > 1U);
+	}
+
+	static DWORD expand_placeholder(std::wstring &str, const DWORD n, const wchar_t postfix, const wchar_t *const value, const bool allow_quote = true)
+	{
+		std::wstringstream placeholder;
+		if (postfix)
+		{
+			placeholder << L"{{" << n << L':' << postfix << L"}}";
+		}
+		else
+		{
+			placeholder << L"{{" << n << L"}}";
+		}
+
+		if (allow_quote && options::auto_quote_vars && ((!value) || (!value[0]) || utils::string::contains_whitespace(value)))
+		{
+			std::wstringstream replacement;
+			replacement << L'"' << value << L'"';
+			return utils::string::replace_str(str, placeholder.str(), replacement.str());
+		}
+		else
+		{
+			return utils::string::replace_str(str, placeholder.str(), value);
+		}
+	}
+
+	//Expand placeholder in the command and in the redirection file names
+	static DWORD expand_task(task_t &task, const DWORD n, const wchar_t postfix, const wchar_t *const value)
+	{
+		DWORD expanded = expand_placeholder(task.command, n, postfix, value);
+		expanded += expand_placeholder(task.stdin_file,  n, postfix, value, false);
+		expanded += expand_placeholder(task.stdout_file, n, postfix, value, false);
+		expanded += expand_placeholder(task.stderr_file, n, postfix, value, false);
+		return expanded;
+	}
+
+	//Expand all placeholders of the n-th token, including the file name parts
+	static DWORD expand_token(task_t &task, const DWORD n, const wchar_t *const current)
+	{
+		static const wchar_t *const TYPES = L"FDPNX";
+		DWORD expanded = 0;
+		expanded += expand_task(task, n, 0x00, current);
+		const std::wstring file_full = utils::files::get_full_path(current);
+		if (!file_full.empty())
+		{
+			expanded += expand_task(task, n, TYPES[0], file_full.c_str());
+			std::wstring file_drive, file_dir, file_fname, file_ext;
+			if (utils::files::split_file_name(file_full.c_str(), file_drive, file_dir, file_fname, file_ext))
+			{
+				expanded += expand_task(task, n, TYPES[1], file_drive.c_str());
+				expanded += expand_task(task, n, TYPES[2], file_dir.c_str());
+				expanded += expand_task(task, n, TYPES[3], file_fname.c_str());
+				expanded += expand_task(task, n, TYPES[4], file_ext.c_str());
+			}
+		}
+		for (DWORD i = 0; TYPES[i]; i++)
+		{
+			expanded += expand_task(task, n, TYPES[i], BLANK_STR);
+		}
+		return expanded;
+	}
+
+	//Parse commands (simple)
+	static void parse_commands_simple(const int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
+	{
+		int i = offset;
+		std::wstringstream command_buffer;
+		PRINT_TRC(L"Separator: ``%s\n", separator ? separator : L"<NULL>");
+		while (i < argc)
+		{
+			const wchar_t *const current = argv[i++];
+			PRINT_TRC(L"Process token: %s\n", current);
+			if ((!separator) || wcscmp(current, separator))
+			{
+				if (command_buffer.tellp())
+				{
+					command_buffer << L' ';
+				}
+				if ((!current[0]) || utils::string::contains_whitespace(current))
+				{
+					command_buffer << L'"' << current << L'"';
+				}
+				else
+				{
+					command_buffer << current;
+				}
+			}
+			else
+			{
+				if (command_buffer.tellp())
+				{
+					queue::enqueue(std::move(command_buffer.str()));
+				}
+				command_buffer.str(std::wstring());
+				command_buffer.clear();
+			}
+		}
+		if (command_buffer.tellp())
+		{
+			queue::enqueue(command_buffer.str());
+		}
+	}
+
+	//Check whether the pattern contains any placeholder for the n-th token
+	static bool has_placeholder(const std::wstring &pattern, const DWORD n)
+	{
+		std::wstringstream placeholder;
+		placeholder << L"{{" << n;
+		const std::wstring prefix = placeholder.str();
+		for (size_t pos = pattern.find(prefix); pos != std::wstring::npos; pos = pattern.find(prefix, pos + 1U))
+		{
+			const wchar_t next = pattern[pos + prefix.length()];
+			if ((next == L'}') || (next == L':'))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Pack the tokens of one input into a record, each token is terminated by RECORD_SEP
+	static std::wstring pack_tokens(const std::vector<std::wstring> &tokens)
+	{
+		std::wstring record;
+		for (std::vector<std::wstring>::const_iterator iter = tokens.begin(); iter != tokens.end(); iter++)
+		{
+			record += (*iter);
+			record += RECORD_SEP;
+		}
+		return record;
+	}
+
+	//Unpack the tokens of one input from a record
+	static void unpack_tokens(const std::wstring &record, std::vector<std::wstring> &tokens)
+	{
+		tokens.clear();
+		size_t start = 0;
+		for (size_t pos = record.find(RECORD_SEP); pos != std::wstring::npos; pos = record.find(RECORD_SEP, start))
+		{
+			tokens.push_back(record.substr(start, pos - start));
+			start = pos + 1U;
+		}
+	}
+
+	//Parse commands with pattern
+	static void parse_commands_pattern(const std::wstring &pattern, int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
+	{
+		int i = offset, var_idx = 0;
+		const task_t task_pattern = queue::make_task(pattern);
+		task_t task_buffer = task_pattern;
+		std::vector<std::wstring> tokens;
+		PRINT_TRC(L"Separator: ``%s\n", separator ? separator : L"<NULL>");
+		PRINT_TRC(L"Pattern: ``%s\n", pattern.c_str());
+		while (i < argc)
+		{
+			const wchar_t *const current = argv[i++];
+			PRINT_TRC(L"Process token: %s\n", current);
+			if ((!separator) || wcscmp(current, separator))
+			{
+				const DWORD expanded = options::batch_mode ? (has_placeholder(pattern, var_idx) ? 1U : 0U) : expand_token(task_buffer, var_idx, current);
+				if(expanded < 1)
+				{
+					PRINT_WRN(L"WARNING: Discarding token \"%s\", due to missing {{%u}} placeholder!\n\n", current, var_idx);
+				}
+				if (options::batch_mode)
+				{
+					tokens.push_back(std::wstring(current)); /*expanded when the batch is formed*/
+				}
+				var_idx++;
+			}
+			else
+			{
+				if (options::batch_mode && (!tokens.empty()))
+				{
+					queue::enqueue(pack_tokens(tokens));
+					var_idx = 0;
+					tokens.clear();
+				}
+				else if ((!options::batch_mode) && (!task_buffer.command.empty()))
+				{
+					queue::enqueue(task_buffer);
+					var_idx = 0;
+					task_buffer = task_pattern;
+				}
+			}
+		}
+		if (options::batch_mode && (!tokens.empty()))
+		{
+			queue::enqueue(pack_tokens(tokens));
+		}
+		else if ((!options::batch_mode) && (!task_buffer.command.empty()) && (var_idx > 0))
+		{
+			queue::enqueue(task_buffer);
+		}
+	}
+
+	//Parse commands
+	static void parse_commands(int argc, const wchar_t *const argv[], const int offset, const wchar_t *const separator)
+	{
+		if (!options::command_pattern.empty())
+		{
+			parse_commands_pattern(options::command_pattern, argc, argv, offset, separator);
+		}
+		else
+		{
+			parse_commands_simple(argc, argv, offset, separator);
+		}
+	}
+}
+
+// ==========================================================================
+// SHARDING
+// ==========================================================================
+
+namespace shard
+{
+	namespace impl
+	{
+		static ULONGLONG              g_line_count = 0;
+		static ULONGLONG              g_owned_count = 0;
+		static ULONGLONG              g_stat_failed = 0;
+		static std::vector<ULONGLONG> g_loads;
+
+		//FNV-1a over the UTF-16 code units, followed by a SplitMix64 finalizer for better spreading
+		static ULONGLONG hash_string(const wchar_t *str, const bool fold_case)
+		{
+			ULONGLONG hash = 0xCBF29CE484222325ULL;
+			for (; *str; str++)
+			{
+				hash = (hash ^ ULONGLONG(fold_case ? towlower(*str) : (*str))) * 0x100000001B3ULL;
+			}
+			return mix64(hash);
+		}
+
+		//Get the first token of the line, i.e. the file name (may be quoted)
+		static std::wstring first_token(const wchar_t *ptr)
+		{
+			while (iswspace(*ptr))
+			{
+				ptr++;
+			}
+			const bool quoted = (*ptr == L'"');
+			const wchar_t *const start = quoted ? (++ptr) : ptr;
+			while ((*ptr) && (quoted ? (*ptr != L'"') : (!iswspace(*ptr))))
+			{
+				ptr++;
+			}
+			return std::wstring(start, ptr);
+		}
+
+		//Weight of an input line, i.e. size of the file its first token refers to (if any)
+		static ULONGLONG get_weight(const wchar_t *const line)
+		{
+			const std::wstring file_name = first_token(line);
+			WIN32_FILE_ATTRIBUTE_DATA file_info;
+			if (file_name.empty() || (!GetFileAttributesExW(file_name.c_str(), GetFileExInfoStandard, &file_info)) || (file_info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				if (!(g_stat_failed++))
+				{
+					PRINT_WRN(L"WARNING: Size of ``%s is unknown, so it is weighted as an empty file! (all instances must see the same file sizes)\n\n", file_name.c_str());
+				}
+				return 1U;
+			}
+			return ((ULONGLONG(file_info.nFileSizeHigh) << 32) | ULONGLONG(file_info.nFileSizeLow)) + 1U;
+		}
+
+		//Assign the line to the least loaded shard so far (lowest index wins ties)
+		static DWORD assign_weighted(const wchar_t *const line)
+		{
+			if (g_loads.empty())
+			{
+				g_loads.resize(options::shard_count, 0U);
+			}
+			DWORD target = 0;
+			for (DWORD i = 1; i < options::shard_count; i++)
+			{
+				if (g_loads[i] < g_loads[target])
+				{
+					target = i;
+				}
+			}
+			g_loads[target] += get_weight(line);
+			return target;
+		}
+	}
+
+	//Sharding enabled?
+	static inline bool enabled(void)
+	{
+		return options::shard_count > 1U;
+	}
+
+	//Parse shard specification, format is INDEX/COUNT (one-based)
+	static bool parse(const wchar_t *const value)
+	{
+		const wchar_t *const slash = value ? wcschr(value, L'/') : NULL;
+		DWORD index = 0, count = 0;
+		if (slash && (slash > value))
+		{
+			const std::wstring index_str(value, slash);
+			if (!(utils::string::parse_uint32(index_str.c_str(), index) && utils::string::parse_uint32(slash + 1, count)))
+			{
+				index = count = 0;
+			}
+		}
+		if ((count < 1U) || (index < 1U) || (index > count))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid shard! (format is INDEX/COUNT, with 1 <= INDEX <= COUNT)\n\n", value ? value : BLANK_STR);
+			return false;
+		}
+		options::shard_index = index - 1U;
+		options::shard_count = count;
+		return true;
+	}
+
+	//Does this instance own the given input line? Called once per line, in input order
+	static bool owns_line(const wchar_t *const line)
+	{
+		if (!enabled())
+		{
+			return true;
+		}
+		DWORD target;
+		switch (options::shard_mode)
+		{
+		case SHARD_LINE:
+			target = DWORD(impl::g_line_count % options::shard_count);
+			break;
+		case SHARD_SIZE:
+			target = impl::assign_weighted(line);
+			break;
+		default:
+			target = DWORD(impl::hash_string(line, false) % options::shard_count);
+			break;
+		}
+		impl::g_line_count++;
+		if (target == options::shard_index)
+		{
+			impl::g_owned_count++;
+			return true;
+		}
+		return false;
+	}
+
+	//Does this instance own the given file? The path is relative to the search directory (thread-safe)
+	static bool owns_path(const wchar_t *const path)
+	{
+		return (!enabled()) || ((impl::hash_string(path, true) % options::shard_count) == options::shard_index);
+	}
+
+	//First task index owned by this instance, for the input generators
+	static inline ULONGLONG first_index(void)
+	{
+		return options::shard_index;
+	}
+
+	//Distance between task indices owned by this instance, for the input generators
+	static inline ULONGLONG stride(void)
+	{
+		return enabled() ? options::shard_count : 1U;
+	}
+
+	//Print statistics
+	static void print_stats(void)
+	{
+		if (enabled() && (impl::g_line_count > 0U))
+		{
+			PRINT_TRC(L"Shard %u/%u owns %I64u of %I64u input lines.\n", options::shard_index + 1U, options::shard_count, impl::g_owned_count, impl::g_line_count);
+		}
+		if (impl::g_stat_failed > 1U)
+		{
+			PRINT_WRN(L"WARNING: The size of %I64u input file(s) was unknown, the shards may overlap or miss lines!\n\n", impl::g_stat_failed);
+		}
+	}
+}
+
+// ==========================================================================
+// INPUT GENERATORS
+// ==========================================================================
+
+namespace generator
+{
+	namespace impl
+	{
+		typedef struct _source_t
+		{
+			bool      is_range;
+			LONGLONG  start;
+			LONGLONG  step;
+			ULONGLONG count;
+			std::vector<std::wstring> values;
+		}
+		source_t;
+
+		static std::vector<source_t> g_sources;
+		static ULONGLONG g_total = 0;
+		static ULONGLONG g_next = 0;
+		static ULONGLONG g_stride = 1;
+
+		//Parse a signed 64-Bit integer
+		static bool parse_int64(const wchar_t *const str, LONGLONG &value)
+		{
+			wchar_t *end = NULL;
+			value = _wcstoi64(str, &end, 10);
+			return (end != str) && end && (!(*end));
+		}
+
+		//Add a source from an argument list
+		static void add_list(const int argc, const wchar_t *const argv[], int &i)
+		{
+			source_t source;
+			source.is_range = false;
+			source.start = source.step = 0;
+			while ((i < argc) && wcscmp(argv[i], L":::") && wcscmp(argv[i], L"::::"))
+			{
+				source.values.push_back(std::wstring(argv[i++]));
+			}
+			source.count = source.values.size();
+			g_sources.push_back(source);
+		}
+
+		//Add a source from the lines of a file
+		static bool add_file(const wchar_t *const file_name)
+		{
+			FILE *file = NULL;
+			if (_wfopen_s(&file, file_name, options::encoding_utf16 ? L"r,ccs=UTF-16LE" : L"r,ccs=UTF-8") != 0)
+			{
+				PRINT_ERR(L"ERROR: Unbale to open file \"%s\" for reading!\n\n", file_name);
+				return false;
+			}
+			source_t source;
+			source.is_range = false;
+			source.start = source.step = 0;
+			wchar_t buffer[4096];
+			std::wstring line;
+			while (fgetws(buffer, 4096, file))
+			{
+				line += buffer;
+				if ((!line.empty()) && (line[line.length() - 1] != L'\n') && (!feof(file)))
+				{
+					continue; /*line is longer than the buffer*/
+				}
+				while ((!line.empty()) && ((line[line.length() - 1] == L'\n') || (line[line.length() - 1] == L'\r')))
+				{
+					line.erase(line.length() - 1);
+				}
+				if (!line.empty())
+				{
+					source.values.push_back(line);
+				}
+				line.clear();
+			}
+			CLOSE_FILE(file);
+			source.count = source.values.size();
+			g_sources.push_back(source);
+			return true;
+		}
+
+		//Number of tasks from the given index on that are owned by this instance
+		static inline ULONGLONG count_from(const ULONGLONG index)
+		{
+			return (index < g_total) ? (((g_total - index - 1U) / g_stride) + 1U) : 0U;
+		}
+
+		//Get the value of the source at the given index
+		static std::wstring get_value(const source_t &source, const ULONGLONG index)
+		{
+			if (source.is_range)
+			{
+				wchar_t buffer[32];
+				_snwprintf_s(buffer, 32, _TRUNCATE, L"%I64d", source.start + (LONGLONG(index) * source.step));
+				return std::wstring(buffer);
+			}
+			return source.values[size_t(index)];
+		}
+	}
+
+	//Any sources defined?
+	static inline bool enabled(void)
+	{
+		return !impl::g_sources.empty();
+	}
+
+	//Add a range source, format is START:END[:STEP]
+	static bool add_range(const wchar_t *const value)
+	{
+		std::vector<std::wstring> parts;
+		std::wstring part;
+		for (const wchar_t *ptr = value; ptr && (*ptr); ptr++)
+		{
+			if (*ptr == L':')
+			{
+				parts.push_back(part);
+				part.clear();
+				continue;
+			}
+			part.push_back(*ptr);
+		}
+		parts.push_back(part);
+
+		impl::source_t source;
+		source.is_range = true;
+		LONGLONG end = 0;
+		source.step = 1;
+		if ((parts.size() < 2U) || (parts.size() > 3U) || (!impl::parse_int64(parts[0].c_str(), source.start)) || (!impl::parse_int64(parts[1].c_str(), end)) || ((parts.size() > 2U) && (!impl::parse_int64(parts[2].c_str(), source.step))) || (source.step == 0))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid range! (format is START:END[:STEP])\n\n", value ? value : BLANK_STR);
+			return false;
+		}
+		if ((source.step > 0) ? (end < source.start) : (end > source.start))
+		{
+			source.count = 0;
+		}
+		else
+		{
+			const ULONGLONG distance = (source.step > 0) ? ULONGLONG(end - source.start) : ULONGLONG(source.start - end);
+			const ULONGLONG stride = (source.step > 0) ? ULONGLONG(source.step) : ULONGLONG(-source.step);
+			source.count = (distance / stride) + 1U;
+		}
+		impl::g_sources.push_back(source);
+		return true;
+	}
+
+	//Parse argument lists (":::") and input files ("::::") from the command-line
+	static bool parse_sources(const int argc, const wchar_t *const argv[], const int offset)
+	{
+		int i = offset;
+		while (i < argc)
+		{
+			const bool files = (wcscmp(argv[i], L"::::") == 0);
+			if (!(files || (wcscmp(argv[i], L":::") == 0)))
+			{
+				PRINT_ERR(L"ERROR: Unexpected token \"%s\" in argument lists!\n\n", argv[i]);
+				return false;
+			}
+			i++;
+			if (!files)
+			{
+				impl::add_list(argc, argv, i);
+				continue;
+			}
+			while ((i < argc) && wcscmp(argv[i], L":::") && wcscmp(argv[i], L"::::"))
+			{
+				if (!impl::add_file(argv[i++]))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//Compute the total number of tasks
+	static bool initialize(void)
+	{
+		impl::g_total = options::link_sources ? 0U : 1U;
+		for (std::vector<impl::source_t>::const_iterator iter = impl::g_sources.begin(); iter != impl::g_sources.end(); iter++)
+		{
+			if (options::link_sources)
+			{
+				impl::g_total = std::max(impl::g_total, iter->count);
+				continue;
+			}
+			if ((iter->count > 0U) && (impl::g_total > (ULONGLONG(MAXDWORD) / iter->count)))
+			{
+				PRINT_ERR(L"ERROR: The input sources produce more than %u tasks!\n\n", MAXDWORD);
+				return false;
+			}
+			impl::g_total *= iter->count;
+		}
+		if (options::link_sources && (impl::g_total > 0U))
+		{
+			for (std::vector<impl::source_t>::const_iterator iter = impl::g_sources.begin(); iter != impl::g_sources.end(); iter++)
+			{
+				if (iter->count < 1U)
+				{
+					impl::g_total = 0U; /*can not wrap around an empty source*/
+				}
+			}
+		}
+		if (impl::g_total > ULONGLONG(MAXDWORD))
+		{
+			PRINT_ERR(L"ERROR: The input sources produce more than %u tasks!\n\n", MAXDWORD);
+			return false;
+		}
+		impl::g_next = shard::first_index();
+		impl::g_stride = shard::stride();
+		PRINT_TRC(L"Input sources: %u, total tasks: %I64u, owned tasks: %I64u\n", DWORD(impl::g_sources.size()), impl::g_total, impl::count_from(impl::g_next));
+		return true;
+	}
+
+	//Total number of tasks
+	static inline DWORD total(void)
+	{
+		return DWORD(impl::count_from(shard::first_index()));
+	}
+
+	//Number of tasks not generated yet
+	static inline DWORD remaining(void)
+	{
+		return DWORD(impl::count_from(impl::g_next));
+	}
+
+	//Any more tasks to be generated?
+	static inline bool have_more(void)
+	{
+		return impl::g_next < impl::g_total;
+	}
+
+	//Get the values of the next combination (the last source varies fastest)
+	static void next_values(std::vector<std::wstring> &values)
+	{
+		assert(have_more());
+		const size_t source_count = impl::g_sources.size();
+		values.resize(source_count);
+		ULONGLONG index = impl::g_next;
+		impl::g_next += impl::g_stride;
+		for (size_t k = source_count; k > 0; k--)
+		{
+			const impl::source_t &source = impl::g_sources[k - 1U];
+			values[k - 1U] = impl::get_value(source, index % source.count);
+			if (!options::link_sources)
+			{
+				index /= source.count;
+			}
+		}
+	}
+
+	//Generate the next task from the current combination
+	static void next_task(task_t &task)
+	{
+		std::vector<std::wstring> values;
+		next_values(values);
+		const size_t source_count = values.size();
+
+		if (options::command_pattern.empty())
+		{
+			std::wstringstream command_buffer;
+			for (size_t k = 0; k < source_count; k++)
+			{
+				if (k > 0)
+				{
+					command_buffer << L' ';
+				}
+				if (values[k].empty() || utils::string::contains_whitespace(values[k].c_str()))
+				{
+					command_buffer << L'"' << values[k] << L'"';
+				}
+				else
+				{
+					command_buffer << values[k];
+				}
+			}
+			queue::init_task(task, command_buffer.str());
+			return;
+		}
+
+		queue::init_task(task, options::command_pattern);
+		for (size_t k = 0; k < source_count; k++)
+		{
+			command::expand_token(task, DWORD(k), values[k].c_str());
+		}
+	}
+}
+
+// ==========================================================================
+// DIRECTORY WALKER
+// ==========================================================================
+
+namespace walker
+{
+	namespace impl
+	{
+		static const size_t HIGH_WATER = 65536U;
+		static const size_t LOW_WATER  = 16384U;
+		static const size_t BATCH_SIZE = 256U;
+		static const DWORD  MAX_THREADS = 8U;
+
+		static CRITICAL_SECTION          g_lock;
+		static std::vector<std::wstring> g_directories;
+		static std::deque<std::wstring>  g_files;
+		static HANDLE    g_dir_semaphore = NULL;
+		static HANDLE    g_space_event = NULL;
+		static HANDLE    g_ready_event = NULL;
+		static HANDLE    g_threads[MAX_THREADS];
+		static DWORD     g_thread_count = 0;
+		static DWORD     g_busy = 0;
+		static size_t    g_root_length = 0;
+		static bool      g_finished = true;
+		static volatile LONG g_stop = 0;
+
+		static std::vector<std::wstring> g_name_filter;
+		static int       g_size_cmp = 0, g_age_cmp = 0;
+		static ULONGLONG g_size_limit = 0, g_time_limit = 0;
+
+		//Match file name against a wildcard pattern with '*' and '?' (case-insensitive)
+		static bool match_glob(const wchar_t *name, const wchar_t *pattern)
+		{
+			const wchar_t *star = NULL, *resume = NULL;
+			while (*name)
+			{
+				if ((*pattern == L'?') || ((*pattern != L'*') && (*pattern) && (towlower(*pattern) == towlower(*name))))
+				{
+					name++;
+					pattern++;
+				}
+				else if (*pattern == L'*')
+				{
+					star = pattern++;
+					resume = name;
+				}
+				else if (star)
+				{
+					pattern = star + 1;
+					name = ++resume;
+				}
+				else
+				{
+					return false;
+				}
+			}
+			while (*pattern == L'*')
+			{
+				pattern++;
+			}
+			return !(*pattern);
+		}
+
+		//Does the file pass all filters?
+		static bool accept_file(const WIN32_FIND_DATAW &data)
+		{
+			if (!g_name_filter.empty())
+			{
+				bool matched = false;
+				for (std::vector<std::wstring>::const_iterator iter = g_name_filter.begin(); (!matched) && (iter != g_name_filter.end()); iter++)
+				{
+					matched = match_glob(data.cFileName, iter->c_str());
+				}
+				if (!matched)
+				{
+					return false;
+				}
+			}
+			if (g_size_cmp)
+			{
+				const ULONGLONG size = (ULONGLONG(data.nFileSizeHigh) << 32) | ULONGLONG(data.nFileSizeLow);
+				if ((g_size_cmp > 0) ? (size <= g_size_limit) : (size >= g_size_limit))
+				{
+					return false;
+				}
+			}
+			if (g_age_cmp)
+			{
+				const ULONGLONG mtime = (ULONGLONG(data.ftLastWriteTime.dwHighDateTime) << 32) | ULONGLONG(data.ftLastWriteTime.dwLowDateTime);
+				if ((g_age_cmp < 0) ? (mtime < g_time_limit) : (mtime >= g_time_limit))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//Hand over a batch of files to the main thread, block while the buffer is full
+		static void flush_files(std::vector<std::wstring> &batch)
+		{
+			if (batch.empty())
+			{
+				return;
+			}
+			bool full = false;
+			EnterCriticalSection(&g_lock);
+			if (g_stop)
+			{
+				LeaveCriticalSection(&g_lock);
+				batch.clear();
+				return; /*nobody is going to take the files anymore*/
+			}
+			for (std::vector<std::wstring>::iterator iter = batch.begin(); iter != batch.end(); iter++)
+			{
+				g_files.push_back(std::wstring());
+				g_files.back().swap(*iter);
+			}
+			if (full = (g_files.size() >= HIGH_WATER))
+			{
+				ResetEvent(g_space_event);
+			}
+			LeaveCriticalSection(&g_lock);
+			batch.clear();
+			SetEvent(g_ready_event);
+			if (full)
+			{
+				WaitForSingleObject(g_space_event, INFINITE);
+			}
+		}
+
+		//Add the "\\?\" prefix, so that directories deeper than MAX_PATH can be enumerated
+		static std::wstring extended_path(const std::wstring &directory)
+		{
+			if ((directory.compare(0, 4, L"\\\\?\\") == 0) || (directory.compare(0, 4, L"\\\\.\\") == 0))
+			{
+				return directory;
+			}
+			if (directory.compare(0, 2, L"\\\\") == 0)
+			{
+				return std::wstring(L"\\\\?\\UNC\\").append(directory, 2, std::wstring::npos);
+			}
+			return std::wstring(L"\\\\?\\").append(directory);
+		}
+
+		//Scan a single directory, sub-directories are pushed to the shared stack
+		static void scan_directory(const std::wstring &directory, std::vector<std::wstring> &batch)
+		{
+			WIN32_FIND_DATAW data;
+			const std::wstring search = extended_path(directory) + L"\\*";
+			HANDLE handle = FindFirstFileExW(search.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+			if (handle == INVALID_HANDLE_VALUE)
+			{
+				if (GetLastError() != ERROR_INVALID_PARAMETER)
+				{
+					PRINT_TRC(L"Failed to enumerate directory: %s\n", directory.c_str());
+					return;
+				}
+				if ((handle = FindFirstFileW(search.c_str(), &data)) == INVALID_HANDLE_VALUE)
+				{
+					return; /*extended info level is not supported by this OS*/
+				}
+			}
+
+			std::vector<std::wstring> subdirs;
+			do
+			{
+				if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				{
+					const bool is_dots = (data.cFileName[0] == L'.') && ((!data.cFileName[1]) || ((data.cFileName[1] == L'.') && (!data.cFileName[2])));
+					if ((!is_dots) && (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)))
+					{
+						subdirs.push_back(directory + L'\\' + data.cFileName);
+					}
+				}
+				else if (accept_file(data))
+				{
+					std::wstring file_name(directory + L'\\' + data.cFileName);
+					if (!shard::owns_path(file_name.c_str() + g_root_length))
+					{
+						continue;
+					}
+					batch.push_back(std::wstring());
+					batch.back().swap(file_name);
+					if (batch.size() >= BATCH_SIZE)
+					{
+						flush_files(batch);
+					}
+				}
+			}
+			while ((!g_stop) && FindNextFileW(handle, &data));
+			FindClose(handle);
+
+			if (!subdirs.empty())
+			{
+				EnterCriticalSection(&g_lock);
+				g_directories.insert(g_directories.end(), subdirs.begin(), subdirs.end());
+				LeaveCriticalSection(&g_lock);
+				ReleaseSemaphore(g_dir_semaphore, LONG(subdirs.size()), NULL);
+			}
+		}
+
+		//Walker thread, takes directories from the shared stack until the walk is complete
+		static unsigned __stdcall walker_thread(void *const)
+		{
+			std::vector<std::wstring> batch;
+			batch.reserve(BATCH_SIZE);
+			for (;;)
+			{
+				WaitForSingleObject(g_dir_semaphore, INFINITE);
+				EnterCriticalSection(&g_lock);
+				if (g_finished || g_directories.empty())
+				{
+					LeaveCriticalSection(&g_lock);
+					break;
+				}
+				std::wstring directory;
+				directory.swap(g_directories.back());
+				g_directories.pop_back();
+				g_busy++;
+				LeaveCriticalSection(&g_lock);
+
+				if (!g_stop)
+				{
+					scan_directory(directory, batch);
+				}
+				flush_files(batch);
+
+				EnterCriticalSection(&g_lock);
+				if ((--g_busy < 1) && (g_stop || g_directories.empty()))
+				{
+					g_finished = true;
+					ReleaseSemaphore(g_dir_semaphore, LONG(MAX_THREADS), NULL);
+				}
+				LeaveCriticalSection(&g_lock);
+			}
+			SetEvent(g_ready_event);
+			return 0;
+		}
+
+		//Parse a filter of the form "+N" or "-N"
+		static bool parse_filter(const std::wstring &spec, int &cmp, ULONGLONG &value, const bool is_size)
+		{
+			cmp = ((!spec.empty()) && (spec[0] == L'+')) ? 1 : (((!spec.empty()) && (spec[0] == L'-')) ? -1 : 0);
+			if (cmp)
+			{
+				DWORD days = 0;
+				if (is_size ? utils::string::parse_size(spec.c_str() + 1, value) : utils::string::parse_uint32(spec.c_str() + 1, days))
+				{
+					value = is_size ? value : ULONGLONG(days);
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
+	//Directory walker enabled?
+	static inline bool enabled(void)
+	{
+		return !options::find_root.empty();
+	}
+
+	//Start the walker threads
+	static bool start(void)
+	{
+		if (!utils::files::directory_exists(options::find_root.c_str()))
+		{
+			PRINT_ERR(L"ERROR: Specified search directory \"%s\" does NOT exist!\n\n", options::find_root.c_str());
+			return false;
+		}
+		if ((!options::find_size.empty()) && (!impl::parse_filter(options::find_size, impl::g_size_cmp, impl::g_size_limit, true)))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid size filter! (format is +SIZE or -SIZE)\n\n", options::find_size.c_str());
+			return false;
+		}
+		if (!options::find_mtime.empty())
+		{
+			ULONGLONG days = 0;
+			if (!impl::parse_filter(options::find_mtime, impl::g_age_cmp, days, false))
+			{
+				PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid age filter! (format is +DAYS or -DAYS)\n\n", options::find_mtime.c_str());
+				return false;
+			}
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			const ULONGLONG now_value = (ULONGLONG(now.dwHighDateTime) << 32) | ULONGLONG(now.dwLowDateTime);
+			const ULONGLONG age = days * 864000000000ULL; /*100ns units per day*/
+			impl::g_time_limit = (now_value > age) ? (now_value - age) : 0U;
+		}
+
+		std::wstring pattern;
+		for (const wchar_t *ptr = options::find_name.c_str(); ; ptr++)
+		{
+			if ((*ptr) && (*ptr != L';'))
+			{
+				pattern.push_back(*ptr);
+				continue;
+			}
+			if (!pattern.empty())
+			{
+				impl::g_name_filter.push_back(pattern);
+				pattern.clear();
+			}
+			if (!(*ptr))
+			{
+				break;
+			}
+		}
+
+		std::wstring root = utils::files::get_full_path(options::find_root.c_str());
+		while ((root.length() > 3U) && ((root[root.length() - 1] == L'\\') || (root[root.length() - 1] == L'/')))
+		{
+			root.erase(root.length() - 1);
+		}
+		if ((!root.empty()) && (root[root.length() - 1] == L'\\'))
+		{
+			root.erase(root.length() - 1); /*drive root, e.g. "C:\"*/
+		}
+
+		InitializeCriticalSection(&impl::g_lock);
+		impl::g_ready_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+		impl::g_space_event = CreateEventW(NULL, TRUE, TRUE, NULL);
+		impl::g_dir_semaphore = CreateSemaphoreW(NULL, 0, MAXLONG, NULL);
+		if (!(impl::g_ready_event && impl::g_space_event && impl::g_dir_semaphore))
+		{
+			PRINT_ERR(L"ERROR: Failed to create the directory walker!\n\n");
+			return false;
+		}
+
+		impl::g_finished = false;
+		impl::g_root_length = root.length() + 1U;
+		impl::g_directories.push_back(root);
+		ReleaseSemaphore(impl::g_dir_semaphore, 1, NULL);
+
+		const DWORD thread_count = BOUND(DWORD(1), utils::sysinfo::get_processor_count(), impl::MAX_THREADS);
+		for (DWORD i = 0; i < thread_count; i++)
+		{
+			if (impl::g_threads[impl::g_thread_count] = (HANDLE)_beginthreadex(NULL, 0, impl::walker_thread, NULL, 0, NULL))
+			{
+				impl::g_thread_count++;
+			}
+		}
+		if (impl::g_thread_count < 1)
+		{
+			PRINT_ERR(L"ERROR: Failed to create the directory walker threads!\n\n");
+			return false;
+		}
+
+		PRINT_TRC(L"Directory walker started with %u threads: %s\n", impl::g_thread_count, root.c_str());
+		return true;
+	}
+
+	//Stop the walk, wait for the walker threads to exit and release them
+	static void stop(void)
+	{
+		if (impl::g_thread_count < 1)
+		{
+			return;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		InterlockedExchange(&impl::g_stop, 1L);
+		SetEvent(impl::g_space_event); /*under the lock, so no thread can reset it after this point*/
+		LeaveCriticalSection(&impl::g_lock);
+
+		WaitForMultipleObjects(impl::g_thread_count, impl::g_threads, TRUE, INFINITE);
+		for (DWORD i = 0; i < impl::g_thread_count; i++)
+		{
+			CLOSE_HANDLE(impl::g_threads[i]);
+		}
+		impl::g_thread_count = 0;
+		PRINT_TRC(L"Directory walker stopped.\n");
+	}
+
+	//Get the event that is signaled when new files are available
+	static inline HANDLE get_handle(void)
+	{
+		return impl::g_ready_event;
+	}
+
+	//Are any files available right now?
+	static bool ready(void)
+	{
+		if (!impl::g_ready_event)
+		{
+			return false;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		const bool result = !impl::g_files.empty();
+		LeaveCriticalSection(&impl::g_lock);
+		return result;
+	}
+
+	//Are there any files left, or is the walk still running?
+	static bool have_more(void)
+	{
+		if (!impl::g_ready_event)
+		{
+			return false;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		const bool result = (!impl::g_files.empty()) || (!impl::g_finished);
+		LeaveCriticalSection(&impl::g_lock);
+		return result;
+	}
+
+	//Take the next file from the buffer
+	static void next_file(std::wstring &file_name)
+	{
+		EnterCriticalSection(&impl::g_lock);
+		assert(!impl::g_files.empty());
+		file_name.swap(impl::g_files.front());
+		impl::g_files.pop_front();
+		if (impl::g_files.size() <= impl::LOW_WATER)
+		{
+			SetEvent(impl::g_space_event);
+		}
+		LeaveCriticalSection(&impl::g_lock);
+	}
+
+	//Generate the task for the next file (the file is mapped to {{0}})
+	static void next_task(task_t &task)
+	{
+		std::wstring file_name;
+		next_file(file_name);
+		if (options::command_pattern.empty())
+		{
+			queue::init_task(task, L"\"" + file_name + L"\"");
+			return;
+		}
+		queue::init_task(task, options::command_pattern);
+		command::expand_token(task, 0, file_name.c_str());
+	}
+}
+
+// ==========================================================================
+// ARGUMENT BATCHING
+// ==========================================================================
+
+namespace batch
+{
+	namespace impl
+	{
+		static const DWORD MAX_CHARS_DIRECT = 32767U - 1U;
+		static const DWORD MAX_CHARS_SHELL  = 8191U - 32U;
+		static const DWORD MAX_ADAPTIVE     = 65536U;
+		static const double OVERHEAD_RATIO  = 0.05;
+
+		typedef struct _placeholder_t
+		{
+			DWORD        index;
+			wchar_t      postfix;
+			DWORD        count;
+			std::wstring list;
+		}
+		placeholder_t;
+
+		static std::vector<placeholder_t> g_placeholders;
+		static size_t                     g_fixed_length = 0;
+		static DWORD                      g_max_chars = MAX_CHARS_DIRECT;
+		static std::vector<std::wstring>  g_pending;
+		static bool                       g_have_pending = false;
+		static DWORD                      g_last_count = 1;
+		static DWORD                      g_slot_items[MAX_TASKS];
+
+		//Adaptive batch size, least-squares fit of "time = overhead + items * per_item"
+		static DWORD  g_adaptive_size = 1;
+		static DWORD  g_samples = 0;
+		static double g_sum_n = 0.0, g_sum_t = 0.0, g_sum_nn = 0.0, g_sum_nt = 0.0;
+
+		//Find all distinct placeholders in the pattern
+		static void parse_pattern(const std::wstring &pattern)
+		{
+			size_t placeholder_length = 0;
+			for (size_t pos = pattern.find(L"{{"); pos != std::wstring::npos; pos = pattern.find(L"{{", pos + 1U))
+			{
+				size_t end = pos + 2U;
+				DWORD index = 0;
+				while ((end < pattern.length()) && iswdigit(pattern[end]))
+				{
+					index = (10U * index) + DWORD(pattern[end++] - L'0');
+				}
+				if (end == pos + 2U)
+				{
+					continue; /*not a token placeholder*/
+				}
+				wchar_t postfix = 0x00;
+				if ((end + 1U < pattern.length()) && (pattern[end] == L':') && wcschr(L"FDPNX", pattern[end + 1U]))
+				{
+					postfix = pattern[end + 1U];
+					end += 2U;
+				}
+				if (pattern.compare(end, 2U, L"}}") != 0)
+				{
+					continue;
+				}
+				placeholder_length += (end + 2U) - pos;
+				bool found = false;
+				for (std::vector<placeholder_t>::iterator iter = g_placeholders.begin(); iter != g_placeholders.end(); iter++)
+				{
+					if ((iter->index == index) && (iter->postfix == postfix))
+					{
+						iter->count++;
+						found = true;
+						break;
+					}
+				}
+				if (!found)
+				{
+					placeholder_t placeholder;
+					placeholder.index = index;
+					placeholder.postfix = postfix;
+					placeholder.count = 1U;
+					g_placeholders.push_back(placeholder);
+				}
+			}
+			g_fixed_length = pattern.length() - placeholder_length;
+		}
+
+		//Get the value of the placeholder for the given token, e.g. the file name part
+		static std::wstring derive_value(const std::wstring &token, const wchar_t postfix)
+		{
+			if (!postfix)
+			{
+				return token;
+			}
+			const std::wstring file_full = utils::files::get_full_path(token.c_str());
+			if (file_full.empty() || (postfix == L'F'))
+			{
+				return file_full;
+			}
+			std::wstring file_drive, file_dir, file_fname, file_ext;
+			if (!utils::files::split_file_name(file_full.c_str(), file_drive, file_dir, file_fname, file_ext))
+			{
+				return std::wstring();
+			}
+			switch (postfix)
+			{
+				case L'D': return file_drive;
+				case L'P': return file_dir;
+				case L'N': return file_fname;
+				default:   return file_ext;
+			}
+		}
+
+		//Append a value to a list, every value is quoted if required
+		static size_t append_value(std::wstring &list, const std::wstring &value)
+		{
+			const size_t length = list.length();
+			if (!list.empty())
+			{
+				list.push_back(L' ');
+			}
+			if (value.empty() || options::auto_quote_vars || utils::string::contains_whitespace(value.c_str()))
+			{
+				list.push_back(L'"');
+				list += value;
+				list.push_back(L'"');
+			}
+			else
+			{
+				list += value;
+			}
+			return list.length() - length;
+		}
+
+		//Take the tokens of the next input, from the queue, then from the input generators or the directory walker
+		static bool next_record(std::vector<std::wstring> &tokens)
+		{
+			if (g_have_pending)
+			{
+				tokens.swap(g_pending);
+				g_have_pending = false;
+				return true;
+			}
+			if (queue::have_more())
+			{
+				task_t task;
+				queue::dequeue(task);
+				command::unpack_tokens(task.command, tokens);
+				return true;
+			}
+			if (generator::have_more())
+			{
+				generator::next_values(tokens);
+				return true;
+			}
+			if (walker::ready())
+			{
+				tokens.resize(1U);
+				walker::next_file(tokens[0]);
+				queue::g_queue_max++; /*total is not known in advance*/
+				return true;
+			}
+			return false;
+		}
+
+		//Compute the maximum number of inputs for the next batch
+		static DWORD target_size(void)
+		{
+			DWORD limit = (options::batch_max_args > 0U) ? options::batch_max_args : MAXDWORD;
+			if (options::batch_adaptive)
+			{
+				limit = std::min(limit, g_adaptive_size);
+			}
+			if (!walker::enabled())
+			{
+				const ULONGLONG remaining = ULONGLONG(queue::size()) + generator::remaining() + (g_have_pending ? 1U : 0U);
+				const ULONGLONG fair_share = (remaining + options::max_instances - 1U) / std::max(options::max_instances, DWORD(1));
+				limit = DWORD(std::min(ULONGLONG(limit), std::max(fair_share, ULONGLONG(1)))); /*spread the tail evenly*/
+			}
+			return std::max(limit, DWORD(1));
+		}
+
+		//Update the adaptive batch size from a completed batch
+		static void update_adaptive(const DWORD items, const double seconds)
+		{
+			g_samples++;
+			g_sum_n  += double(items);
+			g_sum_t  += seconds;
+			g_sum_nn += double(items) * double(items);
+			g_sum_nt += double(items) * seconds;
+
+			const double denominator = (double(g_samples) * g_sum_nn) - (g_sum_n * g_sum_n);
+			if ((g_samples < 2U) || (denominator <= 0.0))
+			{
+				g_adaptive_size = std::min(2U * std::max(g_adaptive_size, items), MAX_ADAPTIVE); /*need more distinct sizes first*/
+				return;
+			}
+			const double per_item = ((double(g_samples) * g_sum_nt) - (g_sum_n * g_sum_t)) / denominator;
+			const double overhead = (g_sum_t - (per_item * g_sum_n)) / double(g_samples);
+			if (per_item <= 0.0)
+			{
+				g_adaptive_size = std::min(2U * std::max(g_adaptive_size, items), MAX_ADAPTIVE); /*run time is all overhead*/
+				return;
+			}
+			const double optimum = std::max(overhead, 0.0) / (OVERHEAD_RATIO * per_item);
+			g_adaptive_size = DWORD(BOUND(1.0, optimum + 1.0, double(MAX_ADAPTIVE)));
+			PRINT_TRC(L"Batch overhead: %.1f ms, per item: %.1f ms -> batch size: %u\n", overhead * 1000.0, per_item * 1000.0, g_adaptive_size);
+		}
+	}
+
+	//Batching enabled?
+	static inline bool enabled(void)
+	{
+		return options::batch_mode;
+	}
+
+	//Setup the placeholders and the command-line length limit
+	static void initialize(void)
+	{
+		impl::parse_pattern(options::command_pattern);
+		impl::g_max_chars = (options::batch_max_chars > 0U) ? options::batch_max_chars : (options::force_use_shell ? impl::MAX_CHARS_SHELL : impl::MAX_CHARS_DIRECT);
+		PRINT_TRC(L"Batching: %u placeholders, at most %u arguments and %u characters per command\n", DWORD(impl::g_placeholders.size()), options::batch_max_args, impl::g_max_chars);
+	}
+
+	//Is an input left over from the previous batch?
+	static inline bool have_more(void)
+	{
+		return impl::g_have_pending;
+	}
+
+	//Pack the next inputs into a single task, each placeholder expands to the list of all values in the batch
+	static void next_task(task_t &task)
+	{
+		const DWORD limit = impl::target_size();
+		size_t length = impl::g_fixed_length;
+		DWORD count = 0;
+		std::vector<std::wstring> tokens, values(impl::g_placeholders.size());
+		while ((count < limit) && impl::next_record(tokens))
+		{
+			size_t added = 0;
+			for (size_t i = 0; i < impl::g_placeholders.size(); i++)
+			{
+				const impl::placeholder_t &placeholder = impl::g_placeholders[i];
+				values[i] = (placeholder.index < tokens.size()) ? impl::derive_value(tokens[placeholder.index], placeholder.postfix) : std::wstring();
+				added += placeholder.count * (values[i].length() + 3U);
+			}
+			if ((count > 0U) && (length + added > impl::g_max_chars))
+			{
+				impl::g_pending.swap(tokens);
+				impl::g_have_pending = true; /*start the next batch with this input*/
+				break;
+			}
+			length = impl::g_fixed_length;
+			for (size_t i = 0; i < impl::g_placeholders.size(); i++)
+			{
+				impl::placeholder_t &placeholder = impl::g_placeholders[i];
+				if (placeholder.index < tokens.size())
+				{
+					impl::append_value(placeholder.list, values[i]);
+				}
+				length += placeholder.count * placeholder.list.length();
+			}
+			count++;
+		}
+		if (length > impl::g_max_chars)
+		{
+			PRINT_WRN(L"WARNING: The command exceeds the limit of %u characters!\n\n", impl::g_max_chars);
+		}
+
+		queue::init_task(task, options::command_pattern);
+		for (std::vector<impl::placeholder_t>::iterator iter = impl::g_placeholders.begin(); iter != impl::g_placeholders.end(); iter++)
+		{
+			command::expand_placeholder(task.command, iter->index, iter->postfix, iter->list.c_str(), false);
+			iter->list.clear();
+		}
+		if (count > 1U)
+		{
+			queue::g_queue_max -= std::min(queue::g_queue_max, count - 1U); /*count invocations, not inputs*/
+		}
+		impl::g_last_count = count;
+		PRINT_TRC(L"Batch of %u inputs (limit: %u)\n", count, limit);
+	}
+
+	//A task has been started in the slot
+	static inline void task_started(const DWORD slot)
+	{
+		impl::g_slot_items[slot] = impl::g_last_count;
+		impl::g_last_count = 1U;
+	}
+
+	//The task in the slot has completed, the elapsed time is given in timer ticks
+	static void task_finished(const DWORD slot, const ULONGLONG elapsed)
+	{
+		if (options::batch_adaptive && (impl::g_slot_items[slot] > 0U))
+		{
+			impl::update_adaptive(impl::g_slot_items[slot], double(elapsed) / double(utils::sysinfo::get_timer_frequency()));
+		}
+	}
+}
+
+// ==========================================================================
+// HALTING POLICY
+// ==========================================================================
+
+namespace halt
+{
+	namespace impl
+	{
+		static bool    g_triggered = false;
+		static wchar_t g_reason[128] = { L'\0' };
+	}
+
+	//Halting policy enabled?
+	static inline bool enabled(void)
+	{
+		return options::halt_mode != HALT_NEVER;
+	}
+
+	//Parse halting policy, format is MODE[,fail=N|fail=P%|success=N|success=P%]
+	static bool parse(const wchar_t *const value)
+	{
+		const std::wstring spec(value ? value : BLANK_STR);
+		const size_t comma = spec.find(L',');
+		const std::wstring mode = spec.substr(0, comma);
+		if (!(MATCH(mode.c_str(), L"never") || MATCH(mode.c_str(), L"soon") || MATCH(mode.c_str(), L"now")))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid halting policy! (mode must be 'never', 'soon' or 'now')\n\n", spec.c_str());
+			return false;
+		}
+		options::halt_mode = MATCH(mode.c_str(), L"now") ? HALT_NOW : (MATCH(mode.c_str(), L"soon") ? HALT_SOON : HALT_NEVER);
+		options::halt_on_success = options::halt_percent = false;
+		options::halt_threshold = 1U;
+		if (comma == std::wstring::npos)
+		{
+			return true; /*halt on the first failure*/
+		}
+
+		std::wstring condition = spec.substr(comma + 1U);
+		const size_t equals = condition.find(L'=');
+		const std::wstring kind = condition.substr(0, equals);
+		if ((equals == std::wstring::npos) || (!(MATCH(kind.c_str(), L"fail") || MATCH(kind.c_str(), L"success"))))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid halting policy! (condition must be 'fail=N' or 'success=N')\n\n", spec.c_str());
+			return false;
+		}
+		condition.erase(0, equals + 1U);
+		if ((!condition.empty()) && (condition[condition.length() - 1] == L'%'))
+		{
+			options::halt_percent = true;
+			condition.erase(condition.length() - 1);
+		}
+		DWORD threshold = 0;
+		if (!(utils::string::parse_uint32(condition.c_str(), threshold) && (threshold > 0U) && ((!options::halt_percent) || (threshold <= 100U))))
+		{
+			PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid halting policy! (threshold must be 1..N or 1..100%%)\n\n", spec.c_str());
+			return false;
+		}
+		options::halt_on_success = MATCH(kind.c_str(), L"success");
+		options::halt_threshold = threshold;
+		return true;
+	}
+
+	//Update the policy after a task has completed, returns true if the halting condition has just been met
+	static bool update(const bool succeeded, const DWORD count_success, const DWORD count_failed, const DWORD count_total)
+	{
+		if ((!enabled()) || impl::g_triggered || (succeeded != options::halt_on_success))
+		{
+			return false;
+		}
+		const DWORD count = succeeded ? count_success : count_failed;
+		const ULONGLONG total = std::max(count_total, count_success + count_failed);
+		if (options::halt_percent ? ((100ULL * count) < (ULONGLONG(options::halt_threshold) * total)) : (count < options::halt_threshold))
+		{
+			return false;
+		}
+		impl::g_triggered = true;
+		if (options::halt_percent)
+		{
+			_snwprintf_s(impl::g_reason, 128, _TRUNCATE, L"%u of %u tasks %s (threshold: %u%%)", count, DWORD(total), succeeded ? L"succeeded" : L"failed", options::halt_threshold);
+		}
+		else
+		{
+			_snwprintf_s(impl::g_reason, 128, _TRUNCATE, L"%u task%s %s (threshold: %u)", count, (count != 1) ? L"s" : L"", succeeded ? L"succeeded" : L"failed", options::halt_threshold);
+		}
+		PRINT_WRN(L"\nHALT: %s, %s!\n\n", impl::g_reason, (options::halt_mode == HALT_NOW) ? L"killing the running tasks" : L"waiting for the running tasks to complete");
+		LOG(L"Halting: %s (Mode: %s)\n", impl::g_reason, (options::halt_mode == HALT_NOW) ? L"now" : L"soon");
+		return true;
+	}
+
+	//Has the halting condition been met?
+	static inline bool triggered(void)
+	{
+		return impl::g_triggered;
+	}
+
+	//Should the running tasks be killed?
+	static inline bool kill_running(void)
+	{
+		return impl::g_triggered && (options::halt_mode == HALT_NOW);
+	}
+
+	//Get the reason for halting
+	static inline const wchar_t *reason(void)
+	{
+		return impl::g_reason;
+	}
+}
+
+// ==========================================================================
+// RESOURCE LIMITS
+// ==========================================================================
+
+namespace limits
+{
+	namespace impl
+	{
+		static bool g_warned = false;
+	}
+
+	//Any per-task limits defined?
+	static inline bool enabled(void)
+	{
+		return (options::limit_memory > 0U) || (options::limit_cpu > 0U) || (options::limit_io_bandwidth > 0U) || (options::limit_io_ops > 0U);
+	}
+
+	//Apply the per-task limits to the job object of a newly created (suspended) task
+	static void apply(const HANDLE job)
+	{
+		if (!enabled())
+		{
+			return;
+		}
+		utils::jobs::limits_t limits;
+		limits.memory = options::limit_memory;
+		limits.cpu_rate = options::limit_cpu;
+		limits.io_bandwidth = options::limit_io_bandwidth;
+		limits.io_ops = options::limit_io_ops;
+		if (!(job && utils::jobs::set_task_limits(job, limits)))
+		{
+			if (!impl::g_warned)
+			{
+				PRINT_WRN(L"WARNING: Failed to apply the resource limits to the task! (requires Windows 8, or Windows 10 for I/O limits)\n\n");
+				impl::g_warned = true;
+			}
+		}
+	}
+}
+
+// ==========================================================================
+// OPTION HANDLING
+// ==========================================================================
+
+#define PARSE_WSTR(OUT) do \
+{ \
+	(OUT) = (value && value[0]) ? std::wstring(value) : std::wstring(); \
+} \
+while(0)
+
+#define PARSE_UINT32(MIN, OUT, MAX) do \
+{ \
+	if(value && value[0]) \
+	{ \
+		DWORD _temp; \
+		if(!utils::string::parse_uint32(value, _temp)) \
+		{ \
+			PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid integer!\n\n", value); \
+			return false; \
+		} \
+		(OUT) = BOUND((MIN), _temp, (MAX)); \
+	} \
+	else \
+	{ \
+		PRINT_ERR(L"ERROR: Argument for option \"--%s\" is missing!\n\n", option); \
+		return false; \
+	} \
+} \
+while(0)
+
+#define PARSE_BOOL(OUT) do \
+{ \
+	if(value && value[0]) \
+	{ \
+		bool _temp; \
+		if(!utils::string::parse_bool(value, _temp)) \
+		{ \
+			PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid boolean!\n\n", value); \
+			return false; \
+		} \
+		(OUT) = _temp; \
+	} \
+	else \
+	{ \
+		(OUT) = true; \
+	} \
+} \
+while(0)
+
+namespace options
+{
+	//Load defaults
+	static void reset_all_options(void)
+	{
+		abort_on_failure = false;
+		auto_quote_vars  = false;
+		auto_shell       = false;
+		batch_adaptive   = false;
+		batch_max_args   = 0;
+		batch_max_chars  = 0;
+		batch_mode       = false;
+		bench_parse_count = 0;
+		bench_queue_count = 0;
+		command_pattern  = std::wstring();
+		coprocess_command = std::wstring();
+		detached_console = false;
+		disable_builtins = false;
+		disable_concolor = false;
+		disable_jobctrl  = false;
+		disable_lineargv = false;
+		disable_outputs  = false;
+		disable_prboost  = false;
+		discard_textouts = false;
+		enable_notifysnd = false;
+		enable_summary   = false;
+		enable_tracing   = false;
+		encoding_utf16   = false;
+		find_mtime       = std::wstring();
+		find_name        = std::wstring();
+		find_root        = std::wstring();
+		find_size        = std::wstring();
+		force_use_shell  = false;
+		halt_mode        = HALT_NEVER;
+		halt_on_success  = false;
+		halt_percent     = false;
+		halt_threshold   = 1;
+		kill_grace       = 0;
+		limit_cpu        = 0;
+		limit_io_bandwidth = 0;
+		limit_io_ops     = 0;
+		limit_memory     = 0;
+		ignore_exitcode  = false;
+		input_file_name  = std::wstring();
+		jobserver        = false;
+		keep_order       = false;
+		link_sources     = false;
+		log_file_name    = std::wstring();
+		log_format_json  = false;
+		max_instances    = 0;
+		metrics_file_name = std::wstring();
+		metrics_interval = 5000;
+		metrics_port     = 0;
+		partition_file_name = std::wstring();
+		persistent_shell = false;
+		pipe_block_size  = 1048576;
+		pipe_mode        = false;
+		process_priority = PRIORITY_DEFAULT;
+		process_timeout  = 0;
+		print_manpage    = false;
+		read_stdin_lines = false;
+		record_end       = std::wstring(L"\\n");
+		redir_path_name  = std::wstring();
+		results_file_name = std::wstring();
+		separator        = DEFAULT_SEP;
+		shard_count      = 1;
+		shard_index      = 0;
+		shard_mode       = SHARD_HASH;
+		stderr_pattern   = std::wstring();
+		stdin_pattern    = std::wstring();
+		stdout_pattern   = std::wstring();
+		unique_memory    = 0;
+		unique_tasks     = false;
+	}
+
+	namespace impl
+	{
+		//Line buffer
+		static const DWORD LINE_BUFFER_SIZE = 32768;
+		static wchar_t g_line_buffer[LINE_BUFFER_SIZE];
+
+		//Parse option
+		static bool parse_option_string(const wchar_t *const option, const wchar_t *const value)
+		{
+			if (MATCH(option, L"pattern"))
+			{
+				PARSE_WSTR(options::command_pattern);
+				return true;
+			}
+			else if (MATCH(option, L"count"))
+			{
+				PARSE_UINT32(DWORD(0), options::max_instances, DWORD(MAX_TASKS));
+				return true;
+			}
+			else if (MATCH(option, L"separator"))
+			{
+				PARSE_WSTR(options::separator);
+				return true;
+			}
+			else if (MATCH(option, L"stdin"))
+			{
+				PARSE_BOOL(options::read_stdin_lines);
+				return true;
+			}
+			else if (MATCH(option, L"unique"))
+			{
+				PARSE_BOOL(options::unique_tasks);
+				return true;
+			}
+			else if (MATCH(option, L"unique-memory"))
+			{
+				if (!(value && utils::string::parse_size(value, options::unique_memory) && (options::unique_memory > 0)))
+				{
+					PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid size!\n\n", value ? value : BLANK_STR);
+					return false;
+				}
+				options::unique_tasks = true;
+				return true;
+			}
+			else if (MATCH(option, L"input"))
+			{
+				PARSE_WSTR(options::input_file_name);
+				return true;
+			}
+			else if (MATCH(option, L"logfile"))
+			{
+				PARSE_WSTR(options::log_file_name);
+				return true;
+			}
+			else if (MATCH(option, L"log-format"))
+			{
+				if (value && (MATCH(value, L"text") || MATCH(value, L"json")))
+				{
+					options::log_format_json = MATCH(value, L"json");
+					return true;
+				}
+				PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid log format!\n\n", value ? value : BLANK_STR);
+				return false;
+			}
+			else if (MATCH(option, L"out-path"))
+			{
+				PARSE_WSTR(options::redir_path_name);
+				return true;
+			}
+			else if (MATCH(option, L"stdin-from"))
+			{
+				PARSE_WSTR(options::stdin_pattern);
+				return true;
+			}
+			else if (MATCH(option, L"stdout-to"))
+			{
+				PARSE_WSTR(options::stdout_pattern);
+				return true;
+			}
+			else if (MATCH(option, L"stderr-to"))
+			{
+				PARSE_WSTR(options::stderr_pattern);
+				return true;
+			}
+			else if (MATCH(option, L"results"))
+			{
+				PARSE_WSTR(options::results_file_name);
+				return true;
+			}
+			else if (MATCH(option, L"metrics"))
+			{
+				PARSE_WSTR(options::metrics_file_name);
+				return true;
+			}
+			else if (MATCH(option, L"metrics-port"))
+			{
+				PARSE_UINT32(DWORD(0), options::metrics_port, DWORD(65535));
+				return true;
+			}
+			else if (MATCH(option, L"metrics-tick"))
+			{
+				PARSE_UINT32(DWORD(100), options::metrics_interval, DWORD(MAXDWORD-1));
+				return true;
+			}
+			else if (MATCH(option, L"auto-wrap"))
+			{
+				PARSE_BOOL(options::auto_quote_vars);
+				return true;
+			}
+			else if (MATCH(option, L"no-split-lines"))
+			{
+				PARSE_BOOL(options::disable_lineargv);
+				return true;
+			}
+			else if (MATCH(option, L"shell"))
+			{
+				if (value && MATCH(value, L"persistent"))
+				{
+					options::force_use_shell = options::persistent_shell = true;
+					options::auto_shell = false;
+					return true;
+				}
+				if (value && MATCH(value, L"auto"))
+				{
+					options::force_use_shell = options::auto_shell = true;
+					options::persistent_shell = false;
+					return true;
+				}
+				PARSE_BOOL(options::force_use_shell);
+				options::persistent_shell = options::auto_shell = false;
+				return true;
+			}
+			else if (MATCH(option, L"coprocess"))
+			{
+				PARSE_WSTR(options::coprocess_command);
+				return true;
+			}
+			else if (MATCH(option, L"jobserver"))
+			{
+				PARSE_BOOL(options::jobserver);
+				return true;
+			}
+			else if (MATCH(option, L"pipe"))
+			{
+				PARSE_BOOL(options::pipe_mode);
+				return true;
+			}
+			else if (MATCH(option, L"pipe-part"))
+			{
+				PARSE_WSTR(options::partition_file_name);
+				return true;
+			}
+			else if (MATCH(option, L"block-size"))
+			{
+				ULONGLONG block_size;
+				if (!(value && utils::string::parse_size(value, block_size)))
+				{
+					PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid size!\n\n", value ? value : BLANK_STR);
+					return false;
+				}
+				options::pipe_block_size = DWORD(BOUND(ULONGLONG(1), block_size, ULONGLONG(1073741824)));
+				return true;
+			}
+			else if (MATCH(option, L"record-end"))
+			{
+				PARSE_WSTR(options::record_end);
+				return true;
+			}
+			else if (MATCH(option, L"keep-order"))
+			{
+				PARSE_BOOL(options::keep_order);
+				return true;
+			}
+			else if (MATCH(option, L"range"))
+			{
+				return generator::add_range(value);
+			}
+			else if (MATCH(option, L"max-args"))
+			{
+				if (value && MATCH(value, L"auto"))
+				{
+					options::batch_adaptive = options::batch_mode = true;
+					options::batch_max_args = 0;
+					return true;
+				}
+				PARSE_UINT32(DWORD(1), options::batch_max_args, DWORD(MAXDWORD));
+				options::batch_mode = true;
+				options::batch_adaptive = false;
+				return true;
+			}
+			else if (MATCH(option, L"max-chars"))
+			{
+				PARSE_UINT32(DWORD(1), options::batch_max_chars, DWORD(MAXDWORD));
+				options::batch_mode = true;
+				return true;
+			}
+			else if (MATCH(option, L"shard"))
+			{
+				return shard::parse(value);
+			}
+			else if (MATCH(option, L"shard-by"))
+			{
+				if (value && (MATCH(value, L"hash") || MATCH(value, L"line") || MATCH(value, L"size")))
+				{
+					options::shard_mode = MATCH(value, L"size") ? SHARD_SIZE : (MATCH(value, L"line") ? SHARD_LINE : SHARD_HASH);
+					return true;
+				}
+				PRINT_ERR(L"ERROR: Argument \"%s\" is not a valid shard mode!\n\n", value ? value : BLANK_STR);
+				return false;
+			}
+			else if (MATCH(option, L"link"))
+			{
+				PARSE_BOOL(options::link_sources);
+				return true;
+			}
+			else if (MATCH(option, L"find"))
+			{
+				PARSE_WSTR(options::find_root);
+				return true;
+			}
+			else if (MATCH(option, L"find-name"))
+			{
+				PARSE_WSTR(options::find_name);
+				return true;
+			}
+			else if (MATCH(option, L"find-size"))
+			{
+				PARSE_WSTR(options::find_size);
+				return true;
+			}
+			else if (MATCH(option, L"find-mtime"))
+			{
+				PARSE_WSTR(options::find_mtime);
+				return true;
+			}
+			else if (MATCH(option, L"timeout"))
+			{
+				PARSE_UINT32(DWORD(0), options::process_timeout, DWORD(MAXDWORD-1));
+				return true;
+			}
+			else if (MATCH(option, L"priority"))
+			{
+				PARSE_UINT32(DWORD(PRIORITY_LOWEST), options::process_priority, DWORD(PRIORITY_HIGHEST));
+				return true;
+			}
+			else if (MATCH(option, L"detached"))
+			{
+				PARSE_BOOL(options::detached_console);
+				return true;
+			}
+			else if (MATCH(option, L"abort"))
+			{
+				PARSE_BOOL(options::abort_on_failure);
+				return true;
+			}
+			else if (MATCH(option, L"max-memory") || MATCH(option, L"max-io") || MATCH(option, L"max-iops"))
+			{
+				ULONGLONG &limit = MATCH(option, L"max-memory") ? options::limit_memory : (MATCH(option, L"max-io") ? options::limit_io_bandwidth : options::limit_io_ops);
+				if (!(value && utils::string::parse_size(value, limit)))
+				{
+					PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid size!\n\n", value ? value : BLANK_STR);
+					return false;
+				}
+				return true;
+			}
+			else if (MATCH(option, L"max-cpu"))
+			{
+				PARSE_UINT32(DWORD(0), options::limit_cpu, DWORD(100U * MAX_TASKS));
+				return true;
+			}
+			else if (MATCH(option, L"kill-grace"))
+			{
+				PARSE_UINT32(DWORD(0), options::kill_grace, DWORD(MAXDWORD-1));
+				return true;
+			}
+			else if (MATCH(option, L"halt"))
+			{
+				return halt::parse(value);
+			}
+			else if (MATCH(option, L"no-builtins"))
+			{
+				PARSE_BOOL(options::disable_builtins);
+				return true;
+			}
+			else if (MATCH(option, L"no-jobctrl"))
+			{
+				PARSE_BOOL(options::disable_jobctrl);
+				return true;
+			}
+			else if (MATCH(option, L"no-boost"))
+			{
+				PARSE_BOOL(options::disable_prboost);
+				return true;
+			}
+			else if (MATCH(option, L"discard-output"))
+			{
+				PARSE_BOOL(options::discard_textouts);
+				return true;
+			}
+			else if (MATCH(option, L"ignore-exitcode"))
+			{
+				PARSE_BOOL(options::ignore_exitcode);
+				return true;
+			}
+			else if (MATCH(option, L"utf16"))
+			{
+				PARSE_BOOL(options::encoding_utf16);
+				return true;
+			}
+			else if (MATCH(option, L"notify"))
+			{
+				PARSE_BOOL(options::enable_notifysnd);
+				return true;
+			}
+			else if (MATCH(option, L"summary"))
+			{
+				PARSE_BOOL(options::enable_summary);
+				return true;
+			}
+			else if (MATCH(option, L"trace"))
+			{
+				PARSE_BOOL(options::enable_tracing);
+				return true;
+			}
+			else if (MATCH(option, L"silent"))
+			{
+				PARSE_BOOL(options::disable_outputs);
+				return true;
+			}
+			else if (MATCH(option, L"no-colors"))
+			{
+				PARSE_BOOL(options::disable_concolor);
+				return true;
+			}
+			else if (MATCH(option, L"help"))
+			{
+				PARSE_BOOL(options::print_manpage);
+				return true;
+			}
+			else if (MATCH(option, L"bench-parse"))
+			{
+				PARSE_UINT32(DWORD(1), options::bench_parse_count, DWORD(MAXDWORD-1));
+				return true;
+			}
+			else if (MATCH(option, L"bench-queue"))
+			{
+				PARSE_UINT32(DWORD(1), options::bench_queue_count, DWORD(MAXDWORD-1));
+				return true;
+			}
+
+			PRINT_ERR(L"ERROR: Unknown option \"--%s\" encountred!\n\n", option);
+			return false;
+		}
+
+		//Parse option
+		static bool parse_option_string(const wchar_t *const option_str)
+		{
+			wchar_t opt_buffer[32];
+			const wchar_t *const pos = wcschr(option_str, L'=');
+			if (pos && (pos != option_str))
+			{
+				wcsncpy_s(opt_buffer, 32, option_str, (pos - option_str));
+				return parse_option_string(opt_buffer, (*(pos + 1)) ? (pos + 1) : NULL);
+			}
+			else
+			{
+				return parse_option_string(option_str, NULL);
+			}
+		}
+
+		//Validate options
+		static bool validate_options(void)
+		{
+			if (options::enable_tracing && options::disable_outputs)
+			{
+				PRINT_ERR(L"ERROR: Options \"--trace\" and \"--silent\" are mutually exclusive!\n\n");
+				return false;
+			}
+			if (options::detached_console && (!options::redir_path_name.empty()))
+			{
+				PRINT_ERR(L"ERROR: Options \"--out-path\" and \"--detached\" are mutually exclusive!\n\n");
+				return false;
+			}
+			if (options::discard_textouts && (!options::redir_path_name.empty()))
+			{
+				PRINT_ERR(L"ERROR: Options \"--out-path\" and \"--discard-output\" are mutually exclusive!\n\n");
+				return false;
+			}
+			if ((options::pipe_mode || (!options::partition_file_name.empty()) || generator::enabled()) && (!options::find_root.empty()))
+			{
+				PRINT_ERR(L"ERROR: Option \"--find\" can NOT be combined with \"--pipe\", \"--pipe-part\" or other input sources!\n\n");
+				return false;
+			}
+			if ((options::pipe_mode || (!options::partition_file_name.empty())) && generator::enabled())
+			{
+				PRINT_ERR(L"ERROR: Input sources (\"--range\" or \":::\") can NOT be combined with \"--pipe\" or \"--pipe-part\"!\n\n");
+				return false;
+			}
+			if (options::batch_mode && options::command_pattern.empty())
+			{
+				PRINT_ERR(L"ERROR: Options \"--max-args\" and \"--max-chars\" require a \"--pattern\"!\n\n");
+				return false;
+			}
+			if (options::batch_mode && (options::pipe_mode || (!options::partition_file_name.empty()) || (!options::coprocess_command.empty()) || (!(options::stdin_pattern.empty() && options::stdout_pattern.empty() && options::stderr_pattern.empty()))))
+			{
+				PRINT_ERR(L"ERROR: Options \"--max-args\" and \"--max-chars\" can NOT be combined with \"--pipe\", \"--pipe-part\", \"--coprocess\" or redirection patterns!\n\n");
+				return false;
+			}
+			if (options::disable_jobctrl && limits::enabled())
+			{
+				PRINT_ERR(L"ERROR: Per-task resource limits can NOT be combined with \"--no-jobctrl\"!\n\n");
+				return false;
+			}
+			if ((options::persistent_shell || (!options::coprocess_command.empty())) && limits::enabled())
+			{
+				PRINT_ERR(L"ERROR: Per-task resource limits can NOT be combined with \"--shell=persistent\" or \"--coprocess\"!\n\n");
+				return false;
+			}
+			if ((options::pipe_mode || (!options::partition_file_name.empty())) && shard::enabled())
+			{
+				PRINT_ERR(L"ERROR: Option \"--shard\" can NOT be combined with \"--pipe\" or \"--pipe-part\"!\n\n");
+				return false;
+			}
+			if (options::pipe_mode && (!options::stdin_pattern.empty()))
+			{
+				PRINT_ERR(L"ERROR: Options \"--pipe\" and \"--stdin-from\" are mutually exclusive!\n\n");
+				return false;
+			}
+			if ((!options::coprocess_command.empty()) && (!(options::stdin_pattern.empty() && options::stdout_pattern.empty() && options::stderr_pattern.empty())))
+			{
+				PRINT_ERR(L"ERROR: Option \"--coprocess\" can NOT be combined with \"--stdin-from\", \"--stdout-to\" or \"--stderr-to\"!\n\n");
+				return false;
+			}
+			if (!options::redir_path_name.empty())
+			{
+				if (!utils::files::directory_exists(options::redir_path_name.c_str()))
+				{
+					CreateDirectoryW(options::redir_path_name.c_str(), NULL);
+					if (!utils::files::directory_exists(options::redir_path_name.c_str()))
+					{
+						PRINT_ERR(L"ERROR: Specified output directory \"%s\" does NOT exist!\n\n", options::redir_path_name.c_str());
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		static bool parse_options_file(const wchar_t *const file_name)
+		{
+			static const wchar_t *const HEADER = L"[MParallel]";
+			FILE *input = NULL;
+			if (_wfopen_s(&input, file_name, L"r,ccs=UTF-8") == 0)
+			{
+				bool found_header = false;
+				while (wchar_t *const current_line = fgetws(impl::g_line_buffer, impl::LINE_BUFFER_SIZE, input))
+				{
+					const wchar_t *const trimmed = utils::string::trim_str(current_line);
+					if (trimmed && trimmed[0] && (trimmed[0] != L'#') && (trimmed[0] != L';'))
+					{
+						if(found_header && (trimmed[0] != L'[') && (trimmed[0] != L']'))
+						{
+							if(!parse_option_string(trimmed))
+							{
+								return false;
+							}
+						}
+						else
+						{
+							found_header = MATCH(HEADER, trimmed);
+						}
+					}
+				}
+				CLOSE_FILE(input);
+				return true;
+			}
+			PRINT_ERR(L"ERROR: Failed to open options file \"%s\" for reading!\n\n", file_name);
+			return false;
+		}
+	}
+
+	//Parse arguments
+	static bool parse_arguments(const int argc, const wchar_t *const argv[])
+	{
+		int i = 1;
+		while(i < argc)
+		{
+			const wchar_t *const current = argv[i++];
+			if ((current[0] == L'-') && (current[1] == L'-'))
+			{
+				PRINT_TRC(L"Process token: %s\n", current);
+				if (current[2])
+				{
+					if (!impl::parse_option_string(&current[2]))
+					{
+						return false;
+					}
+					if (options::print_manpage)
+					{
+						break; /*just print the manpage*/
+					}
+				}
+				else
+				{
+					command::parse_commands(argc, argv, i, options::separator.c_str());
+					break;
+				}
+			}
+			else if ((!wcscmp(current, L":::")) || (!wcscmp(current, L"::::")))
+			{
+				if (!generator::parse_sources(argc, argv, --i))
+				{
+					return false;
+				}
+				break;
+			}
+			else
+			{
+				command::parse_commands(argc, argv, --i, options::separator.c_str());
+				break;
+			}
+		}
+		return impl::validate_options();
+	}
+
+	//Read options file
+	static bool parse_options_file(void)
+	{
+		const std::wstring executable_file = utils::files::get_running_executable();
+		if(!executable_file.empty())
+		{
+			const std::wstring executable_path = utils::files::get_full_path(executable_file.c_str());
+			if(!executable_path.empty())
+			{
+				std::wstring file_drive, file_dir, file_fname, file_ext;
+				if(utils::files::split_file_name(executable_path.c_str(), file_drive, file_dir, file_fname, file_ext))
+				{
+					const std::wstring options_file_path = file_drive + file_dir + file_fname + L".ini";
+					if((!options_file_path.empty()) && utils::files::file_exists(options_file_path.c_str()))
+					{
+						return impl::parse_options_file(options_file_path.c_str());
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	//Read commands from file stream
+	static void parse_commands_file(FILE *const input)
+	{
+		while (wchar_t *const current_line = fgetws(impl::g_line_buffer, impl::LINE_BUFFER_SIZE, input))
+		{
+			int argc;
+			const wchar_t *const trimmed = utils::string::trim_str(current_line);
+			if (trimmed && trimmed[0])
+			{
+				if (!shard::owns_line(trimmed))
+				{
+					continue; /*owned by another shard*/
+				}
+				PRINT_TRC(L"Read line: %s\n", trimmed);
+				if (!options::disable_lineargv)
+				{
+					wchar_t *const *const argv = CommandLineToArgvW(trimmed, &argc);
+					if (!argv)
+					{
+						error::fatal_exit("\nFATAL: CommandLineToArgvW() has failed!\n\n");
+					}
+					command::parse_commands(argc, argv, 0, NULL);
+					LocalFree((HLOCAL)argv);
+				}
+				else
+				{
+					const wchar_t *const argv[1] = { trimmed };
+					command::parse_commands(1, argv, 0, NULL);
+				}
+			}
+		}
+	}
+
+	//Read commands from file name
+	static bool parse_commands_file(const wchar_t *const file_name)
+	{
+		FILE *file = NULL;
+		if (_wfopen_s(&file, file_name, options::encoding_utf16 ? L"r,ccs=UTF-16LE" : L"r,ccs=UTF-8") == 0)
+		{
+			parse_commands_file(file);
+			CLOSE_FILE(file);
+			return true;
+		}
+		PRINT_ERR(L"ERROR: Unbale to open file \"%s\" for reading!\n\n", file_name);
+		return false;
+	}
+}
+
+// ==========================================================================
+// PARSER BENCHMARK
+// ==========================================================================
+
+#ifdef MPARALLEL_BENCH
+namespace bench
+{
+	namespace impl
+	{
+		static bool      g_count_allocs = false;
+		static ULONGLONG g_allocations = 0;
+	}
+}
+
+//Replaceable allocation functions, count the allocations while a benchmark is running (dedicated benchmark builds only)
+void *operator new(size_t size)
+{
+	if (bench::impl::g_count_allocs)
+	{
+		bench::impl::g_allocations++;
+	}
+	void *const ptr = malloc(size ? size : 1U);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) throw()
+{
+	free(ptr);
+}
+#endif //MPARALLEL_BENCH
+
+namespace bench
+{
+	namespace impl
+	{
+		typedef struct _corpus_t
+		{
+			const wchar_t *name;
+			const wchar_t *format;
+		}
+		corpus_t;
+
+		//Synthetic input lines, "%07u" is replaced by the line number
+		static const corpus_t CORPORA[] =
+		{
+			{ L"short",   L"img_%07u.jpg" },
+			{ L"long",    L"\"C:\\Media\\Input\\Season 01\\episode_%07u.avi\" -map 0:v -map 0:a -c:v libx264 -preset slow -crf 22 -tune film -c:a aac -b:a 160k -movflags +faststart" },
+			{ L"quoted",  L"\"C:\\Users\\Public\\Pictures\\Holiday 2016\\IMG %07u.jpg\" \"D:\\Backup\\Holiday 2016\\IMG %07u.png\"" },
+			{ L"unicode", L"\"C:\\Benutzer\\J\x00FCrgen\\Bilder\\Stra\x00DF" L"e %07u.jpg\" \"D:\\\x0410\x0440\x0445\x0438\x0432\\\x5199\x771F_%07u.png\"" },
+			{ NULL, NULL }
+		};
+
+		//Command pattern with many placeholders
+		static const wchar_t *const PATTERN = L"magick.exe {{0}} -quality 90 -define png:compression-level=9 -write \"{{0:D}}{{0:P}}thumbs\\{{0:N}}_small{{0:X}}\" \"{{1:P}}{{1:N}}.png\" -log \"{{0:N}}.log\" {{1}}";
+
+		//Generate the lines of the corpus
+		static ULONGLONG generate(const corpus_t &corpus, const DWORD count, std::vector<std::wstring> &lines)
+		{
+			wchar_t buffer[512];
+			ULONGLONG char_count = 0;
+			lines.clear();
+			lines.reserve(count);
+			for (DWORD i = 0; i < count; i++)
+			{
+				_snwprintf_s(buffer, 512, _TRUNCATE, corpus.format, i, i);
+				lines.push_back(std::wstring(buffer));
+				char_count += lines.back().length();
+			}
+			return char_count;
+		}
+
+		//Split the lines into tokens, just like the input file parser does
+		static void tokenize(const std::vector<std::wstring> &lines, std::vector<std::wstring> &tokens, std::vector<size_t> &offsets)
+		{
+			tokens.clear();
+			offsets.clear();
+			for (std::vector<std::wstring>::const_iterator iter = lines.begin(); iter != lines.end(); iter++)
+			{
+				int argc = 0;
+				wchar_t *const *const argv = CommandLineToArgvW(iter->c_str(), &argc);
+				if (!argv)
+				{
+					error::fatal_exit("\nFATAL: CommandLineToArgvW() has failed!\n\n");
+				}
+				offsets.push_back(tokens.size());
+				tokens.insert(tokens.end(), argv, argv + argc);
+				LocalFree((HLOCAL)argv);
+			}
+			offsets.push_back(tokens.size());
+		}
+
+		//Write the lines to a temporary UTF-8 file
+		static std::wstring write_temp_file(const std::vector<std::wstring> &lines)
+		{
+			wchar_t temp_path[MAX_PATH + 1];
+			const DWORD len = GetTempPathW(MAX_PATH + 1, temp_path);
+			const std::wstring file_name = ((len > 0) && (len <= MAX_PATH)) ? utils::files::generate_unique_filename(temp_path, L".txt") : std::wstring();
+			FILE *file = NULL;
+			if (file_name.empty() || (_wfopen_s(&file, file_name.c_str(), L"wb") != 0))
+			{
+				return std::wstring();
+			}
+			std::string buffer;
+			for (std::vector<std::wstring>::const_iterator iter = lines.begin(); iter != lines.end(); iter++)
+			{
+				buffer.clear();
+				utils::string::append_utf8(buffer, iter->c_str(), iter->length());
+				buffer.push_back('\n');
+				fwrite(buffer.c_str(), 1, buffer.size(), file);
+			}
+			CLOSE_FILE(file);
+			return file_name;
+		}
+
+		//Remove all tasks that have been generated by the benchmark
+		static void drain_queue(void)
+		{
+			task_t task;
+			while (queue::have_more())
+			{
+				queue::dequeue(task);
+			}
+		}
+
+		//Start the measurement
+		static ULONGLONG start(void)
+		{
+#ifdef MPARALLEL_BENCH
+			g_allocations = 0;
+			g_count_allocs = true;
+#endif //MPARALLEL_BENCH
+			return utils::sysinfo::get_timer_value();
+		}
+
+		//Stop the measurement and print the result
+		static void report(const wchar_t *const name, const DWORD count, const ULONGLONG char_count, const ULONGLONG start_time)
+		{
+			const ULONGLONG end_time = utils::sysinfo::get_timer_value();
+#ifdef MPARALLEL_BENCH
+			g_count_allocs = false;
+#endif //MPARALLEL_BENCH
+			const double seconds = double(end_time - start_time) / double(utils::sysinfo::get_timer_frequency());
+#ifdef MPARALLEL_BENCH
+			PRINT_NFO(L"  %-16s %8.3f M lines/s %9.2f M chars/s %7.2f allocs/line\n", name,
+				(seconds > 0.0) ? (double(count) / seconds / 1000000.0) : 0.0,
+				(seconds > 0.0) ? (double(char_count) / seconds / 1000000.0) : 0.0,
+				double(g_allocations) / double(std::max(count, DWORD(1))));
+#else
+			PRINT_NFO(L"  %-16s %8.3f M lines/s %9.2f M chars/s\n", name,
+				(seconds > 0.0) ? (double(count) / seconds / 1000000.0) : 0.0,
+				(seconds > 0.0) ? (double(char_count) / seconds / 1000000.0) : 0.0);
+#endif //MPARALLEL_BENCH
+		}
+
+		//Measure the input file parser, with and without a command pattern
+		static void bench_file(const std::vector<std::wstring> &lines, const ULONGLONG char_count)
+		{
+			const std::wstring file_name = write_temp_file(lines);
+			if (file_name.empty())
+			{
+				PRINT_WRN(L"  WARNING: Failed to create the temporary file, skipping!\n");
+				return;
+			}
+			for (DWORD i = 0; i < 2; i++)
+			{
+				FILE *file = NULL;
+				if (_wfopen_s(&file, file_name.c_str(), L"r,ccs=UTF-8") == 0)
+				{
+					if (i > 0)
+					{
+						options::command_pattern = PATTERN;
+					}
+					const ULONGLONG start_time = start();
+					options::parse_commands_file(file);
+					report((i > 0) ? L"file+pattern" : L"file", DWORD(lines.size()), char_count, start_time);
+					options::command_pattern.clear();
+					CLOSE_FILE(file);
+					drain_queue();
+				}
+			}
+			DeleteFileW(file_name.c_str());
+		}
+
+		//Measure the command generation from tokens, i.e. without the file input
+		static void bench_commands(const std::vector<std::wstring> &lines, const ULONGLONG char_count)
+		{
+			std::vector<std::wstring> tokens;
+			std::vector<size_t> offsets;
+			tokenize(lines, tokens, offsets);
+			std::vector<const wchar_t*> argv;
+			for (std::vector<std::wstring>::const_iterator iter = tokens.begin(); iter != tokens.end(); iter++)
+			{
+				argv.push_back(iter->c_str());
+			}
+			argv.push_back(NULL);
+			const DWORD count = DWORD(lines.size());
+
+			ULONGLONG start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				command::parse_commands_simple(int(offsets[i + 1U] - offsets[i]), &argv[offsets[i]], 0, NULL);
+			}
+			report(L"simple", count, char_count, start_time);
+			drain_queue();
+
+			const std::wstring pattern(PATTERN);
+			start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				command::parse_commands_pattern(pattern, int(offsets[i + 1U] - offsets[i]), &argv[offsets[i]], 0, NULL);
+			}
+			report(L"pattern", count, char_count, start_time);
+			drain_queue();
+
+			start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				std::wstring command(pattern);
+				const wchar_t *const first = argv[offsets[i]], *const second = (offsets[i + 1U] - offsets[i] > 1U) ? argv[offsets[i] + 1U] : BLANK_STR;
+				command::expand_placeholder(command, 0, 0x00, first);
+				command::expand_placeholder(command, 0, L'N', first);
+				command::expand_placeholder(command, 1, 0x00, second);
+			}
+			report(L"expand", count, char_count, start_time);
+		}
+
+		//Measure the string utility functions
+		static void bench_strings(const std::vector<std::wstring> &lines, const ULONGLONG char_count)
+		{
+			const DWORD count = DWORD(lines.size());
+			std::vector<std::wstring> padded;
+			padded.reserve(count);
+			for (std::vector<std::wstring>::const_iterator iter = lines.begin(); iter != lines.end(); iter++)
+			{
+				padded.push_back(std::wstring(L" \t") + (*iter) + L"\r\n");
+			}
+
+			ULONGLONG start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				utils::string::trim_str(&padded[i][0]);
+			}
+			report(L"trim_str", count, char_count, start_time);
+
+			start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				std::wstring str(lines[i]);
+				utils::string::replace_str(str, L"\\", L"/");
+			}
+			report(L"replace_str", count, char_count, start_time);
+
+			start_time = start();
+			for (DWORD i = 0; i < count; i++)
+			{
+				utils::string::wstring_to_utf8(lines[i]);
+			}
+			report(L"wstring_to_utf8", count, char_count, start_time);
+		}
+	}
+
+	//Measure throughput and allocations of the input parsing and command generation
+	static void run(const DWORD count)
+	{
+		std::vector<std::wstring> lines;
+		PRINT_NFO(L"Parser benchmark (%u lines per corpus):\n", count);
+#ifndef _DEBUG
+		PRINT_NFO(L"(Allocations are counted by the debug heap only, use a debug build to get them)\n");
+#endif //_DEBUG
+		for (DWORD i = 0; impl::CORPORA[i].name; i++)
+		{
+			const ULONGLONG char_count = impl::generate(impl::CORPORA[i], count, lines);
+			PRINT_NFO(L"\n[%s] %.1f chars per line\n", impl::CORPORA[i].name, double(char_count) / double(std::max(count, DWORD(1))));
+			impl::bench_file(lines, char_count);
+			impl::bench_commands(lines, char_count);
+			impl::bench_strings(lines, char_count);
+		}
+		PRINT_NFO(L"\n");
+	}
+}
+
+// ==========================================================================
+// TIMER
+// ==========================================================================
+
+namespace priority
+{
+	namespace impl
+	{
+		static bool g_timer_flag = false;
+		static const DWORD g_timer_period = 1U;
+
+		//Restore timer
+		static void restore_timer_period(void)
+		{
+			timeEndPeriod(g_timer_period);
+		}
+
+		//Thread priorities
+		static DWORD map_thread_priority(const DWORD priority)
+		{
+			switch (BOUND(DWORD(PRIORITY_DEFAULT), priority, DWORD(PRIORITY_MAXIMUM)))
+			{
+				case PRIORITY_DEFAULT: return THREAD_PRIORITY_NORMAL;        break;
+				case PRIORITY_HIGHER:  return THREAD_PRIORITY_ABOVE_NORMAL;  break;
+				case PRIORITY_HIGHEST: return THREAD_PRIORITY_HIGHEST;       break;
+				case PRIORITY_MAXIMUM: return THREAD_PRIORITY_TIME_CRITICAL; break;
+			}
+			PRINT_WRN(L"WARNING: Unknown priority value %u specified!", priority);
+			return 0;
+		}
+	}
+
+	//Translate to Win32 priority class
+	static DWORD get_priority_class(const DWORD priority)
+	{
+		switch (BOUND(DWORD(PRIORITY_LOWEST), priority, DWORD(PRIORITY_MAXIMUM)))
+		{
+			case PRIORITY_LOWEST:  return IDLE_PRIORITY_CLASS;         break;
+			case PRIORITY_LOWER:   return BELOW_NORMAL_PRIORITY_CLASS; break;
+			case PRIORITY_DEFAULT: return NORMAL_PRIORITY_CLASS;       break;
+			case PRIORITY_HIGHER:  return ABOVE_NORMAL_PRIORITY_CLASS; break;
+			case PRIORITY_HIGHEST: return HIGH_PRIORITY_CLASS;         break;
+			case PRIORITY_MAXIMUM: return HIGH_PRIORITY_CLASS;         break;
+		}
+		PRINT_WRN(L"WARNING: Unknown priority value %u specified!", priority);
+		return 0;
+	}
+
+	//Apply priority boost
+	static void set_process_priority(const DWORD priority_value)
+	{
+		if (!SetPriorityClass(GetCurrentProcess(), get_priority_class(priority_value)))
+		{
+			PRINT_WRN(L"WARNING: Failed to change process priority!\n\n");
+		}
+		if (!SetThreadPriority(GetCurrentThread(), impl::map_thread_priority(priority_value)))
+		{
+			PRINT_WRN(L"WARNING: Failed to change thread priority!\n\n");
+		}
+		if (!impl::g_timer_flag)
+		{
+			if (timeBeginPeriod(1) == TIMERR_NOERROR)
+			{
+				impl::g_timer_flag = true;
+				atexit(impl::restore_timer_period);
+			}
+		}
+	}
+}
+
+// ==========================================================================
+// RESULTS
+// ==========================================================================
+
+namespace results
+{
+	namespace impl
+	{
+		static FILE* g_results_file = NULL;
+		static bool  g_collect      = false;
+
+		static std::vector<ULONGLONG> g_wall_time;
+		static std::vector<ULONGLONG> g_cpu_time;
+		static std::vector<ULONGLONG> g_peak_memory;
+		static ULONGLONG g_total_read  = 0;
+		static ULONGLONG g_total_write = 0;
+
+		//Close the results file
+		static void close_results_file(void)
+		{
+			CLOSE_FILE(g_results_file);
+		}
+
+		//Escape quotation marks for CSV output
+		static std::wstring escape_csv(const std::wstring &str)
+		{
+			std::wstring escaped;
+			escaped.reserve(str.length() + 2U);
+			for (std::wstring::const_iterator iter = str.begin(); iter != str.end(); iter++)
+			{
+				if ((*iter) == L'"')
+				{
+					escaped.push_back(L'"');
+				}
+				escaped.push_back(*iter);
+			}
+			return escaped;
+		}
+
+		//Compute percentile (values will be re-ordered!)
+		static ULONGLONG percentile(std::vector<ULONGLONG> &values, const double p)
+		{
+			if (values.empty())
+			{
+				return 0;
+			}
+			const size_t k = std::min(values.size() - 1U, size_t(p * double(values.size() - 1U) + 0.5));
+			std::nth_element(values.begin(), values.begin() + k, values.end());
+			return values[k];
+		}
+
+		//Compute total
+		static ULONGLONG total(const std::vector<ULONGLONG> &values)
+		{
+			ULONGLONG sum = 0;
+			for (std::vector<ULONGLONG>::const_iterator iter = values.begin(); iter != values.end(); iter++)
+			{
+				sum += (*iter);
+			}
+			return sum;
+		}
+
+		//Print a single row of the summary
+		static void print_summary_row(const wchar_t *const name, std::vector<ULONGLONG> &values, const double scale)
+		{
+			const ULONGLONG sum = total(values);
+			const ULONGLONG p50 = percentile(values, 0.50), p90 = percentile(values, 0.90), p99 = percentile(values, 0.99), max = percentile(values, 1.00);
+			PRINT_NFO(L"  %-16s total: %10.1f, p50: %9.1f, p90: %9.1f, p99: %9.1f, max: %9.1f\n", name, double(sum) / scale, double(p50) / scale, double(p90) / scale, double(p99) / scale, double(max) / scale);
+			LOG(L"Summary %s: total=%.1f, p50=%.1f, p90=%.1f, p99=%.1f, max=%.1f\n", name, double(sum) / scale, double(p50) / scale, double(p90) / scale, double(p99) / scale, double(max) / scale);
+		}
+	}
+
+	//Resource accounting required?
+	static inline bool enabled(void)
+	{
+		return impl::g_collect;
+	}
+
+	//Open results file
+	static void open_results_file(const wchar_t *file_name)
+	{
+		if (!impl::g_results_file)
+		{
+			if (impl::g_results_file = _wfsopen(file_name, L"w,ccs=UTF-8", _SH_DENYWR))
+			{
+				atexit(impl::close_results_file);
+				fwprintf(impl::g_results_file, L"task,pid,status,exit_code,wall_ms,user_ms,kernel_ms,peak_rss_kb,peak_commit_kb,read_bytes,write_bytes,read_ops,write_ops,command\n");
+			}
+			else
+			{
+				impl::g_results_file = NULL;
+				PRINT_ERR(L"ERROR: Failed to open results file \"%s\" for writing!\n\n", file_name);
+			}
+		}
+	}
+
+	//Enable resource accounting
+	static void initialize(void)
+	{
+		if (!options::results_file_name.empty())
+		{
+			open_results_file(options::results_file_name.c_str());
+		}
+		impl::g_collect = (impl::g_results_file != NULL) || options::enable_summary;
+	}
+
+	//Record the result of a single task
+	static void record_task(const DWORD task_id, const DWORD pid, const wchar_t *const status, const DWORD exit_code, const utils::process::stats_t &stats, const std::wstring &command)
+	{
+		impl::g_wall_time.push_back(stats.wall_time);
+		impl::g_cpu_time.push_back(stats.user_time + stats.kernel_time);
+		impl::g_peak_memory.push_back(stats.peak_memory);
+		impl::g_total_read  += stats.read_bytes;
+		impl::g_total_write += stats.write_bytes;
+
+		if (impl::g_results_file)
+		{
+			const std::wstring command_escaped = impl::escape_csv(command);
+			fwprintf_s(impl::g_results_file, L"%u,%u,%s,%u,%.3f,%.3f,%.3f,%I64u,%I64u,%I64u,%I64u,%I64u,%I64u,\"%s\"\n",
+				task_id, pid, status, exit_code, double(stats.wall_time) / 1000.0, double(stats.user_time) / 1000.0, double(stats.kernel_time) / 1000.0,
+				stats.peak_memory / 1024U, stats.peak_commit / 1024U, stats.read_bytes, stats.write_bytes, stats.read_ops, stats.write_ops, command_escaped.c_str());
+		}
+	}
+
+	//Record a single stage of a pipeline (not included in the summary)
+	static void record_stage(const DWORD task_id, const DWORD pid, const DWORD exit_code, const utils::process::stats_t &stats, const std::wstring &command)
+	{
+		if (impl::g_results_file)
+		{
+			const std::wstring command_escaped = impl::escape_csv(command);
+			fwprintf_s(impl::g_results_file, L"%u,%u,stage,%u,%.3f,%.3f,%.3f,%I64u,%I64u,%I64u,%I64u,%I64u,%I64u,\"%s\"\n",
+				task_id, pid, exit_code, double(stats.wall_time) / 1000.0, double(stats.user_time) / 1000.0, double(stats.kernel_time) / 1000.0,
+				stats.peak_memory / 1024U, stats.peak_commit / 1024U, stats.read_bytes, stats.write_bytes, stats.read_ops, stats.write_ops, command_escaped.c_str());
+		}
+	}
+
+	//Record a task that could not be started
+	static void record_failed_task(const DWORD task_id, const std::wstring &command)
+	{
+		if (impl::g_results_file)
+		{
+			const std::wstring command_escaped = impl::escape_csv(command);
+			fwprintf_s(impl::g_results_file, L"%u,0,spawn_failed,,,,,,,,,,,\"%s\"\n", task_id, command_escaped.c_str());
+		}
+	}
+
+	//Print summary
+	static void print_summary(void)
+	{
+		if (impl::g_collect && (!impl::g_wall_time.empty()))
+		{
+			PRINT_NFO(L"Resource usage of %u task(s):\n", DWORD(impl::g_wall_time.size()));
+			impl::print_summary_row(L"Wall time [ms]",  impl::g_wall_time,   1000.0);
+			impl::print_summary_row(L"CPU time [ms]",   impl::g_cpu_time,    1000.0);
+			impl::print_summary_row(L"Peak RSS [MB]",   impl::g_peak_memory, 1048576.0);
+			PRINT_NFO(L"  %-16s total: %.1f MB read, %.1f MB written\n\n", L"I/O", double(impl::g_total_read) / 1048576.0, double(impl::g_total_write) / 1048576.0);
+			LOG(L"Summary I/O: read=%I64u, written=%I64u\n", impl::g_total_read, impl::g_total_write);
+		}
+	}
+}
+
+// ==========================================================================
+// PERSISTENT SHELLS
+// ==========================================================================
+
+namespace shell
+{
+	namespace impl
+	{
+		static const DWORD  MAX_TASKS_PER_SHELL = 1000U;
+		static const DWORD  BASELINE_TIMEOUT    = 10000U;
+		static const size_t MAX_REPORT_SIZE     = 1048576U;
+
+		typedef struct _shell_t
+		{
+			HANDLE       process;
+			DWORD        pid;
+			HANDLE       job;
+			HANDLE       stdin_pipe;
+			HANDLE       status_pipe;
+			HANDLE       event;
+			HANDLE       wait_handle;
+			OVERLAPPED   overlapped;
+			bool         connected;
+			DWORD        task_count;
+			DWORD        exit_code;
+			bool         dirty;
+			std::wstring pipe_name;
+			std::string  baseline;
+		}
+		shell_t;
+
+		static shell_t      g_shells[MAX_TASKS];
+		static std::wstring g_working_dir;
+		static DWORD        g_generation = 0;
+		static bool         g_atexit = false;
+
+		//Signal the event, when the shell terminates
+		static VOID CALLBACK shell_exited(PVOID context, BOOLEAN)
+		{
+			SetEvent((HANDLE)context);
+		}
+
+		//Duplicate handle as inheritable
+		static HANDLE make_inheritable(const HANDLE handle)
+		{
+			HANDLE duplicate = NULL;
+			if (handle && (handle != INVALID_HANDLE_VALUE))
+			{
+				if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &duplicate, 0, TRUE, DUPLICATE_SAME_ACCESS))
+				{
+					duplicate = NULL;
+				}
+			}
+			return duplicate;
+		}
+
+		//Terminate shell and release all resources
+		static void destroy_shell(shell_t &shell)
+		{
+			if (shell.wait_handle)
+			{
+				UnregisterWaitEx(shell.wait_handle, INVALID_HANDLE_VALUE);
+				shell.wait_handle = NULL;
+			}
+			CLOSE_HANDLE(shell.stdin_pipe);
+			if (shell.process)
+			{
+				if (WaitForSingleObject(shell.process, 0) != WAIT_OBJECT_0)
+				{
+					if (!(shell.job && utils::jobs::terminate_task_job(shell.job, FATAL_EXIT_CODE, KILL_TIMEOUT)))
+					{
+						TerminateProcess(shell.process, FATAL_EXIT_CODE);
+					}
+				}
+				CLOSE_HANDLE(shell.process);
+			}
+			CLOSE_HANDLE(shell.job);
+			if (shell.status_pipe)
+			{
+				CancelIo(shell.status_pipe);
+				CLOSE_HANDLE(shell.status_pipe);
+			}
+			CLOSE_HANDLE(shell.event);
+			shell.task_count = 0;
+			shell.connected = shell.dirty = false;
+			shell.pipe_name.clear();
+			shell.baseline.clear();
+		}
+
+		//Terminate all shells at exit
+		static void destroy_all_shells(void)
+		{
+			for (DWORD i = 0; i < MAX_TASKS; i++)
+			{
+				destroy_shell(g_shells[i]);
+			}
+		}
+
+		//Wait for the next connection on the status pipe
+		static bool arm_status_pipe(shell_t &shell)
+		{
+			memset(&shell.overlapped, 0, sizeof(OVERLAPPED));
+			shell.overlapped.hEvent = shell.event;
+			shell.connected = false;
+			if (!ConnectNamedPipe(shell.status_pipe, &shell.overlapped))
+			{
+				const DWORD error = GetLastError();
+				if (error == ERROR_PIPE_CONNECTED)
+				{
+					shell.connected = true;
+					SetEvent(shell.event);
+				}
+				return (error == ERROR_IO_PENDING) || (error == ERROR_PIPE_CONNECTED);
+			}
+			return true;
+		}
+
+		//Start a new shell process
+		static bool create_shell(const DWORD slot, shell_t &shell)
+		{
+			std::wstringstream pipe_name;
+			pipe_name << L"\\\\.\\pipe\\MParallel." << GetCurrentProcessId() << L'.' << slot << L'.' << (++g_generation);
+			shell.pipe_name = pipe_name.str();
+
+			shell.status_pipe = CreateNamedPipeW(shell.pipe_name.c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 0, 4096, 0, NULL);
+			if (shell.status_pipe == INVALID_HANDLE_VALUE)
+			{
+				shell.status_pipe = NULL;
+				return false;
+			}
+
+			if (!(shell.event = CreateEventW(NULL, TRUE, FALSE, NULL)))
+			{
+				destroy_shell(shell);
+				return false;
+			}
+
+			SECURITY_ATTRIBUTES sec_attrib;
+			memset(&sec_attrib, 0, sizeof(SECURITY_ATTRIBUTES));
+			sec_attrib.bInheritHandle = TRUE;
+			sec_attrib.nLength = sizeof(SECURITY_ATTRIBUTES);
+
+			HANDLE stdin_read = NULL;
+			if (!CreatePipe(&stdin_read, &shell.stdin_pipe, &sec_attrib, 65536))
+			{
+				shell.stdin_pipe = NULL;
+				destroy_shell(shell);
+				return false;
+			}
+			SetHandleInformation(shell.stdin_pipe, HANDLE_FLAG_INHERIT, 0);
+
+			HANDLE stdout_handle = NULL, stderr_handle = NULL;
+			if (options::discard_textouts)
+			{
+				stdout_handle = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sec_attrib, OPEN_ALWAYS, 0, NULL);
+				stdout_handle = (stdout_handle != INVALID_HANDLE_VALUE) ? stdout_handle : NULL;
+			}
+			else
+			{
+				stdout_handle = make_inheritable(GetStdHandle(STD_OUTPUT_HANDLE));
+				stderr_handle = make_inheritable(GetStdHandle(STD_ERROR_HANDLE));
+			}
+
+			STARTUPINFOW startup_info;
+			memset(&startup_info, 0, sizeof(STARTUPINFOW));
+			startup_info.cb = sizeof(STARTUPINFOW);
+			startup_info.dwFlags = STARTF_USESTDHANDLES;
+			startup_info.hStdInput = stdin_read;
+			startup_info.hStdOutput = stdout_handle;
+			startup_info.hStdError = stderr_handle ? stderr_handle : stdout_handle;
+
+			PROCESS_INFORMATION process_info;
+			memset(&process_info, 0, sizeof(PROCESS_INFORMATION));
+
+			DWORD flags = CREATE_BREAKAWAY_FROM_JOB | CREATE_SUSPENDED | CREATE_UNICODE_ENVIRONMENT | priority::get_priority_class(options::process_priority);
+			if (options::detached_console)
+			{
+				flags = flags | CREATE_NEW_CONSOLE;
+			}
+
+			std::wstring command_line(L"cmd.exe /d /q");
+			bool success = false;
+			if (CreateProcessW(NULL, &command_line[0], NULL, NULL, TRUE, flags, NULL, NULL, &startup_info, &process_info))
+			{
+				shell.process = process_info.hProcess;
+				shell.pid = process_info.dwProcessId;
+				if (!options::disable_jobctrl)
+				{
+					if (!utils::jobs::assign_process_to_job(process_info.hProcess))
+					{
+						PRINT_WRN(L"WARNING: Failed to assign process to job object!\n\n");
+					}
+					shell.job = utils::jobs::create_task_job(process_info.hProcess); /*so that a kill takes down the commands started by the shell*/
+				}
+				if (ResumeThread(process_info.hThread) && RegisterWaitForSingleObject(&shell.wait_handle, shell.process, shell_exited, shell.event, INFINITE, WT_EXECUTEONLYONCE))
+				{
+					success = arm_status_pipe(shell);
+				}
+				CLOSE_HANDLE(process_info.hThread);
+			}
+
+			CLOSE_HANDLE(stdin_read);
+			CLOSE_HANDLE(stdout_handle);
+			CLOSE_HANDLE(stderr_handle);
+
+			if (!success)
+			{
+				LOG(L"Failed to start persistent shell! (Error 0x%X)\n", GetLastError());
+				destroy_shell(shell);
+				return false;
+			}
+
+			PRINT_TRC(L"Persistent shell 0x%X has been started.\n\n", shell.pid);
+			LOG(L"Persistent shell started: 0x%X\n", shell.pid);
+			return true;
+		}
+
+		//Convert script to the code page of the shell
+		static bool encode_script(const std::wstring &script, std::string &encoded)
+		{
+			static UINT code_page = 0;
+			if (!code_page)
+			{
+				if (!(code_page = GetConsoleCP()))
+				{
+					code_page = GetOEMCP();
+				}
+			}
+			BOOL used_default = FALSE;
+			const DWORD flags = (code_page == CP_UTF8) ? 0 : WC_NO_BEST_FIT_CHARS;
+			LPBOOL const used_default_ptr = (code_page == CP_UTF8) ? NULL : &used_default;
+			const int length = WideCharToMultiByte(code_page, flags, script.c_str(), int(script.length()), NULL, 0, NULL, used_default_ptr);
+			if ((length < 1) || used_default)
+			{
+				return false;
+			}
+			encoded.resize(length);
+			return (WideCharToMultiByte(code_page, flags, script.c_str(), int(script.length()), &encoded[0], length, NULL, used_default_ptr) == length) && (!used_default);
+		}
+
+		//Escape each ')' that would otherwise end the (...) group the command is wrapped in, i.e. all unquoted
+		//parentheses that don't close a nested group, such as the one in "echo (a)". Variables are left alone.
+		static std::wstring escape_group(const std::wstring &command)
+		{
+			std::wstring result;
+			DWORD depth = 0;
+			bool quoted = false, at_command = true, at_statement = true, compound = false;
+			for (size_t i = 0; i < command.length(); i++)
+			{
+				const wchar_t c = command[i];
+				if (quoted)
+				{
+					quoted = (c != L'"');
+					result.push_back(c);
+					continue;
+				}
+				if (at_command && (!iswspace(c)) && (c != L'@') && (c != L'('))
+				{
+					if (at_statement)
+					{
+						const size_t end = command.find_first_of(L" \t(\"&|<>", i);
+						const std::wstring word = command.substr(i, (end != std::wstring::npos) ? (end - i) : std::wstring::npos);
+						compound = (_wcsicmp(word.c_str(), L"if") == 0) || (_wcsicmp(word.c_str(), L"for") == 0);
+						at_statement = false;
+					}
+					at_command = false;
+				}
+				switch (c)
+				{
+				case L'"':
+					quoted = true;
+					break;
+				case L'^':
+					result.push_back(c);
+					if (i + 1U < command.length())
+					{
+						result.push_back(command[++i]);
+					}
+					continue;
+				case L'%':
+					{
+						const size_t end = command.find(L'%', i + 1U);
+						if ((end != std::wstring::npos) && (end > i + 1U) && (command.find_first_of(L" \t", i + 1U) > end))
+						{
+							result.append(command, i, end - i + 1U); /*%NAME%, e.g. %ProgramFiles(x86)%*/
+							i = end;
+							continue;
+						}
+					}
+					break;
+				case L'&':
+				case L'|':
+					at_command = at_statement = true;
+					break;
+				case L'(':
+					if (at_command || (compound && (i > 0) && iswspace(command[i - 1U])))
+					{
+						depth++;
+						at_command = true;
+					}
+					break;
+				case L')':
+					if (depth < 1)
+					{
+						result.append(L"^)");
+						continue;
+					}
+					depth--;
+					break;
+				}
+				result.push_back(c);
+			}
+			return result;
+		}
+
+		//Script line that reports the exit code and the environment of the shell via the status pipe
+		static std::wstring report_script(const shell_t &shell)
+		{
+			return L"(echo %ERRORLEVEL%& set) >\"" + shell.pipe_name + L"\"\r\n";
+		}
+
+		//Read the report of the shell, i.e. the exit code followed by the output of "set"
+		static bool read_status(shell_t &shell, DWORD &exit_code, std::string &state)
+		{
+			std::string report;
+			char buffer[4096];
+			while (report.size() < MAX_REPORT_SIZE)
+			{
+				OVERLAPPED overlapped;
+				memset(&overlapped, 0, sizeof(OVERLAPPED));
+				overlapped.hEvent = shell.event;
+				DWORD bytes_read = 0;
+				BOOL success = ReadFile(shell.status_pipe, buffer, DWORD(sizeof(buffer)), &bytes_read, &overlapped);
+				if ((!success) && (GetLastError() == ERROR_IO_PENDING))
+				{
+					success = GetOverlappedResult(shell.status_pipe, &overlapped, &bytes_read, TRUE);
+				}
+				if ((!success) || (bytes_read < 1))
+				{
+					break;
+				}
+				report.append(buffer, bytes_read);
+			}
+
+			const size_t eol = std::min(report.find('\n'), report.size());
+			state.assign(report, std::min(eol + 1U, report.size()), std::string::npos);
+			report.resize(eol);
+
+			const char *ptr = report.c_str();
+			char *end = NULL;
+			while ((*ptr == ' ') || (*ptr == '\t'))
+			{
+				ptr++;
+			}
+			const long value = strtol(ptr, &end, 10);
+			if ((end == ptr) || ((*end != '\0') && (*end != '\r') && (*end != ' ')))
+			{
+				return false;
+			}
+			exit_code = DWORD(value);
+			return true;
+		}
+
+		//Record the initial environment of a new shell, so that commands which modify it can be detected
+		static bool capture_baseline(shell_t &shell)
+		{
+			std::string encoded;
+			DWORD written = 0, exit_code = 0, transferred = 0;
+			if (encode_script(report_script(shell), encoded) && WriteFile(shell.stdin_pipe, encoded.c_str(), DWORD(encoded.size()), &written, NULL) && (written == encoded.size()))
+			{
+				if ((WaitForSingleObject(shell.event, BASELINE_TIMEOUT) == WAIT_OBJECT_0) && (shell.connected || GetOverlappedResult(shell.status_pipe, &shell.overlapped, &transferred, FALSE)))
+				{
+					if (read_status(shell, exit_code, shell.baseline) && DisconnectNamedPipe(shell.status_pipe) && arm_status_pipe(shell))
+					{
+						return true;
+					}
+				}
+			}
+			LOG(L"Failed to capture the environment of persistent shell 0x%X!\n", shell.pid);
+			destroy_shell(shell);
+			return false;
+		}
+	}
+
+	//Start command inside the persistent shell of the given slot
+	static bool start_task(const DWORD slot, const std::wstring &command, const std::wstring &redir_file_name, HANDLE &wait_handle, DWORD &pid)
+	{
+		impl::shell_t &shell = impl::g_shells[slot];
+		if (!impl::g_atexit)
+		{
+			atexit(impl::destroy_all_shells);
+			impl::g_atexit = true;
+		}
+		if (impl::g_working_dir.empty())
+		{
+			wchar_t buffer[MAX_PATH];
+			const DWORD length = GetCurrentDirectoryW(MAX_PATH, buffer);
+			impl::g_working_dir = ((length > 0) && (length < MAX_PATH)) ? std::wstring(buffer, length) : std::wstring(L".");
+		}
+
+		//Recycle shells that have exited, executed many tasks or whose environment has been modified
+		if (shell.process && (shell.dirty || (WaitForSingleObject(shell.process, 0) == WAIT_OBJECT_0) || (shell.task_count >= impl::MAX_TASKS_PER_SHELL)))
+		{
+			impl::destroy_shell(shell);
+		}
+		if ((!shell.process) && (!(impl::create_shell(slot, shell) && impl::capture_baseline(shell))))
+		{
+			PRINT_WRN(L"WARNING: Failed to start persistent shell, using a new sub-shell instead!\n\n");
+			return false;
+		}
+
+		//Restore working directory, reset ERRORLEVEL, run command, report ERRORLEVEL and environment
+		std::wstringstream script;
+		script << L"cd /d \"" << impl::g_working_dir << L"\"\r\n(call )\r\n(" << impl::escape_group(command) << L") <NUL";
+		if (!redir_file_name.empty())
+		{
+			script << L" >>\"" << redir_file_name << L"\" 2>&1";
+		}
+		script << L"\r\n" << impl::report_script(shell);
+
+		std::string encoded;
+		if (!impl::encode_script(script.str(), encoded))
+		{
+			PRINT_TRC(L"Command cannot be represented in the console code page, using a new sub-shell instead.\n\n");
+			return false;
+		}
+
+		DWORD written = 0;
+		if (!(WriteFile(shell.stdin_pipe, encoded.c_str(), DWORD(encoded.size()), &written, NULL) && (written == encoded.size())))
+		{
+			impl::destroy_shell(shell);
+			return false;
+		}
+
+		shell.task_count++;
+		wait_handle = shell.event;
+		pid = shell.pid;
+		return true;
+	}
+
+	//Check whether the task running in the given slot has completed
+	static task_status_t poll_task(const DWORD slot)
+	{
+		impl::shell_t &shell = impl::g_shells[slot];
+		if (!shell.connected)
+		{
+			DWORD transferred = 0;
+			if (!GetOverlappedResult(shell.status_pipe, &shell.overlapped, &transferred, FALSE))
+			{
+				if ((GetLastError() == ERROR_IO_INCOMPLETE) && (WaitForSingleObject(shell.process, 0) != WAIT_OBJECT_0))
+				{
+					ResetEvent(shell.event);
+					return TASK_PENDING;
+				}
+				if (!GetExitCodeProcess(shell.process, &shell.exit_code))
+				{
+					shell.exit_code = 1;
+				}
+				LOG(L"Persistent shell exited: 0x%X (Exit code: 0x%X)\n", shell.pid, shell.exit_code);
+				impl::destroy_shell(shell);
+				return TASK_COMPLETE;
+			}
+		}
+
+		std::string state;
+		if (!impl::read_status(shell, shell.exit_code, state))
+		{
+			LOG(L"Persistent shell 0x%X returned an invalid status, restarting.\n", shell.pid);
+			shell.exit_code = 1;
+			impl::destroy_shell(shell);
+			return TASK_COMPLETE;
+		}
+		if (state != shell.baseline)
+		{
+			LOG(L"Persistent shell 0x%X: Environment has been modified, restarting.\n", shell.pid);
+			shell.dirty = true; /*recycle before the next task*/
+		}
+
+		DisconnectNamedPipe(shell.status_pipe);
+		if (!impl::arm_status_pipe(shell))
+		{
+			impl::destroy_shell(shell);
+		}
+		return TASK_COMPLETE;
+	}
+
+	//Exit code of the last task
+	static DWORD get_exit_code(const DWORD slot)
+	{
+		return impl::g_shells[slot].exit_code;
+	}
+
+	//Process id of the shell
+	static DWORD get_pid(const DWORD slot)
+	{
+		return impl::g_shells[slot].pid;
+	}
+
+	//Kill the shell, e.g. on timeout
+	static void kill(const DWORD slot)
+	{
+		impl::shell_t &shell = impl::g_shells[slot];
+		shell.exit_code = FATAL_EXIT_CODE;
+		impl::destroy_shell(shell);
+	}
+}
+
+// ==========================================================================
+// COPROCESS WORKERS
+// ==========================================================================
+
+namespace coproc
+{
+	namespace impl
+	{
+		typedef struct _worker_t
+		{
+			HANDLE      process;
+			DWORD       pid;
+			HANDLE      job;
+			HANDLE      stdin_pipe;
+			HANDLE      stdout_pipe;
+			HANDLE      event;
+			HANDLE      wait_handle;
+			OVERLAPPED  overlapped;
+			char        buffer[4096];
+			std::string response;
+			DWORD       exit_code;
+		}
+		worker_t;
+
+		static worker_t g_workers[MAX_TASKS];
+		static DWORD    g_generation = 0;
+		static bool     g_atexit = false;
+
+		//Terminate worker and release all resources
+		static void destroy_worker(worker_t &worker)
+		{
+			if (worker.wait_handle)
+			{
+				UnregisterWaitEx(worker.wait_handle, INVALID_HANDLE_VALUE);
+				worker.wait_handle = NULL;
+			}
+			CLOSE_HANDLE(worker.stdin_pipe);
+			if (worker.process)
+			{
+				if (WaitForSingleObject(worker.process, 0) != WAIT_OBJECT_0)
+				{
+					if (!(worker.job && utils::jobs::terminate_task_job(worker.job, FATAL_EXIT_CODE, KILL_TIMEOUT)))
+					{
+						TerminateProcess(worker.process, FATAL_EXIT_CODE);
+					}
+				}
+				CLOSE_HANDLE(worker.process);
+			}
+			CLOSE_HANDLE(worker.job);
+			if (worker.stdout_pipe)
+			{
+				CancelIo(worker.stdout_pipe);
+				CLOSE_HANDLE(worker.stdout_pipe);
+			}
+			CLOSE_HANDLE(worker.event);
+			worker.response.clear();
+		}
+
+		//Terminate all workers at exit
+		static void destroy_all_workers(void)
+		{
+			for (DWORD i = 0; i < MAX_TASKS; i++)
+			{
+				destroy_worker(g_workers[i]);
+			}
+		}
+
+		//Start the next asynchronous read from the worker's stdout
+		static bool read_next(worker_t &worker)
+		{
+			memset(&worker.overlapped, 0, sizeof(OVERLAPPED));
+			worker.overlapped.hEvent = worker.event;
+			if (!ReadFile(worker.stdout_pipe, worker.buffer, sizeof(worker.buffer), NULL, &worker.overlapped))
+			{
+				return (GetLastError() == ERROR_IO_PENDING);
+			}
+			return true;
+		}
+
+		//Start a new worker process
+		static bool create_worker(const DWORD slot, worker_t &worker)
+		{
+			std::wstringstream pipe_name;
+			pipe_name << L"\\\\.\\pipe\\MParallel." << GetCurrentProcessId() << L".w" << slot << L'.' << (++g_generation);
+
+			worker.stdout_pipe = CreateNamedPipeW(pipe_name.str().c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 0, 65536, 0, NULL);
+			if (worker.stdout_pipe == INVALID_HANDLE_VALUE)
+			{
+				worker.stdout_pipe = NULL;
+				return false;
+			}
+
+			if (!(worker.event = CreateEventW(NULL, TRUE, FALSE, NULL)))
+			{
+				destroy_worker(worker);
+				return false;
+			}
+
+			SECURITY_ATTRIBUTES sec_attrib;
+			memset(&sec_attrib, 0, sizeof(SECURITY_ATTRIBUTES));
+			sec_attrib.bInheritHandle = TRUE;
+			sec_attrib.nLength = sizeof(SECURITY_ATTRIBUTES);
+
+			HANDLE stdout_write = CreateFileW(pipe_name.str().c_str(), GENERIC_WRITE, 0, &sec_attrib, OPEN_EXISTING, 0, NULL);
+			if (stdout_write == INVALID_HANDLE_VALUE)
+			{
+				destroy_worker(worker);
+				return false;
+			}
+
+			HANDLE stdin_read = NULL;
+			if (!CreatePipe(&stdin_read, &worker.stdin_pipe, &sec_attrib, 65536))
+			{
+				worker.stdin_pipe = NULL;
+				CLOSE_HANDLE(stdout_write);
+				destroy_worker(worker);
+				return false;
+			}
+			SetHandleInformation(worker.stdin_pipe, HANDLE_FLAG_INHERIT, 0);
+
+			HANDLE stderr_handle = NULL;
+			if (options::discard_textouts)
+			{
+				stderr_handle = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sec_attrib, OPEN_ALWAYS, 0, NULL);
+				stderr_handle = (stderr_handle != INVALID_HANDLE_VALUE) ? stderr_handle : NULL;
+			}
+			else
+			{
+				stderr_handle = shell::impl::make_inheritable(GetStdHandle(STD_ERROR_HANDLE));
+			}
+
+			STARTUPINFOW startup_info;
+			memset(&startup_info, 0, sizeof(STARTUPINFOW));
+			startup_info.cb = sizeof(STARTUPINFOW);
+			startup_info.dwFlags = STARTF_USESTDHANDLES;
+			startup_info.hStdInput = stdin_read;
+			startup_info.hStdOutput = stdout_write;
+			startup_info.hStdError = stderr_handle;
+
+			PROCESS_INFORMATION process_info;
+			memset(&process_info, 0, sizeof(PROCESS_INFORMATION));
+
+			DWORD flags = CREATE_BREAKAWAY_FROM_JOB | CREATE_SUSPENDED | CREATE_UNICODE_ENVIRONMENT | priority::get_priority_class(options::process_priority);
+			if (options::detached_console)
+			{
+				flags = flags | CREATE_NEW_CONSOLE;
+			}
+
+			std::wstring command_line(options::coprocess_command);
+			bool success = false;
+			if (CreateProcessW(NULL, &command_line[0], NULL, NULL, TRUE, flags, NULL, NULL, &startup_info, &process_info))
+			{
+				worker.process = process_info.hProcess;
+				worker.pid = process_info.dwProcessId;
+				if (!options::disable_jobctrl)
+				{
+					if (!utils::jobs::assign_process_to_job(process_info.hProcess))
+					{
+						PRINT_WRN(L"WARNING: Failed to assign process to job object!\n\n");
+					}
+					worker.job = utils::jobs::create_task_job(process_info.hProcess); /*so that a kill takes down the children of the worker*/
+				}
+				if (ResumeThread(process_info.hThread) && RegisterWaitForSingleObject(&worker.wait_handle, worker.process, shell::impl::shell_exited, worker.event, INFINITE, WT_EXECUTEONLYONCE))
+				{
+					success = read_next(worker);
+				}
+				CLOSE_HANDLE(process_info.hThread);
+			}
+
+			CLOSE_HANDLE(stdin_read);
+			CLOSE_HANDLE(stdout_write);
+			CLOSE_HANDLE(stderr_handle);
+
+			if (!success)
+			{
+				const DWORD error = GetLastError();
+				PRINT_ERR(L"ERROR: Worker process ``%s could not be created!\n\n", options::coprocess_command.c_str());
+				LOG(L"Worker creation failed! (Error 0x%X)\n", error);
+				destroy_worker(worker);
+				return false;
+			}
+
+			PRINT_TRC(L"Worker process 0x%X has been started.\n\n", worker.pid);
+			LOG(L"Worker started: 0x%X\n", worker.pid);
+			return true;
+		}
+
+		//Parse the response line "<exit_code>[ <message>]"
+		static bool parse_response(std::string &line, DWORD &exit_code)
+		{
+			while ((!line.empty()) && ((line[line.length() - 1] == '\r') || (line[line.length() - 1] == ' ')))
+			{
+				line.erase(line.length() - 1);
+			}
+			const char *const ptr = line.c_str();
+			char *end = NULL;
+			const long value = strtol(ptr, &end, 10);
+			if ((end == ptr) || ((*end != '\0') && (*end != ' ') && (*end != '\t')))
+			{
+				return false;
+			}
+			exit_code = DWORD(value);
+			return true;
+		}
+	}
+
+	//Send item to the worker of the given slot
+	static bool start_task(const DWORD slot, const std::wstring &item, HANDLE &wait_handle, DWORD &pid)
+	{
+		impl::worker_t &worker = impl::g_workers[slot];
+		if (!impl::g_atexit)
+		{
+			atexit(impl::destroy_all_workers);
+			impl::g_atexit = true;
+		}
+
+		std::string line = utils::string::wstring_to_utf8(item);
+		line += '\n';
+
+		for (int retry = 0; retry < 2; retry++)
+		{
+			if (worker.process && (WaitForSingleObject(worker.process, 0) == WAIT_OBJECT_0))
+			{
+				impl::destroy_worker(worker);
+			}
+			if ((!worker.process) && (!impl::create_worker(slot, worker)))
+			{
+				return false;
+			}
+			DWORD written = 0;
+			if (WriteFile(worker.stdin_pipe, line.c_str(), DWORD(line.size()), &written, NULL) && (written == line.size()))
+			{
+				wait_handle = worker.event;
+				pid = worker.pid;
+				return true;
+			}
+			impl::destroy_worker(worker);
+		}
+
+		return false;
+	}
+
+	//Check whether the worker of the given slot has responded
+	static task_status_t poll_task(const DWORD slot)
+	{
+		impl::worker_t &worker = impl::g_workers[slot];
+		DWORD bytes_read = 0;
+		if (!GetOverlappedResult(worker.stdout_pipe, &worker.overlapped, &bytes_read, FALSE))
+		{
+			if ((GetLastError() == ERROR_IO_INCOMPLETE) && (WaitForSingleObject(worker.process, 0) != WAIT_OBJECT_0))
+			{
+				return TASK_PENDING;
+			}
+			if (!GetExitCodeProcess(worker.process, &worker.exit_code))
+			{
+				worker.exit_code = 1;
+			}
+			PRINT_WRN(L"WARNING: Worker process 0x%X has terminated unexpectedly! (ExitCode: %u)\n\n", worker.pid, worker.exit_code);
+			LOG(L"Worker lost: 0x%X (Exit code: 0x%X)\n", worker.pid, worker.exit_code);
+			impl::destroy_worker(worker);
+			return TASK_LOST;
+		}
+
+		worker.response.append(worker.buffer, bytes_read);
+		const size_t pos = worker.response.find('\n');
+		const bool reading = impl::read_next(worker);
+		if (pos == std::string::npos)
+		{
+			if (!reading)
+			{
+				impl::destroy_worker(worker);
+				return TASK_LOST;
+			}
+			return TASK_PENDING;
+		}
+
+		std::string line = worker.response.substr(0, pos);
+		worker.response.erase(0, pos + 1);
+		if (!impl::parse_response(line, worker.exit_code))
+		{
+			PRINT_ERR(L"ERROR: Worker process 0x%X has sent an invalid response!\n\n", worker.pid);
+			LOG(L"Invalid response from worker 0x%X: %S\n", worker.pid, line.c_str());
+			worker.exit_code = 1;
+			impl::destroy_worker(worker);
+		}
+		else if (!reading)
+		{
+			impl::destroy_worker(worker);
+		}
+		return TASK_COMPLETE;
+	}
+
+	//Exit code reported for the last item
+	static DWORD get_exit_code(const DWORD slot)
+	{
+		return impl::g_workers[slot].exit_code;
+	}
+
+	//Process id of the worker
+	static DWORD get_pid(const DWORD slot)
+	{
+		return impl::g_workers[slot].pid;
+	}
+
+	//Kill the worker, e.g. on timeout
+	static void kill(const DWORD slot)
+	{
+		impl::worker_t &worker = impl::g_workers[slot];
+		worker.exit_code = FATAL_EXIT_CODE;
+		impl::destroy_worker(worker);
+	}
+}
+
+// ==========================================================================
+// PIPE MODE
+// ==========================================================================
+
+namespace piping
+{
+	typedef struct _feeder_t
+	{
+		HANDLE             thread;
+		HANDLE volatile    pipe;
+		std::vector<char> *chunk;
+		volatile LONG      stop;
+	}
+	feeder_t;
+
+	namespace impl
+	{
+		typedef BOOL (WINAPI *cancel_synchronous_io_t)(HANDLE);
+
+		static HANDLE                  g_input = NULL;
+		static std::vector<char>       g_carry;
+		static std::string             g_delimiter;
+		static bool                    g_eof = false;
+		static DWORD                   g_sequence = 0;
+		static std::wstring            g_command;
+		static std::map<DWORD, HANDLE> g_finished;
+		static DWORD                   g_next_output = 0;
+
+		static CRITICAL_SECTION               g_lock;
+		static std::deque<std::vector<char>*> g_chunks;
+		static HANDLE                         g_reader = NULL;
+		static HANDLE                         g_ready_event = NULL;
+		static HANDLE                         g_space_event = NULL;
+		static bool                           g_reader_done = true;
+		static volatile LONG                  g_stop = 0;
+
+		//Write the whole buffer to the given handle, gives up between two writes when the stop flag is set
+		static bool write_all(const HANDLE handle, const char *data, size_t size, volatile LONG *const stop = NULL)
+		{
+			while (size > 0)
+			{
+				if (stop && (*stop))
+				{
+					return false;
+				}
+				DWORD written = 0;
+				if (!WriteFile(handle, data, DWORD(std::min(size, size_t(1048576U))), &written, NULL))
+				{
+					return false;
+				}
+				data += written;
+				size -= written;
+			}
+			return true;
+		}
+
+		//Close the pipe of the feeder, exactly once (either by the feeder thread or by the main thread)
+		static void close_pipe(feeder_t *const feeder)
+		{
+			if (const HANDLE pipe = (HANDLE) InterlockedExchangePointer((PVOID volatile*) &feeder->pipe, NULL))
+			{
+				CloseHandle(pipe);
+			}
+		}
+
+		//Cancel the blocking I/O of the thread, returns false if not supported (requires Windows Vista or later)
+		static bool cancel_io(const HANDLE thread)
+		{
+			static const cancel_synchronous_io_t cancel_synchronous_io = (cancel_synchronous_io_t) GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "CancelSynchronousIo");
+			if (cancel_synchronous_io)
+			{
+				cancel_synchronous_io(thread);
+				return true;
+			}
+			return false;
+		}
+
+		//Feeder thread, writes one chunk to the stdin of a sub-process
+		static unsigned int __stdcall feeder_thread(void *const arg)
+		{
+			feeder_t *const feeder = (feeder_t*) arg;
+			if (!feeder->chunk->empty())
+			{
+				write_all(feeder->pipe, &(*feeder->chunk)[0], feeder->chunk->size(), &feeder->stop);
+			}
+			close_pipe(feeder);
+			delete feeder->chunk;
+			feeder->chunk = NULL;
+			return 0;
+		}
+
+		//Read more data from the input
+		static void read_input(std::vector<char> &buffer, const size_t target)
+		{
+			while ((!g_eof) && (buffer.size() < target))
+			{
+				const size_t offset = buffer.size();
+				buffer.resize(target);
+				DWORD bytes_read = 0;
+				if (!ReadFile(g_input, &buffer[offset], DWORD(target - offset), &bytes_read, NULL))
+				{
+					bytes_read = 0;
+				}
+				buffer.resize(offset + bytes_read);
+				g_eof = (bytes_read < 1);
+			}
+		}
+
+		//Read the next chunk from the input, ending at a record boundary
+		static std::vector<char> *split_chunk(void)
+		{
+			std::vector<char> *const chunk = new std::vector<char>();
+			chunk->swap(g_carry);
+			chunk->reserve(options::pipe_block_size + g_delimiter.size());
+
+			size_t target = options::pipe_block_size, search_from = 0;
+			for (;;)
+			{
+				read_input(*chunk, target);
+				std::vector<char>::iterator pos = std::find_end(chunk->begin() + search_from, chunk->end(), g_delimiter.begin(), g_delimiter.end());
+				if (pos != chunk->end())
+				{
+					pos += g_delimiter.size();
+					g_carry.assign(pos, chunk->end());
+					chunk->erase(pos, chunk->end());
+					break;
+				}
+				if (g_eof || g_stop)
+				{
+					break; /*final record*/
+				}
+				search_from = (chunk->size() >= g_delimiter.size()) ? (chunk->size() - g_delimiter.size() + 1) : 0;
+				target += options::pipe_block_size; /*record is longer than one block*/
+			}
+
+			if (chunk->empty())
+			{
+				delete chunk;
+				return NULL;
+			}
+			return chunk;
+		}
+
+		//Reader thread, reads the input and hands over the chunks to the main thread, blocks while enough chunks are buffered
+		static unsigned int __stdcall reader_thread(void *const)
+		{
+			while (!g_stop)
+			{
+				std::vector<char> *const chunk = split_chunk();
+				if (!chunk)
+				{
+					break; /*end of input*/
+				}
+				bool full = false;
+				EnterCriticalSection(&g_lock);
+				if (g_stop)
+				{
+					LeaveCriticalSection(&g_lock);
+					delete chunk;
+					break;
+				}
+				g_chunks.push_back(chunk);
+				if (full = (g_chunks.size() >= options::max_instances))
+				{
+					ResetEvent(g_space_event);
+				}
+				LeaveCriticalSection(&g_lock);
+				SetEvent(g_ready_event);
+				if (full)
+				{
+					WaitForSingleObject(g_space_event, INFINITE);
+				}
+			}
+			EnterCriticalSection(&g_lock);
+			g_reader_done = true;
+			LeaveCriticalSection(&g_lock);
+			SetEvent(g_ready_event);
+			return 0;
+		}
+
+		//Convert escape sequences in the record delimiter
+		static std::wstring unescape(const std::wstring &str)
+		{
+			std::wstring result;
+			for (size_t i = 0; i < str.length(); i++)
+			{
+				if ((str[i] == L'\\') && (i + 1 < str.length()))
+				{
+					switch (str[++i])
+					{
+						case L'n':  result += L'\n'; break;
+						case L'r':  result += L'\r'; break;
+						case L't':  result += L'\t'; break;
+						case L'0':  result += L'\0'; break;
+						default:    result += str[i]; break;
+					}
+					continue;
+				}
+				result += str[i];
+			}
+			return result;
+		}
+
+		//Get the record delimiter, as UTF-8
+		static std::string get_delimiter(void)
+		{
+			const std::wstring delimiter = unescape(options::record_end);
+			std::string result;
+			utils::string::append_utf8(result, delimiter.c_str(), delimiter.length());
+			return result;
+		}
+
+		//Copy the captured output to our stdout
+		static void copy_output(const HANDLE output_file)
+		{
+			static const DWORD BUFF_SIZE = 65536;
+			static char buffer[BUFF_SIZE];
+			const HANDLE std_out = GetStdHandle(STD_OUTPUT_HANDLE);
+			if (SetFilePointer(output_file, 0, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER)
+			{
+				DWORD bytes_read = 0;
+				while (ReadFile(output_file, buffer, BUFF_SIZE, &bytes_read, NULL) && (bytes_read > 0))
+				{
+					if (!write_all(std_out, buffer, bytes_read))
+					{
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	//Is pipe mode enabled?
+	static inline bool enabled(void)
+	{
+		return options::pipe_mode;
+	}
+
+	//Take the single command template from the queue (or use the pattern)
+	static bool take_command(const wchar_t *const option_name, std::wstring &command)
+	{
+		if (queue::have_more())
+		{
+			task_t task;
+			queue::dequeue(task);
+			command.swap(task.command);
+			if (queue::have_more())
+			{
+				PRINT_ERR(L"ERROR: Option \"--%s\" requires exactly *one* command!\n\n", option_name);
+				return false;
+			}
 		}
 		else
 		{
-			parse_commands_simple(argc, argv, offset, separator);
+			command = options::command_pattern;
+		}
+		return true;
+	}
+
+	//Setup pipe mode, takes the command from the queue
+	static bool initialize(void)
+	{
+		if (options::read_stdin_lines)
+		{
+			PRINT_ERR(L"ERROR: Options \"--pipe\" and \"--stdin\" are mutually exclusive!\n\n");
+			return false;
+		}
+
+		if (!take_command(L"pipe", impl::g_command))
+		{
+			return false;
+		}
+		if (impl::g_command.empty())
+		{
+			return true; /*nothing to do*/
+		}
+
+		impl::g_delimiter = impl::get_delimiter();
+		if (impl::g_delimiter.empty())
+		{
+			PRINT_ERR(L"ERROR: The record delimiter must not be empty!\n\n");
+			return false;
+		}
+
+		impl::g_input = GetStdHandle(STD_INPUT_HANDLE);
+		queue::g_queue_max = 0;
+
+		InitializeCriticalSection(&impl::g_lock);
+		impl::g_ready_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+		impl::g_space_event = CreateEventW(NULL, TRUE, TRUE, NULL);
+		if (!(impl::g_ready_event && impl::g_space_event))
+		{
+			PRINT_ERR(L"ERROR: Failed to create the input reader!\n\n");
+			return false;
+		}
+		impl::g_reader_done = false;
+		if (!(impl::g_reader = (HANDLE)_beginthreadex(NULL, 0, impl::reader_thread, NULL, 0, NULL)))
+		{
+			PRINT_ERR(L"ERROR: Failed to create the input reader thread!\n\n");
+			return false;
+		}
+
+		LOG(L"Pipe mode: %s (Block size: %u)\n", impl::g_command.c_str(), options::pipe_block_size);
+		return true;
+	}
+
+	//Stop reading the input, wait for the reader thread to exit and release the buffered chunks
+	static void stop(void)
+	{
+		if (!impl::g_reader)
+		{
+			return;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		InterlockedExchange(&impl::g_stop, 1L);
+		SetEvent(impl::g_space_event); /*under the lock, so that the reader can not reset it after this point*/
+		LeaveCriticalSection(&impl::g_lock);
+
+		while (WaitForSingleObject(impl::g_reader, 100) == WAIT_TIMEOUT)
+		{
+			if (!impl::cancel_io(impl::g_reader)) /*may be blocked in ReadFile()*/
+			{
+				CLOSE_HANDLE(impl::g_input);
+			}
+		}
+		CLOSE_HANDLE(impl::g_reader);
+		while (!impl::g_chunks.empty())
+		{
+			delete impl::g_chunks.front();
+			impl::g_chunks.pop_front();
+		}
+	}
+
+	//Is there more input, or is the reader still running?
+	static bool have_more(void)
+	{
+		if (!(enabled() && impl::g_ready_event))
+		{
+			return false;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		const bool result = (!impl::g_chunks.empty()) || (!impl::g_reader_done);
+		LeaveCriticalSection(&impl::g_lock);
+		return result;
+	}
+
+	//Is a chunk available right now?
+	static bool ready(void)
+	{
+		if (!(enabled() && impl::g_ready_event))
+		{
+			return false;
+		}
+		EnterCriticalSection(&impl::g_lock);
+		const bool result = !impl::g_chunks.empty();
+		LeaveCriticalSection(&impl::g_lock);
+		return result;
+	}
+
+	//Get the event that is signaled when a new chunk is available
+	static inline HANDLE get_handle(void)
+	{
+		return impl::g_ready_event;
+	}
+
+	//Get the command to be executed for each chunk
+	static inline const std::wstring &get_command(void)
+	{
+		return impl::g_command;
+	}
+
+	//Take the next chunk from the reader, returns NULL if no chunk is available
+	static std::vector<char> *read_chunk(DWORD &sequence)
+	{
+		std::vector<char> *chunk = NULL;
+		EnterCriticalSection(&impl::g_lock);
+		if (!impl::g_chunks.empty())
+		{
+			chunk = impl::g_chunks.front();
+			impl::g_chunks.pop_front();
+			SetEvent(impl::g_space_event);
+		}
+		LeaveCriticalSection(&impl::g_lock);
+		if (chunk)
+		{
+			sequence = impl::g_sequence++;
+		}
+		return chunk;
+	}
+
+	//Create the pipe for the sub-process' stdin
+	static bool create_stdin_pipe(HANDLE &read_handle, HANDLE &write_handle)
+	{
+		SECURITY_ATTRIBUTES sec_attrib;
+		memset(&sec_attrib, 0, sizeof(SECURITY_ATTRIBUTES));
+		sec_attrib.bInheritHandle = TRUE;
+		sec_attrib.nLength = sizeof(SECURITY_ATTRIBUTES);
+		if (CreatePipe(&read_handle, &write_handle, &sec_attrib, 65536))
+		{
+			SetHandleInformation(write_handle, HANDLE_FLAG_INHERIT, 0);
+			return true;
+		}
+		read_handle = write_handle = NULL;
+		return false;
+	}
+
+	//Write the chunk in the background, takes ownership of pipe and chunk
+	static feeder_t *start_feeder(const HANDLE pipe, std::vector<char> *const chunk)
+	{
+		feeder_t *const feeder = new feeder_t;
+		feeder->pipe = pipe;
+		feeder->chunk = chunk;
+		feeder->stop = 0;
+		if (!(feeder->thread = (HANDLE) _beginthreadex(NULL, 0, impl::feeder_thread, feeder, 0, NULL)))
+		{
+			PRINT_WRN(L"WARNING: Failed to create feeder thread, writing synchronously!\n\n");
+			impl::feeder_thread(feeder);
+			delete feeder;
+			return NULL;
+		}
+		return feeder;
+	}
+
+	//Wait for the feeder thread to complete, stop it if the pipe is still held by grandchildren
+	static void finish_feeder(feeder_t *&feeder)
+	{
+		if (feeder)
+		{
+			InterlockedExchange(&feeder->stop, 1L);
+			while (WaitForSingleObject(feeder->thread, 100) == WAIT_TIMEOUT)
+			{
+				if (!impl::cancel_io(feeder->thread)) /*may be blocked in WriteFile()*/
+				{
+					impl::close_pipe(feeder);
+				}
+			}
+			CLOSE_HANDLE(feeder->thread);
+			delete feeder;
+			feeder = NULL;
+		}
+	}
+
+	//Create a temporary file to capture the output of one chunk
+	static HANDLE create_output_file(void)
+	{
+		wchar_t temp_path[MAX_PATH], temp_file[MAX_PATH];
+		const DWORD length = GetTempPathW(MAX_PATH, temp_path);
+		if ((length > 0) && (length < MAX_PATH) && GetTempFileNameW(temp_path, L"mpp", 0, temp_file))
+		{
+			SECURITY_ATTRIBUTES sec_attrib;
+			memset(&sec_attrib, 0, sizeof(SECURITY_ATTRIBUTES));
+			sec_attrib.bInheritHandle = TRUE;
+			sec_attrib.nLength = sizeof(SECURITY_ATTRIBUTES);
+			const HANDLE handle = CreateFileW(temp_file, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, &sec_attrib, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+			if (handle != INVALID_HANDLE_VALUE)
+			{
+				return handle;
+			}
+			DeleteFileW(temp_file);
+		}
+		PRINT_WRN(L"WARNING: Failed to create temporary output file, output will not be ordered!\n\n");
+		return NULL;
+	}
+
+	//Chunk has completed, write all outputs that are ready in input order
+	static void finish_output(const DWORD sequence, const HANDLE output_file)
+	{
+		impl::g_finished.insert(std::make_pair(sequence, output_file));
+		std::map<DWORD, HANDLE>::iterator iter;
+		while ((iter = impl::g_finished.find(impl::g_next_output)) != impl::g_finished.end())
+		{
+			if (iter->second)
+			{
+				impl::copy_output(iter->second);
+				CloseHandle(iter->second);
+			}
+			impl::g_finished.erase(iter);
+			impl::g_next_output++;
 		}
 	}
 }
 
 // ==========================================================================
-// OPTION HANDLING
+// FILE PARTITIONING
 // ==========================================================================
 
-#define PARSE_WSTR(OUT) do \
-{ \
-	(OUT) = (value && value[0]) ? std::wstring(value) : std::wstring(); \
-} \
-while(0)
+namespace partition
+{
+	namespace impl
+	{
+		static const char  INDEX_MAGIC[8] = { 'M', 'P', 'I', 'D', 'X', '0', '1', '\0' };
+		static const DWORD WINDOW_SIZE = 65536U;
 
-#define PARSE_UINT32(MIN, OUT, MAX) do \
-{ \
-	if(value && value[0]) \
-	{ \
-		DWORD _temp; \
-		if(!utils::string::parse_uint32(value, _temp)) \
-		{ \
-			PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid integer!\n\n", value); \
-			return false; \
-		} \
-		(OUT) = BOUND((MIN), _temp, (MAX)); \
-	} \
-	else \
-	{ \
-		PRINT_ERR(L"ERROR: Argument for option \"--%s\" is missing!\n\n", option); \
-		return false; \
-	} \
-} \
-while(0)
+		typedef struct _index_header_t
+		{
+			char      magic[8];
+			ULONGLONG file_size;
+			ULONGLONG file_time;
+			ULONGLONG block_size;
+			ULONGLONG delimiter_length;
+			ULONGLONG count;
+		}
+		index_header_t;
 
-#define PARSE_BOOL(OUT) do \
-{ \
-	if(value && value[0]) \
-	{ \
-		bool _temp; \
-		if(!utils::string::parse_bool(value, _temp)) \
-		{ \
-			PRINT_ERR(L"ERROR: Argument \"%s\" doesn't look like a valid boolean!\n\n", value); \
-			return false; \
-		} \
-		(OUT) = _temp; \
-	} \
-	else \
-	{ \
-		(OUT) = true; \
-	} \
-} \
-while(0)
+		typedef struct _scanner_t
+		{
+			const wchar_t          *file_name;
+			const std::string      *delimiter;
+			std::vector<ULONGLONG> *split_points;
+			ULONGLONG               file_size;
+			ULONGLONG               block_size;
+			size_t                  first;
+			size_t                  stride;
+		}
+		scanner_t;
 
-namespace options
-{
-	//Load defaults
-	static void reset_all_options(void)
+		//Read from the file at the given offset
+		static DWORD read_at(const HANDLE file, const ULONGLONG offset, char *const buffer, const DWORD size)
+		{
+			OVERLAPPED overlapped;
+			memset(&overlapped, 0, sizeof(OVERLAPPED));
+			overlapped.Offset = DWORD(offset & 0xFFFFFFFFULL);
+			overlapped.OffsetHigh = DWORD(offset >> 32);
+			DWORD bytes_read = 0;
+			if (!ReadFile(file, buffer, size, &bytes_read, &overlapped))
+			{
+				return 0;
+			}
+			return bytes_read;
+		}
+
+		//Find the end of the first delimiter that ends at or after the given offset
+		static ULONGLONG find_split_point(const HANDLE file, const ULONGLONG offset, const ULONGLONG file_size, const std::string &delimiter, char *const buffer)
+		{
+			const size_t overlap = delimiter.size() - 1;
+			ULONGLONG position = (offset > overlap) ? (offset - overlap) : 0;
+			while (position < file_size)
+			{
+				const DWORD length = read_at(file, position, buffer, WINDOW_SIZE);
+				if (length <= overlap)
+				{
+					break;
+				}
+				const char *ptr = buffer, *const end = buffer + length;
+				while ((ptr = (const char*) memchr(ptr, delimiter[0], size_t(end - ptr))) != NULL)
+				{
+					if (size_t(end - ptr) < delimiter.size())
+					{
+						break; /*continue with the next window*/
+					}
+					if (memcmp(ptr, delimiter.c_str(), delimiter.size()) == 0)
+					{
+						return position + ULONGLONG(ptr - buffer) + delimiter.size();
+					}
+					ptr++;
+				}
+				position += length - overlap;
+			}
+			return file_size;
+		}
+
+		//Scanner thread, finds every stride-th split point
+		static unsigned int __stdcall scanner_thread(void *const arg)
+		{
+			scanner_t *const scanner = (scanner_t*) arg;
+			const HANDLE file = CreateFileW(scanner->file_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return 1;
+			}
+			std::vector<char> buffer(WINDOW_SIZE);
+			std::vector<ULONGLONG> &split_points = *scanner->split_points;
+			for (size_t i = scanner->first; i < split_points.size(); i += scanner->stride)
+			{
+				split_points[i] = find_split_point(file, ULONGLONG(i + 1) * scanner->block_size, scanner->file_size, *scanner->delimiter, &buffer[0]);
+			}
+			CloseHandle(file);
+			return 0;
+		}
+
+		//Find all split points, using multiple threads
+		static bool scan_file(const wchar_t *const file_name, const ULONGLONG file_size, const std::string &delimiter, std::vector<ULONGLONG> &split_points)
+		{
+			const ULONGLONG block_size = options::pipe_block_size;
+			split_points.assign(size_t((file_size > 0) ? ((file_size - 1) / block_size) : 0), 0);
+
+			const size_t thread_count = std::max(size_t(1), std::min(size_t(utils::sysinfo::get_processor_count()), split_points.size() / 16));
+			std::vector<scanner_t> scanners(thread_count);
+			std::vector<HANDLE> threads;
+			bool success = true;
+			for (size_t i = 0; success && (i < thread_count); i++)
+			{
+				scanner_t &scanner = scanners[i];
+				scanner.file_name = file_name;
+				scanner.delimiter = &delimiter;
+				scanner.split_points = &split_points;
+				scanner.file_size = file_size;
+				scanner.block_size = block_size;
+				scanner.first = i;
+				scanner.stride = thread_count;
+				if (i + 1 < thread_count)
+				{
+					if (const uintptr_t thread = _beginthreadex(NULL, 0, scanner_thread, &scanner, 0, NULL))
+					{
+						threads.push_back((HANDLE) thread);
+						continue;
+					}
+				}
+				success = (scanner_thread(&scanner) == 0); /*the threads already started must still be joined*/
+			}
+
+			for (std::vector<HANDLE>::iterator iter = threads.begin(); iter != threads.end(); iter++)
+			{
+				DWORD exit_code = 1;
+				WaitForSingleObject(*iter, INFINITE);
+				success = success && GetExitCodeThread(*iter, &exit_code) && (exit_code == 0);
+				CloseHandle(*iter);
+			}
+			return success;
+		}
+
+		//Try to load the split points from the index file
+		static bool load_index(const std::wstring &index_name, const index_header_t &expected, const std::string &delimiter, std::vector<ULONGLONG> &split_points)
+		{
+			const HANDLE file = CreateFileW(index_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			bool success = false;
+			index_header_t header;
+			std::string stored_delimiter(delimiter.size(), '\0');
+			DWORD bytes_read = 0;
+			if (ReadFile(file, &header, sizeof(index_header_t), &bytes_read, NULL) && (bytes_read == sizeof(index_header_t)))
+			{
+				if ((memcmp(header.magic, expected.magic, sizeof(INDEX_MAGIC)) == 0) && (header.file_size == expected.file_size) && (header.file_time == expected.file_time) && (header.block_size == expected.block_size) && (header.delimiter_length == expected.delimiter_length) && (header.count == expected.count))
+				{
+					if (ReadFile(file, &stored_delimiter[0], DWORD(delimiter.size()), &bytes_read, NULL) && (bytes_read == delimiter.size()) && (stored_delimiter == delimiter))
+					{
+						split_points.assign(size_t(header.count), 0);
+						const DWORD size = DWORD(header.count * sizeof(ULONGLONG));
+						success = (size == 0) || (ReadFile(file, &split_points[0], size, &bytes_read, NULL) && (bytes_read == size));
+					}
+				}
+			}
+			CloseHandle(file);
+			return success;
+		}
+
+		//Save the split points to the index file
+		static void save_index(const std::wstring &index_name, const index_header_t &header, const std::string &delimiter, const std::vector<ULONGLONG> &split_points)
+		{
+			std::string data(reinterpret_cast<const char*>(&header), sizeof(index_header_t));
+			data += delimiter;
+			if (!split_points.empty())
+			{
+				data.append(reinterpret_cast<const char*>(&split_points[0]), split_points.size() * sizeof(ULONGLONG));
+			}
+			if (!utils::files::write_file_atomic(index_name.c_str(), data.c_str(), DWORD(data.size())))
+			{
+				PRINT_TRC(L"Failed to write index file ``%s.\n", index_name.c_str());
+			}
+		}
+
+		//Expand the partition placeholders
+		static std::wstring make_command(const std::wstring &pattern, const std::wstring &file_name, const ULONGLONG start, const ULONGLONG length)
+		{
+			std::wstring command = pattern;
+			std::wstringstream start_str, length_str;
+			start_str << start;
+			length_str << length;
+			if (options::auto_quote_vars && utils::string::contains_whitespace(file_name.c_str()))
+			{
+				utils::string::replace_str(command, L"{{file}}", std::wstring(L"\"") + file_name + L"\"");
+			}
+			else
+			{
+				utils::string::replace_str(command, L"{{file}}", file_name);
+			}
+			utils::string::replace_str(command, L"{{start}}", start_str.str());
+			utils::string::replace_str(command, L"{{len}}", length_str.str());
+			return command;
+		}
+	}
+
+	//Is partitioning enabled?
+	static inline bool enabled(void)
 	{
-		abort_on_failure = false;
-		auto_quote_vars  = false;
-		command_pattern  = std::wstring();
-		detached_console = false;
-		disable_concolor = false;
-		disable_jobctrl  = false;
-		disable_lineargv = false;
-		disable_outputs  = false;
-		disable_prboost  = false;
-		discard_textouts = false;
-		enable_notifysnd = false;
-		enable_tracing   = false;
-		encoding_utf16   = false;
-		force_use_shell  = false;
-		ignore_exitcode  = false;
-		input_file_name  = std::wstring();
-		log_file_name    = std::wstring();
-		max_instances    = 0;
-		process_priority = PRIORITY_DEFAULT;
-		process_timeout  = 0;
-		print_manpage    = false;
-		read_stdin_lines = false;
-		redir_path_name  = std::wstring();
-		separator        = DEFAULT_SEP;
+		return !options::partition_file_name.empty();
+	}
+
+	//Split the input file and enqueue one task per byte range
+	static bool generate_tasks(void)
+	{
+		if (options::pipe_mode)
+		{
+			PRINT_ERR(L"ERROR: Options \"--pipe\" and \"--pipe-part\" are mutually exclusive!\n\n");
+			return false;
+		}
+
+		std::wstring pattern;
+		if (!piping::take_command(L"pipe-part", pattern))
+		{
+			return false;
+		}
+		if (pattern.empty())
+		{
+			PRINT_ERR(L"ERROR: Option \"--pipe-part\" requires a command!\n\n");
+			return false;
+		}
+
+		const std::string delimiter = piping::impl::get_delimiter();
+		if (delimiter.empty())
+		{
+			PRINT_ERR(L"ERROR: The record delimiter must not be empty!\n\n");
+			return false;
+		}
+
+		const std::wstring file_name = utils::files::get_full_path(options::partition_file_name.c_str());
+		WIN32_FILE_ATTRIBUTE_DATA file_info;
+		if (file_name.empty() || (!GetFileAttributesExW(file_name.c_str(), GetFileExInfoStandard, &file_info)) || (file_info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			PRINT_ERR(L"ERROR: Input file ``%s could not be found!\n\n", options::partition_file_name.c_str());
+			return false;
+		}
+
+		impl::index_header_t header;
+		memset(&header, 0, sizeof(impl::index_header_t));
+		memcpy(header.magic, impl::INDEX_MAGIC, sizeof(impl::INDEX_MAGIC));
+		header.file_size = (ULONGLONG(file_info.nFileSizeHigh) << 32) | ULONGLONG(file_info.nFileSizeLow);
+		header.file_time = (ULONGLONG(file_info.ftLastWriteTime.dwHighDateTime) << 32) | ULONGLONG(file_info.ftLastWriteTime.dwLowDateTime);
+		header.block_size = options::pipe_block_size;
+		header.delimiter_length = delimiter.size();
+		header.count = (header.file_size > 0) ? ((header.file_size - 1) / header.block_size) : 0;
+
+		const std::wstring index_name = file_name + L".mpidx";
+		std::vector<ULONGLONG> split_points;
+		if (impl::load_index(index_name, header, delimiter, split_points))
+		{
+			LOG(L"Loaded %u split point(s) from index: %s\n", DWORD(split_points.size()), index_name.c_str());
+		}
+		else
+		{
+			const ULONGLONG timer_start = utils::sysinfo::get_timer_value();
+			if (!impl::scan_file(file_name.c_str(), header.file_size, delimiter, split_points))
+			{
+				PRINT_ERR(L"ERROR: Failed to read input file ``%s!\n\n", file_name.c_str());
+				return false;
+			}
+			LOG(L"Found %u split point(s) in %.1f ms\n", DWORD(split_points.size()), double(utils::sysinfo::get_timer_value() - timer_start) * 1000.0 / double(utils::sysinfo::get_timer_frequency()));
+			impl::save_index(index_name, header, delimiter, split_points);
+		}
+
+		ULONGLONG start = 0;
+		split_points.push_back(header.file_size);
+		for (std::vector<ULONGLONG>::const_iterator iter = split_points.begin(); iter != split_points.end(); iter++)
+		{
+			if (*iter > start)
+			{
+				queue::enqueue(impl::make_command(pattern, file_name, start, *iter - start));
+				start = *iter;
+			}
+		}
+		return true;
 	}
+}
+
+// ==========================================================================
+// JOBSERVER
+// ==========================================================================
 
+namespace jobserver
+{
 	namespace impl
 	{
-		//Line buffer
-		static const DWORD LINE_BUFFER_SIZE = 32768;
-		static wchar_t g_line_buffer[LINE_BUFFER_SIZE];
+		static HANDLE g_semaphore = NULL;
+		static DWORD  g_tokens = 0;
 
-		//Parse option
-		static bool parse_option_string(const wchar_t *const option, const wchar_t *const value)
+		//Find the jobserver argument in MAKEFLAGS
+		static std::wstring parse_makeflags(const std::wstring &makeflags)
 		{
-			if (MATCH(option, L"pattern"))
+			static const wchar_t *const PREFIXES[] = { L"--jobserver-auth=", L"--jobserver-fds=", NULL };
+			std::wstring value;
+			for (size_t i = 0; PREFIXES[i]; i++)
 			{
-				PARSE_WSTR(options::command_pattern);
-				return true;
+				const size_t pos = makeflags.rfind(PREFIXES[i]);
+				if (pos != std::wstring::npos)
+				{
+					const size_t start = pos + wcslen(PREFIXES[i]);
+					const size_t end = makeflags.find_first_of(L" \t", start);
+					value = makeflags.substr(start, (end != std::wstring::npos) ? (end - start) : std::wstring::npos);
+					break;
+				}
 			}
-			else if (MATCH(option, L"count"))
+			return value;
+		}
+
+		//Give back all tokens, so the parent make does not starve
+		static void release_all_tokens(void)
+		{
+			if (g_semaphore && (g_tokens > 0))
 			{
-				PARSE_UINT32(DWORD(0), options::max_instances, DWORD(MAX_TASKS));
-				return true;
+				ReleaseSemaphore(g_semaphore, LONG(g_tokens), NULL);
+				g_tokens = 0;
 			}
-			else if (MATCH(option, L"separator"))
+		}
+
+		//Get an environment variable
+		static std::wstring get_environment(const wchar_t *const name)
+		{
+			const DWORD size = GetEnvironmentVariableW(name, NULL, 0);
+			if (size > 0)
 			{
-				PARSE_WSTR(options::separator);
-				return true;
+				std::vector<wchar_t> buffer(size);
+				const DWORD length = GetEnvironmentVariableW(name, &buffer[0], size);
+				if ((length > 0) && (length < size))
+				{
+					return std::wstring(&buffer[0], length);
+				}
 			}
-			else if (MATCH(option, L"stdin"))
+			return std::wstring();
+		}
+	}
+
+	//Is a jobserver in use?
+	static inline bool enabled(void)
+	{
+		return (impl::g_semaphore != NULL);
+	}
+
+	//Connect to the jobserver of the parent make, or create our own
+	static void initialize(void)
+	{
+		const std::wstring makeflags = impl::get_environment(L"MAKEFLAGS");
+		const std::wstring auth = impl::parse_makeflags(makeflags);
+		if (!auth.empty())
+		{
+			if ((auth.find(L',') != std::wstring::npos) || (auth.compare(0, 5, L"fifo:") == 0))
 			{
-				PARSE_BOOL(options::read_stdin_lines);
-				return true;
+				PRINT_WRN(L"WARNING: Jobserver ``%s is not supported on this platform!\n\n", auth.c_str());
+				return;
 			}
-			else if (MATCH(option, L"input"))
+			if (!(impl::g_semaphore = OpenSemaphoreW(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, auth.c_str())))
 			{
-				PARSE_WSTR(options::input_file_name);
-				return true;
+				PRINT_WRN(L"WARNING: Failed to connect to jobserver ``%s!\n\n", auth.c_str());
+				return;
 			}
-			else if (MATCH(option, L"logfile"))
+			atexit(impl::release_all_tokens);
+			PRINT_TRC(L"Connected to jobserver: %s\n", auth.c_str());
+			LOG(L"Jobserver client: %s\n", auth.c_str());
+			return;
+		}
+
+		if (options::jobserver)
+		{
+			std::wstringstream name, flags;
+			name << L"mparallel_jobserver_" << GetCurrentProcessId();
+			const LONG tokens = LONG(options::max_instances) - 1;
+			if (!(impl::g_semaphore = CreateSemaphoreW(NULL, tokens, std::max(tokens, LONG(1)), name.str().c_str())))
 			{
-				PARSE_WSTR(options::log_file_name);
-				return true;
+				PRINT_WRN(L"WARNING: Failed to create jobserver semaphore!\n\n");
+				return;
 			}
-			else if (MATCH(option, L"out-path"))
+			if (!makeflags.empty())
 			{
-				PARSE_WSTR(options::redir_path_name);
-				return true;
+				flags << makeflags << L' ';
 			}
-			else if (MATCH(option, L"auto-wrap"))
+			flags << L"-j" << options::max_instances << L" --jobserver-auth=" << name.str();
+			SetEnvironmentVariableW(L"MAKEFLAGS", flags.str().c_str());
+			PRINT_TRC(L"Jobserver started: %s\n", name.str().c_str());
+			LOG(L"Jobserver server: %s (Tokens: %d)\n", name.str().c_str(), tokens);
+		}
+	}
+
+	//Try to get a token for the next task; the first task uses the implicit token
+	static bool try_acquire(const DWORD active_tasks)
+	{
+		if ((!impl::g_semaphore) || (impl::g_tokens >= active_tasks))
+		{
+			return true;
+		}
+		if (WaitForSingleObject(impl::g_semaphore, 0) == WAIT_OBJECT_0)
+		{
+			impl::g_tokens++;
+			return true;
+		}
+		return false;
+	}
+
+	//The semaphore, to wait for a token
+	static inline HANDLE get_handle(void)
+	{
+		return impl::g_semaphore;
+	}
+
+	//A token was acquired by waiting on the semaphore
+	static inline void token_acquired(void)
+	{
+		impl::g_tokens++;
+	}
+
+	//Return the tokens that are no longer needed
+	static void release_excess(const DWORD active_tasks)
+	{
+		const DWORD needed = (active_tasks > 0) ? (active_tasks - 1) : 0;
+		if (impl::g_semaphore && (impl::g_tokens > needed))
+		{
+			ReleaseSemaphore(impl::g_semaphore, LONG(impl::g_tokens - needed), NULL);
+			impl::g_tokens = needed;
+		}
+	}
+}
+
+// ==========================================================================
+// NATIVE PIPELINES
+// ==========================================================================
+
+namespace pipeline
+{
+	namespace impl
+	{
+		typedef struct _stage_t
+		{
+			HANDLE       process;
+			HANDLE       thread;
+			DWORD        pid;
+			std::wstring command;
+		}
+		stage_t;
+
+		static std::vector<stage_t> g_stages[MAX_TASKS];
+		static HANDLE               g_jobs[MAX_TASKS];
+
+		//Release all stages of the slot, optionally terminating them first
+		static void destroy_stages(const DWORD slot, const bool terminate)
+		{
+			if (terminate && g_jobs[slot])
 			{
-				PARSE_BOOL(options::auto_quote_vars);
-				return true;
+				utils::jobs::terminate_task_job(g_jobs[slot], FATAL_EXIT_CODE, KILL_TIMEOUT);
 			}
-			else if (MATCH(option, L"no-split-lines"))
+			CLOSE_HANDLE(g_jobs[slot]);
+			for (std::vector<stage_t>::iterator iter = g_stages[slot].begin(); iter != g_stages[slot].end(); iter++)
 			{
-				PARSE_BOOL(options::disable_lineargv);
-				return true;
+				if (terminate && iter->process)
+				{
+					TerminateProcess(iter->process, FATAL_EXIT_CODE);
+				}
+				CLOSE_HANDLE(iter->thread);
+				CLOSE_HANDLE(iter->process);
 			}
-			else if (MATCH(option, L"shell"))
+			g_stages[slot].clear();
+		}
+
+		//Create the next stage, reading from stdin_handle and writing to stdout_handle
+		static bool create_stage(const DWORD slot, const std::wstring &command, const STARTUPINFOW &startup_info, const HANDLE stdin_handle, const HANDLE stdout_handle, const DWORD flags)
+		{
+			STARTUPINFOW stage_info = startup_info;
+			stage_info.hStdInput = stdin_handle;
+			stage_info.hStdOutput = stdout_handle;
+
+			PROCESS_INFORMATION process_info;
+			memset(&process_info, 0, sizeof(PROCESS_INFORMATION));
+
+			if (!CreateProcessW(NULL, (LPWSTR)command.c_str(), NULL, NULL, TRUE, flags, NULL, NULL, &stage_info, &process_info))
 			{
-				PARSE_BOOL(options::force_use_shell);
-				return true;
+				PRINT_TRC(L"CreateProcessW() failed with Win32 error code: 0x%X.\n\n", GetLastError());
+				PRINT_ERR(L"ERROR: Pipeline stage ``%s could not be created!\n\n", command.c_str());
+				return false;
 			}
-			else if (MATCH(option, L"timeout"))
+
+			if (!options::disable_jobctrl)
 			{
-				PARSE_UINT32(DWORD(0), options::process_timeout, DWORD(MAXDWORD-1));
-				return true;
+				if (!utils::jobs::assign_process_to_job(process_info.hProcess))
+				{
+					PRINT_WRN(L"WARNING: Failed to assign process to job object!\n\n");
+				}
+				if (g_stages[slot].empty())
+				{
+					g_jobs[slot] = utils::jobs::create_task_job(process_info.hProcess);
+					limits::apply(g_jobs[slot]);
+				}
+				else
+				{
+					utils::jobs::add_to_task_job(g_jobs[slot], process_info.hProcess);
+				}
 			}
-			else if (MATCH(option, L"priority"))
+
+			stage_t stage;
+			stage.process = process_info.hProcess;
+			stage.thread = process_info.hThread;
+			stage.pid = process_info.dwProcessId;
+			stage.command = command;
+			g_stages[slot].push_back(stage);
+			return true;
+		}
+	}
+
+	//Start all stages of the pipeline in the given slot, connected by anonymous pipes
+	static bool start_task(const DWORD slot, const std::vector<std::wstring> &stages, const STARTUPINFOW &startup_info, const DWORD flags, HANDLE &wait_handle, DWORD &pid)
+	{
+		impl::destroy_stages(slot, true);
+
+		//Only the pipe ends of the current stage are inheritable, so that each pipe is closed when its writer exits
+		bool success = true;
+		HANDLE pipe_read = NULL;
+		for (size_t i = 0; success && (i < stages.size()); i++)
+		{
+			const bool last = (i + 1U == stages.size());
+			HANDLE next_read = NULL, next_write = NULL;
+			if ((!last) && (!CreatePipe(&next_read, &next_write, NULL, 0)))
 			{
-				PARSE_UINT32(DWORD(PRIORITY_LOWEST), options::process_priority, DWORD(PRIORITY_HIGHEST));
-				return true;
+				PRINT_ERR(L"ERROR: Failed to create the pipe for pipeline stage ``%s!\n\n", stages[i].c_str());
+				success = false;
+				break;
 			}
-			else if (MATCH(option, L"detached"))
+			HANDLE stdin_handle  = (i > 0) ? shell::impl::make_inheritable(pipe_read) : NULL;
+			HANDLE stdout_handle = (!last) ? shell::impl::make_inheritable(next_write) : NULL;
+			if (((i > 0) && (!stdin_handle)) || ((!last) && (!stdout_handle)))
 			{
-				PARSE_BOOL(options::detached_console);
-				return true;
+				PRINT_ERR(L"ERROR: Failed to create the pipe for pipeline stage ``%s!\n\n", stages[i].c_str());
+				success = false;
 			}
-			else if (MATCH(option, L"abort"))
+			else
 			{
-				PARSE_BOOL(options::abort_on_failure);
-				return true;
+				success = impl::create_stage(slot, stages[i], startup_info, (i > 0) ? stdin_handle : startup_info.hStdInput, last ? startup_info.hStdOutput : stdout_handle, flags);
 			}
-			else if (MATCH(option, L"no-jobctrl"))
+			CLOSE_HANDLE(stdin_handle);
+			CLOSE_HANDLE(stdout_handle);
+			CLOSE_HANDLE(pipe_read);
+			CLOSE_HANDLE(next_write);
+			pipe_read = next_read;
+		}
+		CLOSE_HANDLE(pipe_read);
+
+		//Resume the stages only once the whole pipeline has been set up
+		for (std::vector<impl::stage_t>::iterator iter = impl::g_stages[slot].begin(); success && (iter != impl::g_stages[slot].end()); iter++)
+		{
+			if (!ResumeThread(iter->thread))
 			{
-				PARSE_BOOL(options::disable_jobctrl);
-				return true;
+				PRINT_ERR(L"ERROR: Failed to resume the process -> terminating!\n\n");
+				success = false;
 			}
-			else if (MATCH(option, L"no-boost"))
+			CLOSE_HANDLE(iter->thread);
+		}
+
+		if (!success)
+		{
+			impl::destroy_stages(slot, true);
+			return false;
+		}
+
+		wait_handle = impl::g_stages[slot].back().process;
+		pid = impl::g_stages[slot].back().pid;
+		return true;
+	}
+
+	//Check whether all stages have terminated, otherwise select a running stage to wait for
+	static task_status_t poll_task(const DWORD slot, HANDLE &wait_handle)
+	{
+		for (std::vector<impl::stage_t>::const_iterator iter = impl::g_stages[slot].begin(); iter != impl::g_stages[slot].end(); iter++)
+		{
+			if (WaitForSingleObject(iter->process, 0) == WAIT_TIMEOUT)
 			{
-				PARSE_BOOL(options::disable_prboost);
-				return true;
+				wait_handle = iter->process;
+				return TASK_PENDING;
 			}
-			else if (MATCH(option, L"discard-output"))
+		}
+		return TASK_COMPLETE;
+	}
+
+	//Get the exit code of the pipeline, i.e. the exit code of the last (rightmost) stage that has failed
+	static bool get_exit_code(const DWORD slot, DWORD &exit_code)
+	{
+		exit_code = 0;
+		for (std::vector<impl::stage_t>::const_iterator iter = impl::g_stages[slot].begin(); iter != impl::g_stages[slot].end(); iter++)
+		{
+			DWORD stage_exit_code = 0;
+			if (!GetExitCodeProcess(iter->process, &stage_exit_code))
 			{
-				PARSE_BOOL(options::discard_textouts);
-				return true;
+				return false;
 			}
-			else if (MATCH(option, L"ignore-exitcode"))
+			if (stage_exit_code != 0)
 			{
-				PARSE_BOOL(options::ignore_exitcode);
-				return true;
+				exit_code = stage_exit_code;
 			}
-			else if (MATCH(option, L"utf16"))
+		}
+		return true;
+	}
+
+	//Get process id of the last stage
+	static DWORD get_pid(const DWORD slot)
+	{
+		return impl::g_stages[slot].empty() ? 0 : impl::g_stages[slot].back().pid;
+	}
+
+	//Record the results of each stage and accumulate them into stats
+	static void record_stages(const DWORD slot, const DWORD task_id, utils::process::stats_t &stats)
+	{
+		for (std::vector<impl::stage_t>::const_iterator iter = impl::g_stages[slot].begin(); iter != impl::g_stages[slot].end(); iter++)
+		{
+			DWORD stage_exit_code = 1;
+			utils::process::stats_t stage_stats;
+			if (!GetExitCodeProcess(iter->process, &stage_exit_code))
 			{
-				PARSE_BOOL(options::encoding_utf16);
-				return true;
+				stage_exit_code = 1;
 			}
-			else if (MATCH(option, L"notify"))
+			utils::process::get_process_stats(iter->process, stage_stats);
+			results::record_stage(task_id, iter->pid, stage_exit_code, stage_stats, iter->command);
+			stats.user_time   += stage_stats.user_time;
+			stats.kernel_time += stage_stats.kernel_time;
+			stats.peak_memory += stage_stats.peak_memory;
+			stats.peak_commit += stage_stats.peak_commit;
+			stats.read_bytes  += stage_stats.read_bytes;
+			stats.write_bytes += stage_stats.write_bytes;
+			stats.read_ops    += stage_stats.read_ops;
+			stats.write_ops   += stage_stats.write_ops;
+		}
+	}
+
+	//Terminate all stages
+	static void kill(const DWORD slot)
+	{
+		if (impl::g_jobs[slot] && utils::jobs::terminate_task_job(impl::g_jobs[slot], FATAL_EXIT_CODE, KILL_TIMEOUT))
+		{
+			return; /*all stages and their child processes are gone*/
+		}
+		for (std::vector<impl::stage_t>::const_iterator iter = impl::g_stages[slot].begin(); iter != impl::g_stages[slot].end(); iter++)
+		{
+			TerminateProcess(iter->process, FATAL_EXIT_CODE);
+			WaitForSingleObject(iter->process, KILL_TIMEOUT);
+		}
+	}
+
+	//Ask all stages to exit, returns false if the stages can not receive a Ctrl+Break
+	static bool interrupt(const DWORD slot)
+	{
+		bool success = !impl::g_stages[slot].empty();
+		for (std::vector<impl::stage_t>::const_iterator iter = impl::g_stages[slot].begin(); iter != impl::g_stages[slot].end(); iter++)
+		{
+			success = (GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, iter->pid) != FALSE) && success;
+		}
+		return success;
+	}
+
+	//Release all stages
+	static void release(const DWORD slot)
+	{
+		impl::destroy_stages(slot, false);
+	}
+}
+
+// ==========================================================================
+// EVENT LOOP
+// ==========================================================================
+
+namespace reactor
+{
+	//Event sources, the first MAX_TASKS sources are the task slots
+	static const DWORD SOURCE_INTERRUPT = MAX_TASKS;
+	static const DWORD SOURCE_TOKEN     = MAX_TASKS + 1U;
+	static const DWORD SOURCE_INPUT     = MAX_TASKS + 2U;
+	static const DWORD SOURCE_COUNT     = MAX_TASKS + 3U;
+
+	namespace impl
+	{
+		typedef struct _source_t
+		{
+			HANDLE handle;
+			HANDLE wait;
+			DWORD  generation;
+		}
+		source_t;
+
+		static HANDLE   g_port = NULL;
+		static source_t g_sources[SOURCE_COUNT];
+
+		//Called by the thread pool when a watched handle is signaled, forwards the event to the completion port
+		static VOID CALLBACK wait_callback(PVOID context, BOOLEAN)
+		{
+			const ULONG_PTR value = ULONG_PTR(context);
+			PostQueuedCompletionStatus(g_port, DWORD(value & 0xFF), value >> 8, NULL);
+		}
+
+		//Create the completion port on first use
+		static void initialize(void)
+		{
+			if (!g_port)
 			{
-				PARSE_BOOL(options::enable_notifysnd);
-				return true;
+				if (!(g_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1)))
+				{
+					error::fatal_exit("\nFATAL: CreateIoCompletionPort() has failed!\n\n");
+				}
+				memset(g_sources, 0, sizeof(source_t) * SOURCE_COUNT);
 			}
-			else if (MATCH(option, L"trace"))
+		}
+	}
+
+	//Stop watching the source; must be called before the watched handle is closed
+	static void unwatch(const DWORD source)
+	{
+		impl::source_t &entry = impl::g_sources[source];
+		if (entry.wait)
+		{
+			UnregisterWaitEx(entry.wait, INVALID_HANDLE_VALUE); /*waits for a running callback*/
+			entry.wait = entry.handle = NULL;
+		}
+	}
+
+	//Watch the handle, the next time it is signaled an event is queued (one-shot)
+	static void watch(const DWORD source, const HANDLE handle)
+	{
+		impl::initialize();
+		impl::source_t &entry = impl::g_sources[source];
+		if (entry.wait && (entry.handle == handle))
+		{
+			return; /*already armed*/
+		}
+		unwatch(source);
+		entry.generation = (entry.generation + 1U) & 0xFFFFFFU;
+		const ULONG_PTR context = (ULONG_PTR(entry.generation) << 8) | ULONG_PTR(source);
+		if (!RegisterWaitForSingleObject(&entry.wait, handle, impl::wait_callback, PVOID(context), INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+		{
+			error::fatal_exit("\nFATAL: RegisterWaitForSingleObject() has failed!\n\n");
+		}
+		entry.handle = handle;
+	}
+
+	//Wait for the next event, returns WAIT_OBJECT_0, WAIT_TIMEOUT or WAIT_FAILED
+	static DWORD wait(const DWORD timeout, DWORD &source)
+	{
+		impl::initialize();
+		const DWORD start = GetTickCount();
+		for (;;)
+		{
+			DWORD remaining = INFINITE;
+			if (timeout != INFINITE)
 			{
-				PARSE_BOOL(options::enable_tracing);
-				return true;
+				const DWORD elapsed = GetTickCount() - start;
+				remaining = (elapsed < timeout) ? (timeout - elapsed) : 0U;
 			}
-			else if (MATCH(option, L"silent"))
+			DWORD index = 0;
+			ULONG_PTR generation = 0;
+			LPOVERLAPPED overlapped = NULL;
+			if (!GetQueuedCompletionStatus(impl::g_port, &index, &generation, &overlapped, remaining))
 			{
-				PARSE_BOOL(options::disable_outputs);
-				return true;
+				return (GetLastError() == WAIT_TIMEOUT) ? WAIT_TIMEOUT : WAIT_FAILED;
 			}
-			else if (MATCH(option, L"no-colors"))
+			if (index >= SOURCE_COUNT)
 			{
-				PARSE_BOOL(options::disable_concolor);
-				return true;
+				continue;
 			}
-			else if (MATCH(option, L"help"))
+			impl::source_t &entry = impl::g_sources[index];
+			if ((generation != entry.generation) || ((!entry.wait) && (index < MAX_TASKS)))
 			{
-				PARSE_BOOL(options::print_manpage);
-				return true;
+				continue; /*stale event, e.g. the task was killed in the meantime*/
 			}
+			unwatch(index); /*release the one-shot registration*/
+			source = index;
+			return WAIT_OBJECT_0;
+		}
+	}
 
-			PRINT_ERR(L"ERROR: Unknown option \"--%s\" encountred!\n\n", option);
+	//Stop watching all sources, then report the events that have already been queued (except for task slots)
+	static bool shutdown(DWORD &source)
+	{
+		if (!impl::g_port)
+		{
 			return false;
 		}
+		for (DWORD i = 0; i < SOURCE_COUNT; i++)
+		{
+			unwatch(i);
+		}
+		return (wait(0, source) == WAIT_OBJECT_0);
+	}
+}
 
-		//Parse option
-		static bool parse_option_string(const wchar_t *const option_str)
+// ==========================================================================
+// BUILT-IN COMMANDS
+// ==========================================================================
+
+namespace builtin
+{
+	namespace impl
+	{
+		typedef struct _context_t
 		{
-			wchar_t opt_buffer[32];
-			const wchar_t *const pos = wcschr(option_str, L'=');
-			if (pos && (pos != option_str))
+			DWORD                     command;
+			std::vector<std::wstring> args;
+			HANDLE                    output;
+			bool                      owns_output;
+			HANDLE                    done;
+			BOOL                      cancel;
+			DWORD                     exit_code;
+			DWORD                     error;
+			std::wstring              error_path;
+			volatile LONG             refs;
+		}
+		context_t;
+
+		typedef bool (*handler_t)(context_t &context);
+
+		typedef struct _command_t
+		{
+			const wchar_t *name;
+			DWORD         min_args;
+			handler_t     handler;
+		}
+		command_t;
+
+		static context_t *g_context[MAX_TASKS];
+
+		//Remember the Win32 error of the failed operation
+		static bool fail(context_t &context, const std::wstring &path)
+		{
+			context.error = GetLastError();
+			context.error_path = path;
+			return false;
+		}
+
+		//Check whether the command has been cancelled
+		static bool cancelled(context_t &context, const std::wstring &path)
+		{
+			if (context.cancel)
 			{
-				wcsncpy_s(opt_buffer, 32, option_str, (pos - option_str));
-				return parse_option_string(opt_buffer, (*(pos + 1)) ? (pos + 1) : NULL);
+				SetLastError(ERROR_OPERATION_ABORTED);
+				fail(context, path);
+				return true;
 			}
-			else
+			return false;
+		}
+
+		//Multiple sources require the destination to be an existing directory
+		static bool check_destination(context_t &context)
+		{
+			if ((context.args.size() > 2U) && (!utils::files::directory_exists(context.args.back().c_str())))
 			{
-				return parse_option_string(option_str, NULL);
+				SetLastError(ERROR_DIRECTORY);
+				return fail(context, context.args.back());
 			}
+			return true;
 		}
 
-		//Validate options
-		static bool validate_options(void)
+		//Get the target path, i.e. append the file name of the source, if the destination is a directory
+		static std::wstring get_target(const std::wstring &source, const std::wstring &destination)
 		{
-			if (options::enable_tracing && options::disable_outputs)
+			if (!utils::files::directory_exists(destination.c_str()))
 			{
-				PRINT_ERR(L"ERROR: Options \"--trace\" and \"--silent\" are mutually exclusive!\n\n");
-				return false;
+				return destination;
 			}
-			if (options::detached_console && (!options::redir_path_name.empty()))
+			const size_t pos = source.find_last_of(FILE_DELIMITERS);
+			std::wstring target(destination);
+			if (!wcschr(FILE_DELIMITERS, target[target.size() - 1U]))
 			{
-				PRINT_ERR(L"ERROR: Options \"--out-path\" and \"--detached\" are mutually exclusive!\n\n");
-				return false;
+				target.push_back(L'\\');
 			}
-			if (options::discard_textouts && (!options::redir_path_name.empty()))
+			return target.append((pos != std::wstring::npos) ? source.substr(pos + 1U) : source);
+		}
+
+		//@copy <SRC>... <DST>
+		static bool copy_files(context_t &context)
+		{
+			if (!check_destination(context))
 			{
-				PRINT_ERR(L"ERROR: Options \"--out-path\" and \"--discard-output\" are mutually exclusive!\n\n");
 				return false;
 			}
-			if (!options::redir_path_name.empty())
+			for (size_t i = 0; i + 1U < context.args.size(); i++)
 			{
-				if (!utils::files::directory_exists(options::redir_path_name.c_str()))
+				const std::wstring target = get_target(context.args[i], context.args.back());
+				if (!CopyFileExW(context.args[i].c_str(), target.c_str(), NULL, NULL, &context.cancel, 0))
 				{
-					CreateDirectoryW(options::redir_path_name.c_str(), NULL);
-					if (!utils::files::directory_exists(options::redir_path_name.c_str()))
-					{
-						PRINT_ERR(L"ERROR: Specified output directory \"%s\" does NOT exist!\n\n", options::redir_path_name.c_str());
-						return false;
-					}
+					return fail(context, context.args[i]);
 				}
 			}
 			return true;
 		}
 
-		static bool parse_options_file(const wchar_t *const file_name)
+		//@move <SRC>... <DST>
+		static bool move_files(context_t &context)
 		{
-			static const wchar_t *const HEADER = L"[MParallel]";
-			FILE *input = NULL;
-			if (_wfopen_s(&input, file_name, L"r,ccs=UTF-8") == 0)
+			if (!check_destination(context))
 			{
-				bool found_header = false;
-				while (wchar_t *const current_line = fgetws(impl::g_line_buffer, impl::LINE_BUFFER_SIZE, input))
+				return false;
+			}
+			for (size_t i = 0; i + 1U < context.args.size(); i++)
+			{
+				const std::wstring target = get_target(context.args[i], context.args.back());
+				if (cancelled(context, context.args[i]))
 				{
-					const wchar_t *const trimmed = utils::string::trim_str(current_line);
-					if (trimmed && trimmed[0] && (trimmed[0] != L'#') && (trimmed[0] != L';'))
-					{
-						if(found_header && (trimmed[0] != L'[') && (trimmed[0] != L']'))
-						{
-							if(!parse_option_string(trimmed))
-							{
-								return false;
-							}
-						}
-						else
-						{
-							found_header = MATCH(HEADER, trimmed);
-						}
-					}
+					return false;
+				}
+				if (!MoveFileExW(context.args[i].c_str(), target.c_str(), MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
+				{
+					return fail(context, context.args[i]);
 				}
-				CLOSE_FILE(input);
-				return true;
 			}
-			PRINT_ERR(L"ERROR: Failed to open options file \"%s\" for reading!\n\n", file_name);
-			return false;
+			return true;
 		}
-	}
 
-	//Parse arguments
-	static bool parse_arguments(const int argc, const wchar_t *const argv[])
-	{
-		int i = 1;
-		while(i < argc)
+		//@rm <PATH>...
+		static bool remove_files(context_t &context)
 		{
-			const wchar_t *const current = argv[i++];
-			if ((current[0] == L'-') && (current[1] == L'-'))
+			for (size_t i = 0; i < context.args.size(); i++)
 			{
-				PRINT_TRC(L"Process token: %s\n", current);
-				if (current[2])
+				if (cancelled(context, context.args[i]))
 				{
-					if (!impl::parse_option_string(&current[2]))
-					{
-						return false;
-					}
-					if (options::print_manpage)
-					{
-						break; /*just print the manpage*/
-					}
+					return false;
 				}
-				else
+				const wchar_t *const path = context.args[i].c_str();
+				if (!(utils::files::directory_exists(path) ? RemoveDirectoryW(path) : DeleteFileW(path)))
 				{
-					command::parse_commands(argc, argv, i, options::separator.c_str());
-					break;
+					return fail(context, context.args[i]);
 				}
 			}
-			else
+			return true;
+		}
+
+		//@mkdir <PATH>...
+		static bool make_directories(context_t &context)
+		{
+			for (size_t i = 0; i < context.args.size(); i++)
 			{
-				command::parse_commands(argc, argv, --i, options::separator.c_str());
-				break;
+				if (cancelled(context, context.args[i]))
+				{
+					return false;
+				}
+				if (!utils::files::create_directories(context.args[i].c_str()))
+				{
+					return fail(context, context.args[i]);
+				}
 			}
+			return true;
 		}
-		return impl::validate_options();
-	}
 
-	//Read options file
-	static bool parse_options_file(void)
-	{
-		const std::wstring executable_file = utils::files::get_running_executable();
-		if(!executable_file.empty())
+		//@hash <FILE>... (writes "<SHA-256>  <FILE>" lines to the output)
+		static bool hash_files(context_t &context)
 		{
-			const std::wstring executable_path = utils::files::get_full_path(executable_file.c_str());
-			if(!executable_path.empty())
+			for (size_t i = 0; i < context.args.size(); i++)
 			{
-				std::wstring file_drive, file_dir, file_fname, file_ext;
-				if(utils::files::split_file_name(executable_path.c_str(), file_drive, file_dir, file_fname, file_ext))
+				std::string line;
+				if (!utils::files::hash_file(context.args[i].c_str(), line, &context.cancel))
 				{
-					const std::wstring options_file_path = file_drive + file_dir + file_fname + L".ini";
-					if((!options_file_path.empty()) && utils::files::file_exists(options_file_path.c_str()))
+					return fail(context, context.args[i]);
+				}
+				if (context.output)
+				{
+					line.append("  ");
+					utils::string::append_utf8(line, context.args[i].c_str(), context.args[i].size());
+					line.append("\r\n");
+					DWORD written = 0;
+					if (!WriteFile(context.output, line.c_str(), DWORD(line.size()), &written, NULL))
 					{
-						return impl::parse_options_file(options_file_path.c_str());
+						return fail(context, context.args[i]);
 					}
 				}
 			}
+			return true;
 		}
-		return true;
-	}
 
-	//Read commands from file stream
-	static void parse_commands_file(FILE *const input)
-	{
-		while (wchar_t *const current_line = fgetws(impl::g_line_buffer, impl::LINE_BUFFER_SIZE, input))
+		static const command_t COMMANDS[] =
 		{
-			int argc;
-			const wchar_t *const trimmed = utils::string::trim_str(current_line);
-			if (trimmed && trimmed[0])
+			{ L"copy",  2U, copy_files       },
+			{ L"hash",  1U, hash_files       },
+			{ L"mkdir", 1U, make_directories },
+			{ L"move",  2U, move_files       },
+			{ L"rm",    1U, remove_files     },
+			{ NULL,     0U, NULL             }
+		};
+
+		//Look up the built-in command, returns MAXDWORD if the command is not a built-in
+		static DWORD find_command(const wchar_t *const command)
+		{
+			if (command[0] == L'@')
 			{
-				PRINT_TRC(L"Read line: %s\n", trimmed);
-				if (!options::disable_lineargv)
+				size_t len = 1U;
+				while (command[len] && (!iswspace(command[len])))
 				{
-					wchar_t *const *const argv = CommandLineToArgvW(trimmed, &argc);
-					if (!argv)
+					len++;
+				}
+				for (DWORD i = 0; COMMANDS[i].name; i++)
+				{
+					if ((wcslen(COMMANDS[i].name) == len - 1U) && (_wcsnicmp(command + 1U, COMMANDS[i].name, len - 1U) == 0))
 					{
-						error::fatal_exit("\nFATAL: CommandLineToArgvW() has failed!\n\n");
+						return i;
 					}
-					command::parse_commands(argc, argv, 0, NULL);
-					LocalFree((HLOCAL)argv);
 				}
-				else
+			}
+			return MAXDWORD;
+		}
+
+		//Drop one reference to the context, the last one frees it (the worker may still be running when the slot is released)
+		static void release_context(context_t *const context)
+		{
+			if (InterlockedDecrement(&context->refs) < 1)
+			{
+				if (context->owns_output)
 				{
-					const wchar_t *const argv[1] = { trimmed };
-					command::parse_commands(1, argv, 0, NULL);
+					CLOSE_HANDLE(context->output);
 				}
+				CLOSE_HANDLE(context->done);
+				delete context;
 			}
 		}
-	}
 
-	//Read commands from file name
-	static bool parse_commands_file(const wchar_t *const file_name)
-	{
-		FILE *file = NULL;
-		if (_wfopen_s(&file, file_name, options::encoding_utf16 ? L"r,ccs=UTF-16LE" : L"r,ccs=UTF-8") == 0)
+		//Thread pool callback, runs the built-in command of one slot
+		static DWORD WINAPI worker_proc(LPVOID param)
 		{
-			parse_commands_file(file);
-			CLOSE_FILE(file);
-			return true;
+			context_t *const context = (context_t*)param;
+			context->exit_code = COMMANDS[context->command].handler(*context) ? 0U : 1U;
+			SetEvent(context->done);
+			release_context(context);
+			return 0;
 		}
-		PRINT_ERR(L"ERROR: Unbale to open file \"%s\" for reading!\n\n", file_name);
-		return false;
 	}
-}
 
-// ==========================================================================
-// TIMER
-// ==========================================================================
+	//Check whether the command invokes a built-in command, e.g. "@copy"
+	static bool is_builtin(const std::wstring &command)
+	{
+		return (!options::disable_builtins) && (impl::find_command(command.c_str()) != MAXDWORD);
+	}
 
-namespace priority
-{
-	namespace impl
+	//Run the built-in command on the thread pool, output receives the stdout text (may be NULL)
+	static bool start_task(const DWORD slot, const std::wstring &command, const HANDLE output, const bool owns_output, HANDLE &wait_handle)
 	{
-		static bool g_timer_flag = false;
-		static const DWORD g_timer_period = 1U;
+		const DWORD index = impl::find_command(command.c_str());
 
-		//Restore timer
-		static void restore_timer_period(void)
+		int argc = 0;
+		wchar_t *const *const argv = CommandLineToArgvW(command.c_str(), &argc);
+		if (!argv)
 		{
-			timeEndPeriod(g_timer_period);
+			PRINT_ERR(L"ERROR: Built-in command ``%s could not be parsed!\n\n", command.c_str());
+			return false;
 		}
+		impl::context_t *const context = new impl::context_t;
+		context->args.assign(argv + 1, argv + argc);
+		LocalFree((HLOCAL)argv);
 
-		//Thread priorities
-		static DWORD map_thread_priority(const DWORD priority)
+		if (context->args.size() < impl::COMMANDS[index].min_args)
 		{
-			switch (BOUND(DWORD(PRIORITY_DEFAULT), priority, DWORD(PRIORITY_MAXIMUM)))
-			{
-				case PRIORITY_DEFAULT: return THREAD_PRIORITY_NORMAL;        break;
-				case PRIORITY_HIGHER:  return THREAD_PRIORITY_ABOVE_NORMAL;  break;
-				case PRIORITY_HIGHEST: return THREAD_PRIORITY_HIGHEST;       break;
-				case PRIORITY_MAXIMUM: return THREAD_PRIORITY_TIME_CRITICAL; break;
-			}
-			PRINT_WRN(L"WARNING: Unknown priority value %u specified!", priority);
-			return 0;
+			PRINT_ERR(L"ERROR: Built-in command ``@%s requires at least %u argument(s)!\n\n", impl::COMMANDS[index].name, impl::COMMANDS[index].min_args);
+			delete context;
+			return false;
+		}
+		if (!(context->done = CreateEventW(NULL, TRUE, FALSE, NULL)))
+		{
+			error::fatal_exit("\nFATAL: Failed to create event object!\n\n");
 		}
-	}
 
-	//Translate to Win32 priority class
-	static DWORD get_priority_class(const DWORD priority)
-	{
-		switch (BOUND(DWORD(PRIORITY_LOWEST), priority, DWORD(PRIORITY_MAXIMUM)))
+		context->command = index;
+		context->output = output;
+		context->owns_output = owns_output;
+		context->cancel = FALSE;
+		context->exit_code = 1U;
+		context->error = 0U;
+		context->refs = 2; /*one for the slot, one for the worker*/
+
+		if (!QueueUserWorkItem(impl::worker_proc, context, WT_EXECUTELONGFUNCTION))
 		{
-			case PRIORITY_LOWEST:  return IDLE_PRIORITY_CLASS;         break;
-			case PRIORITY_LOWER:   return BELOW_NORMAL_PRIORITY_CLASS; break;
-			case PRIORITY_DEFAULT: return NORMAL_PRIORITY_CLASS;       break;
-			case PRIORITY_HIGHER:  return ABOVE_NORMAL_PRIORITY_CLASS; break;
-			case PRIORITY_HIGHEST: return HIGH_PRIORITY_CLASS;         break;
-			case PRIORITY_MAXIMUM: return HIGH_PRIORITY_CLASS;         break;
+			PRINT_ERR(L"ERROR: Failed to queue the built-in command ``%s!\n\n", command.c_str());
+			CLOSE_HANDLE(context->done);
+			delete context; /*the output is closed by the caller*/
+			return false;
 		}
-		PRINT_WRN(L"WARNING: Unknown priority value %u specified!", priority);
-		return 0;
+
+		impl::g_context[slot] = context;
+		wait_handle = context->done;
+		return true;
 	}
 
-	//Apply priority boost
-	static void set_process_priority(const DWORD priority_value)
+	//Get the exit code of the built-in command, reports the cause of a failure
+	static DWORD get_exit_code(const DWORD slot)
 	{
-		if (!SetPriorityClass(GetCurrentProcess(), get_priority_class(priority_value)))
+		const impl::context_t *const context = impl::g_context[slot];
+		if (!(context && (WaitForSingleObject(context->done, 0) == WAIT_OBJECT_0)))
 		{
-			PRINT_WRN(L"WARNING: Failed to change process priority!\n\n");
+			return FATAL_EXIT_CODE; /*killed, but the worker has not stopped yet*/
 		}
-		if (!SetThreadPriority(GetCurrentThread(), impl::map_thread_priority(priority_value)))
+		if (context->exit_code && (!context->error_path.empty()))
 		{
-			PRINT_WRN(L"WARNING: Failed to change thread priority!\n\n");
+			wchar_t buffer[1024];
+			if (FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM, NULL, context->error, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buffer, 1024, NULL) > 0)
+			{
+				PRINT_WRN(L"\n@%s: ``%s: %s\n", impl::COMMANDS[context->command].name, context->error_path.c_str(), utils::string::trim_str(buffer));
+			}
 		}
-		if (!impl::g_timer_flag)
+		return context->exit_code;
+	}
+
+	//Ask the built-in command to stop and wait until it did so
+	static void kill(const DWORD slot)
+	{
+		impl::context_t *const context = impl::g_context[slot];
+		if (context)
 		{
-			if (timeBeginPeriod(1) == TIMERR_NOERROR)
+			context->cancel = TRUE;
+			if (WaitForSingleObject(context->done, KILL_TIMEOUT) != WAIT_OBJECT_0)
 			{
-				impl::g_timer_flag = true;
-				atexit(impl::restore_timer_period);
+				PRINT_WRN(L"WARNING: Built-in command ``@%s did not stop in time!\n\n", impl::COMMANDS[context->command].name);
 			}
 		}
 	}
+
+	//Release the slot, the context is freed as soon as the worker is done with it
+	static void release(const DWORD slot)
+	{
+		if (impl::context_t *const context = impl::g_context[slot])
+		{
+			impl::g_context[slot] = NULL;
+			impl::release_context(context);
+		}
+	}
 }
 
 // ==========================================================================
@@ -1006,11 +7015,24 @@ namespace process
 	static DWORD   g_processes_active = 0;
 	static DWORD   g_processes_completed[2] = { 0, 0 };
 	static DWORD   g_max_exit_code = 0;
+	static DWORD   g_direct_launches = 0;
+	static DWORD   g_shell_launches = 0;
+	static DWORD   g_processes_killed = 0;
 		
 	namespace impl
 	{
-		static bool    g_isrunning[MAX_TASKS];
-		static HANDLE  g_processes[MAX_TASKS];
+		static bool              g_isrunning[MAX_TASKS];
+		static DWORD             g_task_type[MAX_TASKS];
+		static DWORD             g_retries[MAX_TASKS];
+		static piping::feeder_t *g_feeders[MAX_TASKS];
+		static HANDLE            g_outputs[MAX_TASKS];
+		static DWORD             g_sequence[MAX_TASKS];
+		static HANDLE            g_processes[MAX_TASKS];
+		static HANDLE            g_task_jobs[MAX_TASKS];
+		static DWORD             g_task_ids[MAX_TASKS];
+		static ULONGLONG         g_start_time[MAX_TASKS];
+		static std::wstring      g_commands[MAX_TASKS];
+		static DWORD             g_task_counter = 0;
 
 		//Print Win32 error message
 		static void print_win32_error(const wchar_t *const format, const DWORD error)
@@ -1022,19 +7044,64 @@ namespace process
 			}
 		}
 
+		//Get process id of the task
+		static DWORD get_task_pid(const DWORD index)
+		{
+			switch (g_task_type[index])
+			{
+				case TASK_SHELL:  return shell::get_pid(index);
+				case TASK_WORKER: return coproc::get_pid(index);
+				case TASK_PIPELINE: return pipeline::get_pid(index);
+				case TASK_BUILTIN: return 0;
+				default:          return GetProcessId(g_processes[index]);
+			}
+		}
+
+		//Check whether the task has completed
+		static task_status_t poll_task(const DWORD index)
+		{
+			switch (g_task_type[index])
+			{
+				case TASK_SHELL:  return shell::poll_task(index);
+				case TASK_WORKER: return coproc::poll_task(index);
+				case TASK_PIPELINE: return pipeline::poll_task(index, g_processes[index]);
+				default:          return TASK_COMPLETE;
+			}
+		}
+
 		//Release process handle
 		static bool release_process(const DWORD index, const bool cancelled)
 		{
 			assert(g_isrunning[index]);
+			reactor::unwatch(index);
 			DWORD exit_code = 1;
 			bool succeeded = false;
+			const DWORD pid = get_task_pid(index);
 
 			if (!cancelled)
 			{
-				if (GetExitCodeProcess(g_processes[index], &exit_code))
+				bool have_exit_code = true;
+				switch (g_task_type[index])
+				{
+				case TASK_SHELL:
+					exit_code = shell::get_exit_code(index);
+					break;
+				case TASK_WORKER:
+					exit_code = coproc::get_exit_code(index);
+					break;
+				case TASK_PIPELINE:
+					have_exit_code = pipeline::get_exit_code(index, exit_code);
+					break;
+				case TASK_BUILTIN:
+					exit_code = builtin::get_exit_code(index);
+					break;
+				default:
+					have_exit_code = (GetExitCodeProcess(g_processes[index], &exit_code) != FALSE);
+				}
+				if (have_exit_code)
 				{
-					PRINT_TRC(L"Process 0x%X terminated with exit code 0x%X.\n", GetProcessId(g_processes[index]), exit_code);
-					LOG(L"Process terminated: 0x%X (Exit code: 0x%X).\n", GetProcessId(g_processes[index]), exit_code);
+					PRINT_TRC(L"Process 0x%X terminated with exit code 0x%X.\n", pid, exit_code);
+					LOG(L"Process terminated: 0x%X (Exit code: 0x%X).\n", pid, exit_code);
 					if (!(succeeded = (exit_code == 0) || options::ignore_exitcode))
 					{
 						PRINT_ERR(L"\nERROR: The command has failed! (ExitCode: %u)\n\n", exit_code);
@@ -1043,37 +7110,151 @@ namespace process
 				else
 				{
 					exit_code = 1; /*just to be sure*/
-					PRINT_WRN(L"WARNING: Exit code for process 0x%X could not be determined.\n", GetProcessId(g_processes[index]));
-					LOG(L"Process terminated: 0x%X (Exit code N/A).\n", GetProcessId(g_processes[index]));
+					PRINT_WRN(L"WARNING: Exit code for process 0x%X could not be determined.\n", pid);
+					LOG(L"Process terminated: 0x%X (Exit code N/A).\n", pid);
+				}
+			}
+
+			if (results::enabled())
+			{
+				utils::process::stats_t stats;
+				if (g_task_type[index] != TASK_PROCESS)
+				{
+					memset(&stats, 0, sizeof(utils::process::stats_t));
+					stats.wall_time = (1000000ULL * (utils::sysinfo::get_timer_value() - g_start_time[index])) / utils::sysinfo::get_timer_frequency();
+					if (g_task_type[index] == TASK_PIPELINE)
+					{
+						pipeline::record_stages(index, g_task_ids[index], stats);
+					}
+				}
+				else
+				{
+					utils::process::get_process_stats(g_processes[index], stats);
+					if (g_task_jobs[index])
+					{
+						utils::process::get_job_stats(g_task_jobs[index], stats); /*include the child processes*/
+					}
 				}
+				results::record_task(g_task_ids[index], pid, cancelled ? L"killed" : (succeeded ? L"ok" : L"failed"), exit_code, stats, g_commands[index]);
+			}
+
+			metrics::task_finished(succeeded, utils::sysinfo::get_timer_value() - g_start_time[index]);
+			if (!cancelled)
+			{
+				batch::task_finished(index, utils::sysinfo::get_timer_value() - g_start_time[index]);
 			}
 
-			CLOSE_HANDLE(g_processes[index]);
+			if (g_task_type[index] == TASK_PROCESS)
+			{
+				CLOSE_HANDLE(g_processes[index]);
+				CLOSE_HANDLE(g_task_jobs[index]);
+			}
+			else if (g_task_type[index] == TASK_PIPELINE)
+			{
+				pipeline::release(index);
+			}
+			else if (g_task_type[index] == TASK_BUILTIN)
+			{
+				builtin::release(index);
+			}
+			if (piping::enabled())
+			{
+				piping::finish_feeder(g_feeders[index]);
+				piping::finish_output(g_sequence[index], g_outputs[index]);
+				g_outputs[index] = NULL;
+			}
 			g_processes[index] = NULL;
 			g_isrunning[index] = false;
+			g_task_type[index] = TASK_PROCESS;
+			g_commands[index].clear();
 
 			g_max_exit_code = std::max(g_max_exit_code, exit_code);
 			g_processes_active--;
+			jobserver::release_excess(g_processes_active);
 			g_processes_completed[succeeded ? 0 : 1]++;
+			if (!cancelled)
+			{
+				halt::update(succeeded, g_processes_completed[0], g_processes_completed[1], queue::g_queue_max);
+			}
 
 			return succeeded;
 		}
 
+		//Kill the process and all of its child processes, returns once they are actually gone
+		static void kill_process_tree(const DWORD index)
+		{
+			if (g_task_jobs[index] && utils::jobs::terminate_task_job(g_task_jobs[index], FATAL_EXIT_CODE, KILL_TIMEOUT))
+			{
+				return;
+			}
+			TerminateProcess(g_processes[index], FATAL_EXIT_CODE);
+			if (WaitForSingleObject(g_processes[index], KILL_TIMEOUT) != WAIT_OBJECT_0)
+			{
+				PRINT_WRN(L"WARNING: Process 0x%X did not terminate in time!\n\n", GetProcessId(g_processes[index]));
+			}
+		}
+
+		//Ask the running processes to exit (Ctrl+Break) and wait for the grace period
+		static void interrupt_running_processes(void)
+		{
+			DWORD count = 0;
+			HANDLE handles[MAX_TASKS];
+			for (DWORD i = 0; i < options::max_instances; i++)
+			{
+				if (g_isrunning[i])
+				{
+					const bool success = (g_task_type[i] == TASK_PIPELINE) ? pipeline::interrupt(i) : ((g_task_type[i] == TASK_PROCESS) && GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, GetProcessId(g_processes[i])));
+					if (success)
+					{
+						handles[count++] = g_processes[i];
+					}
+				}
+			}
+			if (count > 0)
+			{
+				PRINT_WRN(L"\nSent Ctrl+Break to %u running task(s), waiting up to %u ms for them to exit...\n\n", count, options::kill_grace);
+				LOG(L"Sent Ctrl+Break to %u task(s).\n", count);
+				WaitForMultipleObjects(count, handles, TRUE, options::kill_grace);
+			}
+		}
+
 		//Terminate all running processes
 		static void terminate_running_processes(void)
 		{
+			if ((options::kill_grace > 0) && (g_processes_active > 0))
+			{
+				interrupt_running_processes();
+			}
 			for (DWORD i = 0; i < options::max_instances; i++)
 			{
 				if (g_isrunning[i])
 				{
-					TerminateProcess(g_processes[i], FATAL_EXIT_CODE);
+					reactor::unwatch(i); /*the handles may be closed by kill()*/
+					switch (g_task_type[i])
+					{
+					case TASK_SHELL:
+						shell::kill(i);
+						break;
+					case TASK_WORKER:
+						coproc::kill(i);
+						break;
+					case TASK_PIPELINE:
+						pipeline::kill(i);
+						break;
+					case TASK_BUILTIN:
+						builtin::kill(i);
+						break;
+					default:
+						kill_process_tree(i);
+					}
 					release_process(i, true);
+					g_processes_killed++;
 				}
 			}
 		}
 
 		//Create redirection file
-		static HANDLE create_redirection_file(const wchar_t *const directory, const wchar_t *const command)
+		static HANDLE create_redirection_file(const wchar_t *const directory, const wchar_t *const command, std::wstring *const file_name_out = NULL)
 		{
 			const std::wstring file_name = utils::files::generate_unique_filename(directory, L".log");
 			if (!file_name.empty())
@@ -1091,6 +7272,10 @@ namespace process
 					WriteFile(handle, BOM, (DWORD)strlen(BOM), &written, NULL);
 					WriteFile(handle, command_utf8.c_str(), (DWORD)command_utf8.size(), &written, NULL);
 					WriteFile(handle, EOL, (DWORD)strlen(EOL), &written, NULL);
+					if (file_name_out)
+					{
+						*file_name_out = file_name;
+					}
 					return handle;
 				}
 			}
@@ -1114,15 +7299,206 @@ namespace process
 			return NULL;
 		}
 
+		//Find the next free slot
+		static DWORD find_free_slot(void)
+		{
+			static DWORD slot = 0;
+			do
+			{
+				slot = (slot + 1) % options::max_instances;
+			}
+			while(g_isrunning[slot]);
+			return slot;
+		}
+
+		//Assign a newly started task to the slot
+		static void register_task(const DWORD slot, const DWORD task_id, const HANDLE handle, const DWORD task_type, std::wstring &command)
+		{
+			g_processes_active++;
+			g_isrunning[slot] = true;
+			g_task_type[slot] = task_type;
+			g_processes[slot] = handle;
+			g_task_ids[slot] = task_id;
+			g_start_time[slot] = utils::sysinfo::get_timer_value();
+			g_commands[slot].swap(command);
+			batch::task_started(slot);
+			metrics::task_started();
+		}
+
+		//Open a file for native stdin/stdout/stderr redirection
+		static HANDLE open_std_file(const std::wstring &file_name, const bool output)
+		{
+			SECURITY_ATTRIBUTES sec_attrib;
+			memset(&sec_attrib, 0, sizeof(SECURITY_ATTRIBUTES));
+			sec_attrib.bInheritHandle = TRUE;
+			sec_attrib.nLength = sizeof(SECURITY_ATTRIBUTES);
+			const HANDLE handle = output
+				? CreateFileW(file_name.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &sec_attrib, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)
+				: CreateFileW(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, &sec_attrib, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (handle != INVALID_HANDLE_VALUE)
+			{
+				return handle;
+			}
+			print_win32_error(L"\nFailed to open file: %s\n\n", GetLastError());
+			PRINT_ERR(L"ERROR: File ``%s could not be opened!\n\n", file_name.c_str());
+			return NULL;
+		}
+
+		//Start the next command inside the persistent shell
+		static bool start_shell_task(const DWORD slot, const DWORD task_id, std::wstring &command)
+		{
+			std::wstring redir_file_name;
+			if (!options::redir_path_name.empty())
+			{
+				HANDLE redir_file = create_redirection_file(options::redir_path_name.c_str(), command.c_str(), &redir_file_name);
+				CLOSE_HANDLE(redir_file);
+			}
+
+			HANDLE wait_handle = NULL;
+			DWORD pid = 0;
+			if (shell::start_task(slot, command, redir_file_name, wait_handle, pid))
+			{
+				PRINT_EMP(L"%s\n\n", command.c_str());
+				LOG(L"Starting process in shell 0x%X: %s\n", pid, command.c_str());
+				register_task(slot, task_id, wait_handle, TASK_SHELL, command);
+				return true;
+			}
+
+			if (!redir_file_name.empty())
+			{
+				DeleteFileW(redir_file_name.c_str());
+			}
+			return false;
+		}
+
+		//Send the next item to a coprocess worker
+		static bool start_worker_task(const DWORD slot, const DWORD task_id, std::wstring &command, const DWORD retries)
+		{
+			HANDLE wait_handle = NULL;
+			DWORD pid = 0;
+			if (coproc::start_task(slot, command, wait_handle, pid))
+			{
+				PRINT_EMP(L"%s\n\n", command.c_str());
+				LOG(L"Sending item to worker 0x%X: %s\n", pid, command.c_str());
+				register_task(slot, task_id, wait_handle, TASK_WORKER, command);
+				g_retries[slot] = retries;
+				return true;
+			}
+
+			g_processes_completed[1]++;
+			metrics::spawn_failed();
+			if (results::enabled())
+			{
+				results::record_failed_task(task_id, command);
+			}
+			return false;
+		}
+
+		//Run a built-in command on the thread pool, its output goes to the stdout file or redirection file
+		static bool start_builtin_task(const DWORD slot, const DWORD task_id, task_t &task)
+		{
+			HANDLE output = NULL;
+			bool owns_output = true, handles_ready = true;
+			if (limits::enabled())
+			{
+				PRINT_ERR(L"ERROR: Built-in command ``%s can NOT run with per-task resource limits!\n\n", task.command.c_str());
+				handles_ready = false; /*runs inside of MParallel, so there is no job object to limit*/
+			}
+			else if (!task.stdout_file.empty())
+			{
+				handles_ready = ((output = open_std_file(task.stdout_file, true)) != NULL);
+			}
+			else if (!options::redir_path_name.empty())
+			{
+				output = create_redirection_file(options::redir_path_name.c_str(), task.command.c_str());
+			}
+			else if (!options::discard_textouts)
+			{
+				output = GetStdHandle(STD_OUTPUT_HANDLE);
+				owns_output = false;
+			}
+			if (output && owns_output)
+			{
+				SetHandleInformation(output, HANDLE_FLAG_INHERIT, 0); /*must not leak into the sub-processes*/
+			}
+
+			HANDLE wait_handle = NULL;
+			if (handles_ready && builtin::start_task(slot, task.command, output, owns_output, wait_handle))
+			{
+				PRINT_EMP(L"%s\n\n", task.command.c_str());
+				LOG(L"Starting built-in command: %s\n", task.command.c_str());
+				register_task(slot, task_id, wait_handle, TASK_BUILTIN, task.command);
+				return true;
+			}
+
+			if (owns_output)
+			{
+				CLOSE_HANDLE(output);
+			}
+			g_processes_completed[1]++;
+			metrics::spawn_failed();
+			if (results::enabled())
+			{
+				results::record_failed_task(task_id, task.command);
+			}
+			return false;
+		}
+
+		//Put the item of a lost worker back into the queue (only once)
+		static bool requeue_task(const DWORD index)
+		{
+			if (g_retries[index] > 0)
+			{
+				return false;
+			}
+			PRINT_WRN(L"WARNING: Re-queueing item ``%s of lost worker.\n\n", g_commands[index].c_str());
+			LOG(L"Re-queueing item: %s\n", g_commands[index].c_str());
+			reactor::unwatch(index);
+			task_t task;
+			queue::init_task(task, g_commands[index]);
+			task.retries = g_retries[index] + 1U; /*kept with the queue entry, so identical items have their own budget*/
+			queue::enqueue(task);
+			metrics::task_requeued();
+			g_processes[index] = NULL;
+			g_isrunning[index] = false;
+			g_task_type[index] = TASK_PROCESS;
+			g_commands[index].clear();
+			g_processes_active--;
+			jobserver::release_excess(g_processes_active);
+			return true;
+		}
+
 		//Start the next process
-		static bool start_next_process(std::wstring command)
+		static bool start_next_process(task_t &task, std::vector<char> *chunk = NULL, const DWORD sequence = 0)
 		{
+			std::wstring &command = task.command;
 			bool success = false;
-			if (options::force_use_shell)
+			const DWORD task_id = ++g_task_counter;
+			const DWORD slot = find_free_slot();
+			if ((!chunk) && (!options::coprocess_command.empty()))
+			{
+				return start_worker_task(slot, task_id, command, task.retries);
+			}
+			if ((!chunk) && builtin::is_builtin(command))
+			{
+				return start_builtin_task(slot, task_id, task);
+			}
+			if ((!chunk) && options::persistent_shell && (!queue::has_redirection(task)) && start_shell_task(slot, task_id, command))
+			{
+				return true;
+			}
+			std::vector<std::wstring> stages;
+			const bool use_pipeline = ((!options::force_use_shell) || options::auto_shell) && command::split_pipeline(command.c_str(), stages);
+			if (options::force_use_shell && (!use_pipeline) && ((!options::auto_shell) || command::requires_shell(command.c_str())))
 			{
 				std::wstringstream builder;
 				builder << L"cmd.exe /c \"" << command << L"\"";
 				command = builder.str();
+				g_shell_launches++;
+			}
+			else
+			{
+				g_direct_launches++;
 			}
 
 			PRINT_EMP(L"%s\n\n", command.c_str());
@@ -1152,13 +7528,81 @@ namespace process
 				}
 			}
 
+			HANDLE stdin_read = NULL, stdin_write = NULL, output_file = NULL, std_handles[3] = { NULL, NULL, NULL }, std_files[3] = { NULL, NULL, NULL };
+			bool handles_ready = true;
+			if (chunk)
+			{
+				if (!(handles_ready = piping::create_stdin_pipe(stdin_read, stdin_write)))
+				{
+					PRINT_WRN(L"WARNING: Failed to create the input pipe!\n\n");
+				}
+				else if (options::keep_order && (!redir_file) && task.stdout_file.empty())
+				{
+					output_file = piping::create_output_file();
+				}
+			}
+
+			const bool stderr_to_stdout = (!task.stderr_file.empty()) && (_wcsicmp(task.stderr_file.c_str(), task.stdout_file.c_str()) == 0);
+			if (handles_ready && (!chunk) && (!task.stdin_file.empty()))
+			{
+				handles_ready = ((std_files[0] = open_std_file(task.stdin_file, false)) != NULL);
+			}
+			if (handles_ready && (!task.stdout_file.empty()))
+			{
+				handles_ready = ((std_files[1] = open_std_file(task.stdout_file, true)) != NULL);
+			}
+			if (handles_ready && (!task.stderr_file.empty()) && (!stderr_to_stdout))
+			{
+				handles_ready = ((std_files[2] = open_std_file(task.stderr_file, true)) != NULL);
+			}
+
+			const bool have_std_files = (std_files[0] || std_files[1] || std_files[2]);
+			if (chunk || have_std_files || use_pipeline)
+			{
+				startup_info.dwFlags = startup_info.dwFlags | STARTF_USESTDHANDLES;
+				startup_info.hStdInput = chunk ? stdin_read : std_files[0];
+				if (std_files[1] || output_file)
+				{
+					startup_info.hStdOutput = std_files[1] ? std_files[1] : output_file;
+				}
+				if (std_files[2] || stderr_to_stdout)
+				{
+					startup_info.hStdError = stderr_to_stdout ? std_files[1] : std_files[2];
+				}
+				static const DWORD STD_IDS[3] = { STD_INPUT_HANDLE, STD_OUTPUT_HANDLE, STD_ERROR_HANDLE };
+				HANDLE *const targets[3] = { &startup_info.hStdInput, &startup_info.hStdOutput, &startup_info.hStdError };
+				for (DWORD i = 0; i < 3; i++)
+				{
+					if (!(*targets[i]))
+					{
+						*targets[i] = std_handles[i] = shell::impl::make_inheritable(GetStdHandle(STD_IDS[i]));
+					}
+				}
+			}
+
 			DWORD flags = CREATE_BREAKAWAY_FROM_JOB | CREATE_SUSPENDED | CREATE_UNICODE_ENVIRONMENT | priority::get_priority_class(options::process_priority);
 			if (options::detached_console)
 			{
 				flags = flags | CREATE_NEW_CONSOLE;
 			}
+			else if (options::kill_grace > 0)
+			{
+				flags = flags | CREATE_NEW_PROCESS_GROUP; /*required for Ctrl+Break*/
+			}
 	
-			if (CreateProcessW(NULL, (LPWSTR)command.c_str(), NULL, NULL, (redir_file ? TRUE : FALSE), flags, NULL, NULL, &startup_info, &process_info))
+			if (handles_ready && use_pipeline)
+			{
+				HANDLE wait_handle = NULL;
+				DWORD pid = 0;
+				if (pipeline::start_task(slot, stages, startup_info, flags, wait_handle, pid))
+				{
+					PRINT_TRC(L"Pipeline of %u processes has been started.\n\n", DWORD(stages.size()));
+					LOG(L"Pipeline started: 0x%X (%u stages)\n", pid, DWORD(stages.size()));
+					register_task(slot, task_id, wait_handle, TASK_PIPELINE, command);
+					success = true;
+				}
+			}
+			else if (handles_ready && CreateProcessW(NULL, (LPWSTR)command.c_str(), NULL, NULL, ((redir_file || chunk || have_std_files) ? TRUE : FALSE), flags, NULL, NULL, &startup_info, &process_info))
 			{
 				if (!options::disable_jobctrl)
 				{
@@ -1166,31 +7610,26 @@ namespace process
 					{
 						PRINT_WRN(L"WARNING: Failed to assign process to job object!\n\n");
 					}
+					g_task_jobs[slot] = utils::jobs::create_task_job(process_info.hProcess);
+					limits::apply(g_task_jobs[slot]);
 				}
 				if (ResumeThread(process_info.hThread))
 				{
 					PRINT_TRC(L"Process 0x%X has been started.\n\n", process_info.dwProcessId);
 					LOG(L"Process started: 0x%X\n", process_info.dwProcessId);
-					static DWORD slot = 0;
-					do
-					{
-						slot = (slot + 1) % options::max_instances;
-					}
-					while(g_isrunning[slot]);
-					g_processes_active++;
-					g_isrunning[slot] = true;
-					g_processes[slot] = process_info.hProcess;
+					register_task(slot, task_id, process_info.hProcess, TASK_PROCESS, command);
 					success = true;
 				}
 				else
 				{
 					TerminateProcess(process_info.hProcess, 666);
 					CLOSE_HANDLE(process_info.hProcess);
+					CLOSE_HANDLE(g_task_jobs[slot]);
 					PRINT_ERR(L"ERROR: Failed to resume the process -> terminating!\n\n");
 				}
 				CLOSE_HANDLE(process_info.hThread);
 			}
-			else
+			else if (handles_ready)
 			{
 				const DWORD error = GetLastError();
 				PRINT_TRC(L"CreateProcessW() failed with Win32 error code: 0x%X.\n\n", error);
@@ -1199,54 +7638,167 @@ namespace process
 				LOG(L"Process creation failed! (Error  0x%X)\n", error);
 			}
 
+			if (success && chunk)
+			{
+				g_feeders[slot] = piping::start_feeder(stdin_write, chunk);
+				g_outputs[slot] = output_file;
+				g_sequence[slot] = sequence;
+				stdin_write = output_file = NULL;
+				chunk = NULL;
+			}
+
 			if(!success)
 			{
 				g_processes_completed[1]++;
+				metrics::spawn_failed();
+				if (results::enabled())
+				{
+					results::record_failed_task(task_id, command);
+				}
+			}
+
+			if (chunk)
+			{
+				delete chunk;
+				piping::finish_output(sequence, output_file); /*keep the output order intact*/
+				output_file = NULL;
 			}
 
+			for (DWORD i = 0; i < 3; i++)
+			{
+				CLOSE_HANDLE(std_files[i]);
+				CLOSE_HANDLE(std_handles[i]);
+			}
+			CLOSE_HANDLE(stdin_read);
+			CLOSE_HANDLE(stdin_write);
 			CLOSE_HANDLE(redir_file);
 			return success;
 		}
 
+		//Start the next process for the next chunk of input
+		static bool start_next_chunk(void)
+		{
+			DWORD sequence = 0;
+			std::vector<char> *const chunk = piping::read_chunk(sequence);
+			if (!chunk)
+			{
+				return true; /*no input available right now*/
+			}
+			queue::g_queue_max++; /*total is not known in advance*/
+			task_t task;
+			queue::init_task(task, piping::get_command());
+			return start_next_process(task, chunk, sequence);
+		}
+
+		//Are there any tasks left to be started?
+		static inline bool have_more_tasks(void)
+		{
+			return batch::have_more() || queue::have_more() || piping::have_more() || generator::have_more() || walker::have_more();
+		}
+
+		//Can the next task be started right now?
+		static inline bool task_ready(void)
+		{
+			return batch::have_more() || queue::have_more() || piping::ready() || generator::have_more() || walker::ready();
+		}
+
+		//Take the next task from the queue, then from the input generators or the directory walker
+		static void next_task(task_t &task)
+		{
+			if (batch::enabled())
+			{
+				batch::next_task(task);
+			}
+			else if (queue::have_more())
+			{
+				queue::dequeue(task);
+			}
+			else if (generator::have_more())
+			{
+				generator::next_task(task);
+			}
+			else
+			{
+				queue::g_queue_max++; /*total is not known in advance*/
+				walker::next_task(task);
+			}
+		}
+
+		//Start the next process for the next task
+		static bool start_next_task(void)
+		{
+			task_t task;
+			next_task(task);
+			return start_next_process(task);
+		}
+
 		//Wait for *any* running process to terminate
-		static DWORD wait_for_process(bool &timeout, bool &interrupted)
+		static DWORD wait_for_process(bool &timeout, bool &interrupted, const bool want_token, bool &token, const bool want_input, bool &input)
 		{
-			DWORD index[MAX_TASKS];
-			HANDLE handles[MAX_TASKS+1];
-	
+			//Watch all running tasks (the watch is kept until the task signals or is released)
 			DWORD count = 0;
 			for (DWORD i = 0; i < options::max_instances; i++)
 			{
 				if (g_isrunning[i])
 				{
-					index[count] = i;
-					handles[count++] = g_processes[i];
+					reactor::watch(i, g_processes[i]);
+					count++;
 				}
 			}
 
+			if ((count < 1) && (!want_input))
+			{
+				PRINT_ERR(L"INTERNAL ERROR: No runnings processes to be awaited!\n\n");
+				abort();
+			}
+
 			if (error::impl::g_interrupt_event)
 			{
-				handles[count] = error::impl::g_interrupt_event;
+				reactor::watch(reactor::SOURCE_INTERRUPT, error::impl::g_interrupt_event);
 			}
 
-			if (count < 1)
+			//Also wait for a jobserver token, if we are still below the limit
+			if (want_token && jobserver::enabled())
 			{
-				PRINT_ERR(L"INTERNAL ERROR: No runnings processes to be awaited!\n\n");
-				abort();
+				reactor::watch(reactor::SOURCE_TOKEN, jobserver::get_handle());
+			}
+
+			//Also wait for new files from the directory walker (or new chunks of the input), if we have nothing to start
+			if (want_input)
+			{
+				reactor::watch(reactor::SOURCE_INPUT, piping::enabled() ? piping::get_handle() : walker::get_handle());
 			}
 
-			const DWORD num_handels = error::impl::g_interrupt_event ? (count + 1) : count;
-			const DWORD ret = WaitForMultipleObjects(num_handels, &handles[0], FALSE, (options::process_timeout > 0) ? options::process_timeout : INFINITE);
-			if ((ret >= WAIT_OBJECT_0) && (ret < WAIT_OBJECT_0 + count))
+			DWORD source = MAXDWORD;
+			const DWORD ret = reactor::wait(((options::process_timeout > 0) && (count > 0)) ? options::process_timeout : INFINITE, source);
+			if (ret == WAIT_OBJECT_0)
 			{
-				return index[ret - WAIT_OBJECT_0];
+				switch (source)
+				{
+				case reactor::SOURCE_TOKEN:
+					token = true;
+					jobserver::token_acquired(); /*the token was taken by the wait*/
+					return MAXDWORD;
+				case reactor::SOURCE_INPUT:
+					input = true;
+					return MAXDWORD;
+				case reactor::SOURCE_INTERRUPT:
+					interrupted = true;
+					return MAXDWORD;
+				default:
+					if (g_isrunning[source])
+					{
+						return source;
+					}
+					input = true; /*nothing to do, just run the loop again*/
+					return MAXDWORD;
+				}
 			}
 
-			interrupted = (ret == WAIT_OBJECT_0 + count);
 			timeout = (ret == WAIT_TIMEOUT) && (options::process_timeout > 0);
-			if(interrupted || timeout)
+			if (!timeout)
 			{
-				PRINT_TRC(L"WaitForMultipleObjects() failed with Win32 error code: 0x%X.\\nn", GetLastError());
+				PRINT_TRC(L"GetQueuedCompletionStatus() failed with Win32 error code: 0x%X.\n", GetLastError());
 			}
 
 			return MAXDWORD;
@@ -1260,9 +7812,18 @@ namespace process
 		g_processes_completed[1] = 0;
 		g_max_exit_code = 0;
 		g_processes_active = 0;
+		g_direct_launches = g_shell_launches = 0;
+		g_processes_killed = 0;
 
 		memset(impl::g_processes, 0, sizeof(HANDLE) * MAX_TASKS);
+		memset(impl::g_task_jobs, 0, sizeof(HANDLE) * MAX_TASKS);
 		memset(impl::g_isrunning, 0, sizeof(bool)   * MAX_TASKS);
+		memset(impl::g_task_type, 0, sizeof(DWORD)  * MAX_TASKS);
+		memset(impl::g_feeders,   0, sizeof(piping::feeder_t*) * MAX_TASKS);
+		memset(impl::g_outputs,   0, sizeof(HANDLE) * MAX_TASKS);
+		memset(impl::g_retries,   0, sizeof(DWORD)  * MAX_TASKS);
+		memset(impl::g_task_ids,  0, sizeof(DWORD)  * MAX_TASKS);
+		impl::g_task_counter = 0;
 	}
 
 	//Run all processes
@@ -1273,12 +7834,14 @@ namespace process
 
 		//Initialize the progress string
 		UPDATE_PROGRESS();
+		ULONGLONG loop_start = utils::sysinfo::get_timer_value();
 
 		//MAIN PROCESSING LOOP
-		while (!(((!queue::have_more()) && (g_processes_active < 1)) || aborted || interrupted))
+		while (!((((!impl::have_more_tasks()) || halt::triggered()) && (g_processes_active < 1)) || aborted || interrupted))
 		{
 			//Launch the next process(es)
-			while (queue::have_more() && (g_processes_active < options::max_instances))
+			bool no_token = false, no_task = false;
+			while (impl::have_more_tasks() && (g_processes_active < options::max_instances) && (!halt::triggered()))
 			{
 				if (error::interrupted())
 				{
@@ -1286,10 +7849,21 @@ namespace process
 					interrupted = aborted = true;
 					break;
 				}
-				if (!impl::start_next_process(queue::dequeue()))
+				if (!impl::task_ready())
+				{
+					no_task = true;
+					break;
+				}
+				if (!jobserver::try_acquire(g_processes_active))
 				{
+					no_token = true;
+					break;
+				}
+				if (!(piping::enabled() ? impl::start_next_chunk() : impl::start_next_task()))
+				{
+					jobserver::release_excess(g_processes_active);
 					g_max_exit_code = std::max(g_max_exit_code, DWORD(1));
-					if (options::abort_on_failure)
+					if (options::abort_on_failure || (halt::update(false, g_processes_completed[0], g_processes_completed[1], queue::g_queue_max) && halt::kill_running()))
 					{
 						aborted = true;
 						break;
@@ -1299,12 +7873,23 @@ namespace process
 			}
 
 			//Wait for one process to terminate
-			if ((!aborted) && (g_processes_active > 0) && ((g_processes_active >= options::max_instances) || (!queue::have_more())))
+			if ((!aborted) && ((g_processes_active > 0) || no_task) && ((g_processes_active >= options::max_instances) || (!impl::have_more_tasks()) || halt::triggered() || no_token || no_task))
 			{
-				bool timeout = false;
-				const DWORD index = impl::wait_for_process(timeout, interrupted);
+				bool timeout = false, token = false, input = false;
+				metrics::scheduler_loop(utils::sysinfo::get_timer_value() - loop_start);
+				const DWORD index = impl::wait_for_process(timeout, interrupted, no_token, token, no_task, input);
+				loop_start = utils::sysinfo::get_timer_value();
+				if (token || input)
+				{
+					continue;
+				}
 				if (index != MAXDWORD)
 				{
+					const task_status_t status = impl::poll_task(index);
+					if ((status == TASK_PENDING) || ((status == TASK_LOST) && impl::requeue_task(index)))
+					{
+						continue;
+					}
 					if (!impl::release_process(index, false))
 					{
 						if (options::abort_on_failure)
@@ -1313,12 +7898,18 @@ namespace process
 							break;
 						}
 					}
+					if (halt::kill_running())
+					{
+						aborted = true;
+						break;
+					}
 				}
 				else
 				{
 					g_max_exit_code = std::max(g_max_exit_code, DWORD(1));
 					if (timeout)
 					{
+						metrics::timeout();
 						PRINT_ERR(L"\nERROR: Timeout encountered, terminating running process!\n\n");
 						if (options::abort_on_failure)
 						{
@@ -1353,6 +7944,16 @@ namespace process
 		//Terminate all processes still running at this point
 		impl::terminate_running_processes();
 		assert(process::g_processes_active < 1);
+
+		//Stop the event loop, keep the jobserver tokens that were taken in the meantime
+		DWORD source = MAXDWORD;
+		while (reactor::shutdown(source))
+		{
+			if (source == reactor::SOURCE_TOKEN)
+			{
+				jobserver::token_acquired();
+			}
+		}
 	}
 }
 
@@ -1398,6 +7999,20 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		return EXIT_SUCCESS;
 	}
 
+	//Run queue benchmark?
+	if (options::bench_queue_count > 0)
+	{
+		queue::benchmark(options::bench_queue_count);
+		return EXIT_SUCCESS;
+	}
+
+	//Run parser benchmark?
+	if (options::bench_parse_count > 0)
+	{
+		bench::run(options::bench_parse_count);
+		return EXIT_SUCCESS;
+	}
+
 	//Setup console icon and title text
 	if (!options::disable_outputs)
 	{
@@ -1424,6 +8039,15 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		logging::open_log_file(options::log_file_name.c_str());
 	}
 
+	//Setup resource accounting
+	results::initialize();
+
+	//Start metrics exporter
+	metrics::initialize();
+
+	//Setup GNU make jobserver
+	jobserver::initialize();
+
 	//Parse jobs from file
 	if (!options::input_file_name.empty())
 	{
@@ -1434,6 +8058,18 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		}
 	}
 
+	//Setup pipe mode
+	if (piping::enabled() && (!piping::initialize()))
+	{
+		return FATAL_EXIT_CODE;
+	}
+
+	//Partition input file
+	if (partition::enabled() && (!partition::generate_tasks()))
+	{
+		return FATAL_EXIT_CODE;
+	}
+
 	//Parse jobs from STDIN
 	if (options::read_stdin_lines)
 	{
@@ -1441,10 +8077,38 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		options::parse_commands_file(stdin);
 	}
 
+	//Enqueue the deferred unique tasks
+	queue::finalize();
+	shard::print_stats();
+
+	//Setup input generators
+	if (generator::enabled())
+	{
+		if (!generator::initialize())
+		{
+			return FATAL_EXIT_CODE;
+		}
+		queue::g_queue_max = DWORD(std::min(ULONGLONG(MAXDWORD), ULONGLONG(queue::g_queue_max) + generator::total()));
+	}
+
+	//Start directory walker
+	if (walker::enabled() && (!walker::start()))
+	{
+		return FATAL_EXIT_CODE;
+	}
+
+	//Setup argument batching
+	if (batch::enabled())
+	{
+		batch::initialize();
+	}
+
 	//Valid queue?
-	if (!queue::have_more())
+	if ((!queue::have_more()) && (!piping::have_more()) && (!generator::have_more()) && (!walker::have_more()))
 	{
 		PRINT_WRN(L"Nothing to do. Run with option \"--help\" for guidance!\n\n");
+		walker::stop();
+		piping::stop();
 		return FATAL_EXIT_CODE;
 	}
 
@@ -1456,9 +8120,15 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		PRINT_NFO(L"\nMParallel v%u.%u.%u [%S]\n\n", MPARALLEL_VERSION_MAJOR, MPARALLEL_VERSION_MINOR, MPARALLEL_VERSION_PATCH, __DATE__);
 	}
 
+	//Console output is written asynchronously from now on
+	if (!options::disable_outputs)
+	{
+		utils::console::start_async_output();
+	}
+
 	//Logging
-	LOG(L"Enqueued tasks: %u (Parallel instances: %u)\n", queue::impl::g_queue.size(), options::max_instances);
-	PRINT_TRC(L"Tasks in queue: %u\n", queue::impl::g_queue.size());
+	LOG(L"Enqueued tasks: %u (Parallel instances: %u)\n", queue::size(), options::max_instances);
+	PRINT_TRC(L"Tasks in queue: %u\n", queue::size());
 	PRINT_TRC(L"Maximum parallel instances: %u\n", options::max_instances);
 	
 	//Run processes
@@ -1468,6 +8138,7 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 
 	//Compute total time
 	const double total_time = double(timestamp_leave - timestamp_enter) / double(CLOCKS_PER_SEC);
+	const DWORD tasks_skipped = queue::size() + generator::remaining() + (batch::have_more() ? 1U : 0U);
 	PRINT_NFO(L"\n--------\n\n");
 	if ((process::g_processes_completed[0] > 0) && (process::g_processes_completed[1] < 1))
 	{
@@ -1475,9 +8146,9 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 	}
 	else
 	{
-		if(queue::impl::g_queue.size() > 0)
+		if(tasks_skipped > 0)
 		{
-			PRINT_WRN(L"Executed %u task(s) in %.2f seconds, %u task(s) failed, %u tasks skipped!\n\n", queue::g_queue_max, total_time, process::g_processes_completed[1], queue::impl::g_queue.size());
+			PRINT_WRN(L"Executed %u task(s) in %.2f seconds, %u task(s) failed, %u tasks skipped!\n\n", queue::g_queue_max, total_time, process::g_processes_completed[1], tasks_skipped);
 		}
 		else
 		{
@@ -1485,8 +8156,36 @@ static int mparallel_main(const int argc, const wchar_t *const argv[])
 		}
 	}
 
+	//Halting policy
+	if (halt::triggered())
+	{
+		PRINT_WRN(L"Halted because %s: %u task(s) not started, %u running task(s) killed%s.\n\n", halt::reason(), tasks_skipped, process::g_processes_killed, walker::have_more() ? L", directory walk stopped" : L"");
+		LOG(L"Halted: %s (Tasks not started/killed: %u/%u)\n", halt::reason(), tasks_skipped, process::g_processes_killed);
+	}
+
+	//Stop directory walker and input reader
+	walker::stop();
+	piping::stop();
+
+	//Shell usage
+	if (options::auto_shell)
+	{
+		PRINT_NFO(L"Launched %u task(s) directly and %u task(s) via sub-shell.\n\n", process::g_direct_launches, process::g_shell_launches);
+		LOG(L"Launches: direct=%u, shell=%u\n", process::g_direct_launches, process::g_shell_launches);
+	}
+
+	//De-duplication
+	if (options::unique_tasks)
+	{
+		PRINT_NFO(L"Dropped %u duplicate task(s).\n\n", dedup::dropped());
+		LOG(L"Duplicate tasks dropped: %u\n", dedup::dropped());
+	}
+
+	//Resource usage summary
+	results::print_summary();
+
 	//Logging
-	LOG(L"Total execution time: %.2f seconds (Tasks completed/failed/skipped: %u/%u/%u)\n", total_time, process::g_processes_completed[0], process::g_processes_completed[1], queue::impl::g_queue.size());
+	LOG(L"Total execution time: %.2f seconds (Tasks completed/failed/skipped: %u/%u/%u)\n", total_time, process::g_processes_completed[0], process::g_processes_completed[1], tasks_skipped);
 
 	//Notification
 	if(options::enable_notifysnd && (!error::interrupted()))
@@ -33,9 +33,14 @@
 #include <iomanip>
 #include <codecvt>
 #include <cstdarg>
+#include <cwctype>
+#include <vector>
+#include <process.h>
 
 //Win32
 #include <Shellapi.h>
+#include <Psapi.h>
+#include <WinCrypt.h>
 
 //MSVC compat
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
@@ -97,6 +102,36 @@ namespace utils
 			}
 			return false;
 		}
+
+		//High-resolution timer value
+		ULONGLONG get_timer_value(void)
+		{
+			LARGE_INTEGER counter;
+			if (QueryPerformanceCounter(&counter))
+			{
+				return counter.QuadPart;
+			}
+			return 0;
+		}
+
+		//High-resolution timer frequency
+		ULONGLONG get_timer_frequency(void)
+		{
+			static ULONGLONG s_frequency = 0;
+			if (!s_frequency)
+			{
+				LARGE_INTEGER frequency;
+				if (QueryPerformanceFrequency(&frequency) && (frequency.QuadPart > 0))
+				{
+					s_frequency = frequency.QuadPart;
+				}
+				else
+				{
+					return 1; /*avoid division by zero*/
+				}
+			}
+			return s_frequency;
+		}
 	}
 }
 
@@ -194,6 +229,129 @@ namespace utils
 					SetConsoleTitleW(g_console_backup_title);
 				}
 			}
+
+			//Pending output
+			typedef struct _output_t
+			{
+				UINT type;
+				bool colors;
+				std::wstring text;
+			}
+			output_t;
+
+			//Asynchronous output
+			static const size_t MAX_PENDING_CHARS = 65536U;
+			static CRITICAL_SECTION      g_output_lock;
+			static HANDLE                g_output_event  = NULL;
+			static HANDLE                g_output_thread = NULL;
+			static bool                  g_output_active = false;
+			static bool                  g_output_stop   = false;
+			static std::vector<output_t> g_output_pending;
+			static size_t                g_output_chars  = 0;
+			static DWORD                 g_output_suppressed = 0;
+
+			//Write text to console (synchronously)
+			static void write_text(const UINT type, const bool colors, const wchar_t *const text)
+			{
+				if ((type < 0x5) && colors && _isatty(_fileno(stderr)))
+				{
+					if(const HANDLE console = HANDLE(_get_osfhandle(_fileno(stderr))))
+					{
+						const WORD original_attribs = set_console_color(console, type);
+						fputws(text, stderr);
+						fflush(stderr);
+						SetConsoleTextAttribute(console, original_attribs);
+					}
+				}
+				else
+				{
+					fputws(text, stderr);
+					fflush(stderr);
+				}
+			}
+
+			//Output writer thread
+			static unsigned __stdcall output_thread(void*)
+			{
+				std::vector<output_t> batch;
+				std::wstring buffer;
+				for (;;)
+				{
+					WaitForSingleObject(g_output_event, INFINITE);
+					DWORD suppressed;
+					bool stop;
+					EnterCriticalSection(&g_output_lock);
+					batch.swap(g_output_pending);
+					g_output_chars = 0;
+					suppressed = g_output_suppressed;
+					g_output_suppressed = 0;
+					stop = g_output_stop;
+					LeaveCriticalSection(&g_output_lock);
+					size_t i = 0;
+					while (i < batch.size())
+					{
+						buffer.clear();
+						const UINT type = batch[i].type;
+						const bool colors = batch[i].colors;
+						while ((i < batch.size()) && (batch[i].type == type) && (batch[i].colors == colors))
+						{
+							buffer.append(batch[i++].text); /*coalesce*/
+						}
+						write_text(type, colors, buffer.c_str());
+					}
+					if (suppressed > 0)
+					{
+						wchar_t notice[128]; /*g_scratch_buffer belongs to the main thread*/
+						_snwprintf_s(notice, 128, _TRUNCATE, L"[Console is too slow, %u message(s) have been suppressed]\n\n", suppressed);
+						write_text(0x1, (!batch.empty()) && batch.back().colors, notice);
+					}
+					batch.clear();
+					if (stop)
+					{
+						break;
+					}
+				}
+				return 0;
+			}
+		}
+
+		//Start asynchronous console output
+		bool start_async_output(void)
+		{
+			if (!impl::g_output_thread)
+			{
+				InitializeCriticalSection(&impl::g_output_lock);
+				if (impl::g_output_event = CreateEventW(NULL, FALSE, FALSE, NULL))
+				{
+					impl::g_output_stop = false;
+					if (impl::g_output_thread = (HANDLE)_beginthreadex(NULL, 0, impl::output_thread, NULL, 0, NULL))
+					{
+						impl::g_output_active = true;
+						atexit(stop_async_output);
+						return true;
+					}
+					CLOSE_HANDLE(impl::g_output_event);
+				}
+				DeleteCriticalSection(&impl::g_output_lock);
+				return false;
+			}
+			return true;
+		}
+
+		//Stop asynchronous console output (flushes all pending output)
+		void stop_async_output(void)
+		{
+			if (impl::g_output_thread)
+			{
+				EnterCriticalSection(&impl::g_output_lock);
+				impl::g_output_active = false;
+				impl::g_output_stop = true;
+				LeaveCriticalSection(&impl::g_output_lock);
+				SetEvent(impl::g_output_event);
+				WaitForSingleObject(impl::g_output_thread, INFINITE);
+				CLOSE_HANDLE(impl::g_output_thread);
+				CLOSE_HANDLE(impl::g_output_event);
+			}
 		}
 
 		//Set the console title
@@ -260,8 +418,45 @@ namespace utils
 		}
 
 		//Write text to console
-		void write_console(const UINT type, const bool colors, const wchar_t *const fmt, va_list &args)
+		void write_console(const UINT type, const bool colors, const wchar_t *const fmt, va_list &args, const bool droppable)
 		{
+			if (impl::g_output_thread)
+			{
+				const int len = _vscwprintf(fmt, args); /*MSVC: va_list can be passed by value multiple times*/
+				if (len > 0)
+				{
+					impl::output_t output;
+					output.type = type;
+					output.colors = colors;
+					output.text.resize(size_t(len) + 1U);
+					if (_vsnwprintf_s(&output.text[0], output.text.size(), _TRUNCATE, fmt, args) >= 0)
+					{
+						output.text.resize(size_t(len));
+						EnterCriticalSection(&impl::g_output_lock);
+						if (impl::g_output_active)
+						{
+							if (droppable && (impl::g_output_chars > impl::MAX_PENDING_CHARS))
+							{
+								impl::g_output_suppressed++; /*writer can't keep up*/
+							}
+							else
+							{
+								impl::g_output_chars += output.text.size();
+								impl::g_output_pending.push_back(impl::output_t());
+								impl::g_output_pending.back().type = type;
+								impl::g_output_pending.back().colors = colors;
+								impl::g_output_pending.back().text.swap(output.text);
+							}
+							LeaveCriticalSection(&impl::g_output_lock);
+							SetEvent(impl::g_output_event);
+							return;
+						}
+						LeaveCriticalSection(&impl::g_output_lock);
+						impl::write_text(type, colors, output.text.c_str());
+					}
+				}
+				return;
+			}
 
 			if ((type < 0x5) && colors && _isatty(_fileno(stderr)))
 			{
@@ -301,6 +496,25 @@ namespace utils
 			return true;
 		}
 
+		//Parse size with optional K, M or G suffix
+		bool parse_size(const wchar_t *const str, ULONGLONG &value)
+		{
+			wchar_t suffix[2] = { L'\0', L'\0' };
+			if (swscanf_s(str, L"%I64u%1c", &value, suffix, 2) < 1)
+			{
+				return false;  /*invalid*/
+			}
+			switch (towupper(suffix[0]))
+			{
+				case L'\0': break;
+				case L'K':  value <<= 10; break;
+				case L'M':  value <<= 20; break;
+				case L'G':  value <<= 30; break;
+				default:    return false; /*invalid*/
+			}
+			return true;
+		}
+
 		//Parse boolean
 		bool parse_bool(const wchar_t *const str, bool &value)
 		{
@@ -377,6 +591,100 @@ namespace utils
 			std::wstring_convert<std::codecvt_utf8<wchar_t>> myconv;
 			return myconv.to_bytes(str);
 		}
+
+		//Append wide string to UTF-8 buffer
+		void append_utf8(std::string &out, const wchar_t *const str, const size_t len)
+		{
+			if (len > 0)
+			{
+				const int required = WideCharToMultiByte(CP_UTF8, 0, str, int(len), NULL, 0, NULL, NULL);
+				if (required > 0)
+				{
+					const size_t offset = out.size();
+					out.resize(offset + size_t(required));
+					WideCharToMultiByte(CP_UTF8, 0, str, int(len), &out[offset], required, NULL, NULL);
+				}
+			}
+		}
+
+		//Encode wide string as WTF-8 into the buffer (3 bytes per char always suffice)
+		//Unlike CP_UTF8, unpaired surrogates are encoded as-is, so that any file name survives the round trip
+		size_t encode_utf8(const wchar_t *const str, const size_t len, char *const buffer, const size_t capacity)
+		{
+			unsigned char *const out = (unsigned char*)buffer;
+			size_t pos = 0;
+			for (size_t i = 0; i < len; i++)
+			{
+				DWORD c = DWORD(str[i]);
+				if ((c >= 0xD800) && (c <= 0xDBFF) && (i + 1U < len) && (DWORD(str[i + 1U]) >= 0xDC00) && (DWORD(str[i + 1U]) <= 0xDFFF))
+				{
+					c = 0x10000 + ((c - 0xD800) << 10) + (DWORD(str[++i]) - 0xDC00);
+				}
+				const size_t size = (c < 0x80) ? 1U : ((c < 0x800) ? 2U : ((c < 0x10000) ? 3U : 4U));
+				if (pos + size > capacity)
+				{
+					break;
+				}
+				switch (size)
+				{
+				case 1U:
+					out[pos++] = (unsigned char)c;
+					break;
+				case 2U:
+					out[pos++] = (unsigned char)(0xC0 | (c >> 6));
+					out[pos++] = (unsigned char)(0x80 | (c & 0x3F));
+					break;
+				case 3U:
+					out[pos++] = (unsigned char)(0xE0 | (c >> 12));
+					out[pos++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+					out[pos++] = (unsigned char)(0x80 | (c & 0x3F));
+					break;
+				default:
+					out[pos++] = (unsigned char)(0xF0 | (c >> 18));
+					out[pos++] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+					out[pos++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+					out[pos++] = (unsigned char)(0x80 | (c & 0x3F));
+					break;
+				}
+			}
+			return pos;
+		}
+
+		//Decode WTF-8 buffer to wide string (never needs more chars than bytes), malformed bytes become U+FFFD
+		void decode_utf8(std::wstring &out, const char *const str, const size_t len)
+		{
+			const unsigned char *const in = (const unsigned char*)str;
+			out.resize(len);
+			size_t pos = 0;
+			for (size_t i = 0; i < len; )
+			{
+				const DWORD lead = in[i];
+				const size_t size = (lead < 0x80) ? 1U : ((lead < 0xC2) ? 0U : ((lead < 0xE0) ? 2U : ((lead < 0xF0) ? 3U : ((lead < 0xF5) ? 4U : 0U))));
+				DWORD c = (size > 1U) ? (lead & (0xFF >> (size + 1U))) : lead;
+				size_t k = 1U;
+				while ((k < size) && (i + k < len) && ((in[i + k] & 0xC0) == 0x80))
+				{
+					c = (c << 6) | (in[i + k++] & 0x3F);
+				}
+				if ((size < 1U) || (k < size) || ((size == 3U) && (c < 0x800)) || ((size == 4U) && ((c < 0x10000) || (c > 0x10FFFF))))
+				{
+					out[pos++] = L'\xFFFD';
+					i += std::max(k, size_t(1U));
+					continue;
+				}
+				if (c >= 0x10000)
+				{
+					out[pos++] = wchar_t(0xD800 + ((c - 0x10000) >> 10));
+					out[pos++] = wchar_t(0xDC00 + ((c - 0x10000) & 0x3FF));
+				}
+				else
+				{
+					out[pos++] = wchar_t(c);
+				}
+				i += size;
+			}
+			out.resize(pos);
+		}
 	}
 }
 
@@ -392,6 +700,33 @@ namespace utils
 		{
 			static HANDLE g_job_object = NULL;
 
+			//I/O rate control, requires Windows 10 (not declared in older SDKs)
+			typedef struct _io_rate_control_t
+			{
+				LONGLONG       max_iops;
+				LONGLONG       max_bandwidth;
+				LONGLONG       reservation_iops;
+				const wchar_t *volume_name;
+				DWORD          base_io_size;
+				DWORD          control_flags;
+			}
+			io_rate_control_t;
+
+			typedef DWORD (WINAPI *set_io_rate_control_t)(HANDLE, io_rate_control_t*);
+			static const DWORD IO_RATE_CONTROL_ENABLE = 0x1;
+
+			//CPU rate control, requires Windows 8 (not declared in older SDKs)
+			typedef struct _cpu_rate_control_t
+			{
+				DWORD control_flags;
+				DWORD cpu_rate;
+			}
+			cpu_rate_control_t;
+
+			static const JOBOBJECTINFOCLASS CPU_RATE_CONTROL_INFORMATION = JOBOBJECTINFOCLASS(15);
+			static const DWORD CPU_RATE_CONTROL_ENABLE   = 0x1;
+			static const DWORD CPU_RATE_CONTROL_HARD_CAP = 0x4;
+
 			//Release job object
 			static void release_job_object(void)
 			{
@@ -440,6 +775,207 @@ namespace utils
 			}
 			return false;
 		}
+
+		//Create a job object for a single task, nested into the global job object (requires Windows 8 or later)
+		HANDLE create_task_job(const HANDLE process)
+		{
+			if (const HANDLE job_object = CreateJobObjectW(NULL, NULL))
+			{
+				if (add_to_task_job(job_object, process))
+				{
+					return job_object;
+				}
+				CloseHandle(job_object);
+			}
+			return NULL;
+		}
+
+		//Add a further process to the job object of a task
+		bool add_to_task_job(const HANDLE job, const HANDLE process)
+		{
+			return job && (AssignProcessToJobObject(job, process) != FALSE);
+		}
+
+		//Get the number of processes still running in the job object
+		DWORD get_active_processes(const HANDLE job)
+		{
+			JOBOBJECT_BASIC_ACCOUNTING_INFORMATION info;
+			memset(&info, 0, sizeof(JOBOBJECT_BASIC_ACCOUNTING_INFORMATION));
+			if (QueryInformationJobObject(job, JobObjectBasicAccountingInformation, &info, sizeof(JOBOBJECT_BASIC_ACCOUNTING_INFORMATION), NULL))
+			{
+				return info.ActiveProcesses;
+			}
+			return 0;
+		}
+
+		//Apply the resource limits to the job object of a task, must be called before the process is resumed
+		bool set_task_limits(const HANDLE job, const limits_t &limits)
+		{
+			bool success = true;
+			if (limits.memory > 0U)
+			{
+				JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobExtendedLimitInfo;
+				memset(&jobExtendedLimitInfo, 0, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION));
+				jobExtendedLimitInfo.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_JOB_MEMORY;
+				jobExtendedLimitInfo.JobMemoryLimit = SIZE_T(std::min(limits.memory, ULONGLONG(SIZE_T(-1))));
+				success = (SetInformationJobObject(job, JobObjectExtendedLimitInformation, &jobExtendedLimitInfo, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION)) != FALSE) && success;
+			}
+			if (limits.cpu_rate > 0U)
+			{
+				impl::cpu_rate_control_t cpuRateInfo;
+				memset(&cpuRateInfo, 0, sizeof(impl::cpu_rate_control_t));
+				cpuRateInfo.control_flags = impl::CPU_RATE_CONTROL_ENABLE | impl::CPU_RATE_CONTROL_HARD_CAP;
+				cpuRateInfo.cpu_rate = BOUND(DWORD(1), (100U * limits.cpu_rate) / std::max(sysinfo::get_processor_count(), DWORD(1)), DWORD(10000)); /*1/100 percent of all CPUs*/
+				success = (SetInformationJobObject(job, impl::CPU_RATE_CONTROL_INFORMATION, &cpuRateInfo, sizeof(impl::cpu_rate_control_t)) != FALSE) && success;
+			}
+			if ((limits.io_bandwidth > 0U) || (limits.io_ops > 0U))
+			{
+				static const impl::set_io_rate_control_t set_io_rate_control = (impl::set_io_rate_control_t) GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetIoRateControlInformationJobObject");
+				impl::io_rate_control_t ioRateInfo;
+				memset(&ioRateInfo, 0, sizeof(impl::io_rate_control_t));
+				ioRateInfo.max_bandwidth = LONGLONG(std::min(limits.io_bandwidth, ULONGLONG(MAXLONGLONG)));
+				ioRateInfo.max_iops = LONGLONG(std::min(limits.io_ops, ULONGLONG(MAXLONGLONG)));
+				ioRateInfo.control_flags = impl::IO_RATE_CONTROL_ENABLE;
+				success = set_io_rate_control && (set_io_rate_control(job, &ioRateInfo) != 0) && success;
+			}
+			return success;
+		}
+
+		//Terminate all processes in the job object and wait until they are actually gone
+		//The job is associated with a completion port, which receives JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO once the last process has exited
+		bool terminate_task_job(const HANDLE job, const UINT exit_code, const DWORD timeout)
+		{
+			const HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+			if (!port)
+			{
+				return false;
+			}
+			JOBOBJECT_ASSOCIATE_COMPLETION_PORT jobPortInfo;
+			jobPortInfo.CompletionKey = job;
+			jobPortInfo.CompletionPort = port;
+			bool success = (SetInformationJobObject(job, JobObjectAssociateCompletionPortInformation, &jobPortInfo, sizeof(JOBOBJECT_ASSOCIATE_COMPLETION_PORT)) != FALSE);
+			if (success && (get_active_processes(job) > 0))
+			{
+				success = (TerminateJobObject(job, exit_code) != FALSE);
+				const DWORD start = GetTickCount();
+				while (success && (get_active_processes(job) > 0))
+				{
+					const DWORD elapsed = GetTickCount() - start;
+					DWORD message = 0;
+					ULONG_PTR key = 0;
+					LPOVERLAPPED overlapped = NULL;
+					if ((elapsed >= timeout) || ((!GetQueuedCompletionStatus(port, &message, &key, &overlapped, timeout - elapsed)) && (!overlapped)))
+					{
+						success = false; /*timed out*/
+					}
+				}
+			}
+			CloseHandle(port);
+			return success;
+		}
+	}
+}
+
+// ==========================================================================
+// PROCESS STATISTICS
+// ==========================================================================
+
+namespace utils
+{
+	namespace process
+	{
+		namespace impl
+		{
+			//Convert FILETIME to 64-Bit integer (100 ns units)
+			static inline ULONGLONG filetime_to_uint64(const FILETIME &file_time)
+			{
+				ULARGE_INTEGER temp;
+				temp.LowPart  = file_time.dwLowDateTime;
+				temp.HighPart = file_time.dwHighDateTime;
+				return temp.QuadPart;
+			}
+		}
+
+		//Query resource usage of all processes in the job object of a task, i.e. the whole process tree
+		bool get_job_stats(const HANDLE job, stats_t &stats)
+		{
+			JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accounting;
+			memset(&accounting, 0, sizeof(JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION));
+			if (!QueryInformationJobObject(job, JobObjectBasicAndIoAccountingInformation, &accounting, sizeof(JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION), NULL))
+			{
+				return false;
+			}
+			stats.user_time   = ULONGLONG(accounting.BasicInfo.TotalUserTime.QuadPart)   / 10U;
+			stats.kernel_time = ULONGLONG(accounting.BasicInfo.TotalKernelTime.QuadPart) / 10U;
+			stats.read_bytes  = accounting.IoInfo.ReadTransferCount;
+			stats.write_bytes = accounting.IoInfo.WriteTransferCount;
+			stats.read_ops    = accounting.IoInfo.ReadOperationCount;
+			stats.write_ops   = accounting.IoInfo.WriteOperationCount;
+
+			JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobExtendedLimitInfo;
+			memset(&jobExtendedLimitInfo, 0, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION));
+			if (QueryInformationJobObject(job, JobObjectExtendedLimitInformation, &jobExtendedLimitInfo, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION), NULL))
+			{
+				stats.peak_commit = std::max(stats.peak_commit, ULONGLONG(jobExtendedLimitInfo.PeakJobMemoryUsed));
+			}
+			return true;
+		}
+
+		//Query resource usage of a (terminated) process
+		bool get_process_stats(const HANDLE process, stats_t &stats)
+		{
+			memset(&stats, 0, sizeof(stats_t));
+			bool success = true;
+
+			FILETIME time_create, time_exit, time_kernel, time_user;
+			if (GetProcessTimes(process, &time_create, &time_exit, &time_kernel, &time_user))
+			{
+				const ULONGLONG create = impl::filetime_to_uint64(time_create);
+				ULONGLONG exit = impl::filetime_to_uint64(time_exit);
+				if (exit < 1U)
+				{
+					FILETIME time_now;
+					GetSystemTimeAsFileTime(&time_now);
+					exit = impl::filetime_to_uint64(time_now); /*still running*/
+				}
+				stats.wall_time   = (exit > create) ? ((exit - create) / 10U) : 0U;
+				stats.user_time   = impl::filetime_to_uint64(time_user)   / 10U;
+				stats.kernel_time = impl::filetime_to_uint64(time_kernel) / 10U;
+			}
+			else
+			{
+				success = false;
+			}
+
+			PROCESS_MEMORY_COUNTERS memory_counters;
+			memset(&memory_counters, 0, sizeof(PROCESS_MEMORY_COUNTERS));
+			memory_counters.cb = sizeof(PROCESS_MEMORY_COUNTERS);
+			if (GetProcessMemoryInfo(process, &memory_counters, sizeof(PROCESS_MEMORY_COUNTERS)))
+			{
+				stats.peak_memory = memory_counters.PeakWorkingSetSize;
+				stats.peak_commit = memory_counters.PeakPagefileUsage;
+			}
+			else
+			{
+				success = false;
+			}
+
+			IO_COUNTERS io_counters;
+			memset(&io_counters, 0, sizeof(IO_COUNTERS));
+			if (GetProcessIoCounters(process, &io_counters))
+			{
+				stats.read_bytes  = io_counters.ReadTransferCount;
+				stats.write_bytes = io_counters.WriteTransferCount;
+				stats.read_ops    = io_counters.ReadOperationCount;
+				stats.write_ops   = io_counters.WriteOperationCount;
+			}
+			else
+			{
+				success = false;
+			}
+
+			return success;
+		}
 	}
 }
 
@@ -530,5 +1066,115 @@ namespace utils
 			}
 			return std::wstring();
 		}
+
+		//Replace file contents atomically (write temp file, then rename)
+		bool write_file_atomic(const wchar_t *const path, const char *const data, const DWORD len)
+		{
+			const std::wstring temp_path = std::wstring(path) + L".tmp";
+			const HANDLE handle = CreateFileW(temp_path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (handle != INVALID_HANDLE_VALUE)
+			{
+				DWORD written = 0;
+				const bool success = (WriteFile(handle, data, len, &written, NULL) != FALSE) && (written == len);
+				CloseHandle(handle);
+				if (success && MoveFileExW(temp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING))
+				{
+					return true;
+				}
+				DeleteFileW(temp_path.c_str());
+			}
+			return false;
+		}
+
+		//Create a directory, including any missing parent directories
+		bool create_directories(const wchar_t *const path)
+		{
+			if (CreateDirectoryW(path, NULL))
+			{
+				return true;
+			}
+			const DWORD error = GetLastError();
+			if (error == ERROR_ALREADY_EXISTS)
+			{
+				if (directory_exists(path))
+				{
+					return true;
+				}
+				SetLastError(error);
+				return false;
+			}
+			if (error == ERROR_PATH_NOT_FOUND)
+			{
+				const std::wstring dir(path);
+				const size_t pos = dir.find_last_of(L"/\\", dir.find_last_not_of(L"/\\"));
+				if ((pos != std::wstring::npos) && (pos > 0) && create_directories(dir.substr(0, pos).c_str()))
+				{
+					return (CreateDirectoryW(path, NULL) != FALSE);
+				}
+			}
+			return false;
+		}
+
+		//Compute the SHA-256 digest of a file as hex string, gives up as soon as *cancel becomes TRUE
+		bool hash_file(const wchar_t *const path, std::string &digest, const BOOL *const cancel)
+		{
+			static const DWORD BUFFER_SIZE = 65536U;
+			static const char *const HEX_CHARS = "0123456789abcdef";
+
+			const HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (handle == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			bool success = false;
+			HCRYPTPROV provider = NULL;
+			HCRYPTHASH hash = NULL;
+			if (CryptAcquireContextW(&provider, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT) && CryptCreateHash(provider, CALG_SHA_256, 0, 0, &hash))
+			{
+				std::vector<BYTE> buffer(BUFFER_SIZE);
+				DWORD len = 0;
+				while (ReadFile(handle, &buffer[0], BUFFER_SIZE, &len, NULL))
+				{
+					if (*cancel)
+					{
+						SetLastError(ERROR_OPERATION_ABORTED);
+						break;
+					}
+					if (len == 0)
+					{
+						BYTE value[32];
+						DWORD value_len = sizeof(value);
+						if (success = (CryptGetHashParam(hash, HP_HASHVAL, value, &value_len, 0) != FALSE))
+						{
+							digest.clear();
+							for (DWORD i = 0; i < value_len; i++)
+							{
+								digest.push_back(HEX_CHARS[value[i] >> 4]);
+								digest.push_back(HEX_CHARS[value[i] & 0xF]);
+							}
+						}
+						break;
+					}
+					if (!CryptHashData(hash, &buffer[0], len, 0))
+					{
+						break;
+					}
+				}
+			}
+
+			const DWORD error = GetLastError();
+			if (hash)
+			{
+				CryptDestroyHash(hash);
+			}
+			if (provider)
+			{
+				CryptReleaseContext(provider, 0);
+			}
+			CloseHandle(handle);
+			SetLastError(error);
+			return success;
+		}
 	}
 }
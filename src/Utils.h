@@ -42,6 +42,8 @@ namespace utils
 	{
 		DWORD get_processor_count(void);
 		bool get_current_time(wchar_t *const buffer, const size_t len, const bool simple);
+		ULONGLONG get_timer_value(void);
+		ULONGLONG get_timer_frequency(void);
 	}
 
 	//Console
@@ -49,24 +51,65 @@ namespace utils
 	{
 		void set_console_title(const wchar_t *const fmt, ...);
 		bool inti_console_window(const wchar_t *icon_name);
-		void write_console(const UINT type, const bool colors, const wchar_t *const fmt, va_list &args);
+		void write_console(const UINT type, const bool colors, const wchar_t *const fmt, va_list &args, const bool droppable = false);
+		bool start_async_output(void);
+		void stop_async_output(void);
 	}
 
 	//String support
 	namespace string
 	{
 		bool parse_uint32(const wchar_t *const str, DWORD &value);
+		bool parse_size(const wchar_t *const str, ULONGLONG &value);
 		bool parse_bool(const wchar_t *const str, bool &value);
 		DWORD replace_str(std::wstring& str, const std::wstring& needle, const std::wstring& replacement);
 		bool contains_whitespace(const wchar_t *str);
 		wchar_t *trim_str(wchar_t *str);
 		std::string wstring_to_utf8(const std::wstring& str);
+		void append_utf8(std::string &out, const wchar_t *const str, const size_t len);
+		size_t encode_utf8(const wchar_t *const str, const size_t len, char *const buffer, const size_t capacity);
+		void decode_utf8(std::wstring &out, const char *const str, const size_t len);
 	}
 
 	//Job control
 	namespace jobs
 	{
+		typedef struct _limits_t
+		{
+			ULONGLONG memory;        /*bytes, zero means unlimited*/
+			DWORD     cpu_rate;      /*percent of a single CPU, zero means unlimited*/
+			ULONGLONG io_bandwidth;  /*bytes per second, zero means unlimited*/
+			ULONGLONG io_ops;        /*operations per second, zero means unlimited*/
+		}
+		limits_t;
+
 		bool assign_process_to_job(const HANDLE process);
+		HANDLE create_task_job(const HANDLE process);
+		bool add_to_task_job(const HANDLE job, const HANDLE process);
+		DWORD get_active_processes(const HANDLE job);
+		bool terminate_task_job(const HANDLE job, const UINT exit_code, const DWORD timeout);
+		bool set_task_limits(const HANDLE job, const limits_t &limits);
+	}
+
+	//Process statistics
+	namespace process
+	{
+		typedef struct _stats_t
+		{
+			ULONGLONG wall_time;      /*microseconds*/
+			ULONGLONG user_time;      /*microseconds*/
+			ULONGLONG kernel_time;    /*microseconds*/
+			ULONGLONG peak_memory;    /*bytes, peak working set*/
+			ULONGLONG peak_commit;    /*bytes, peak private commit*/
+			ULONGLONG read_bytes;
+			ULONGLONG write_bytes;
+			ULONGLONG read_ops;
+			ULONGLONG write_ops;
+		}
+		stats_t;
+
+		bool get_process_stats(const HANDLE process, stats_t &stats);
+		bool get_job_stats(const HANDLE job, stats_t &stats);
 	}
 
 	//File utils
@@ -79,6 +122,9 @@ namespace utils
 		std::wstring get_full_path(const wchar_t *const rel_path);
 		bool split_file_name(const wchar_t *const full_path, std::wstring &drive, std::wstring &dir, std::wstring &fname, std::wstring &ext);
 		std::wstring get_running_executable(void);
+		bool write_file_atomic(const wchar_t *const path, const char *const data, const DWORD len);
+		bool create_directories(const wchar_t *const path);
+		bool hash_file(const wchar_t *const path, std::string &digest, const BOOL *const cancel);
 	}
 }
 